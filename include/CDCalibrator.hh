@@ -103,10 +103,10 @@ private:
 	TChain *mbsinfo_tree;
 	MiniballDataPackets *in_data = nullptr;
 	MBSInfoPackets *mbs_info = nullptr;
-	std::shared_ptr<DgfData> dgf_data;
-	std::shared_ptr<AdcData> adc_data;
-	std::shared_ptr<FebexData> febex_data;
-	std::shared_ptr<InfoData> info_data;
+	const DgfData *dgf_data = nullptr;
+	const AdcData *adc_data = nullptr;
+	const FebexData *febex_data = nullptr;
+	const InfoData *info_data = nullptr;
 
 	/// Outputs
 	TFile *output_file;
@@ -7,11 +7,11 @@
 #include <fstream>
 #include <string>
 #include <array>
+#include <vector>
 #include <cstdlib>
 
 #include "TSystem.h"
 #include "TEnv.h"
-#include "TRandom3.h"
 #include "TMath.h"
 #include "TGraph.h"
 
@@ -20,18 +20,33 @@
 # include "Settings.hh"
 #endif
 
+// Counter-based random numbers header
+#ifndef __PHILOX_HH
+# include "Philox.hh"
+#endif
+
 
 class FebexMWD : public TObject {
 	
 public:
 	
 	// Constructor/destructor
-	inline FebexMWD() {};
+	inline FebexMWD() : fixed_point(false), fixed_shift(16) {};
 	virtual inline ~FebexMWD() {};
 
 	// Main algorithm
 	void DoMWD();
 	
+	// Energies, CFD times and the clipped flag only, straight from the
+	// samples. None of the stages are kept, only the few samples of each
+	// one that are needed, so nothing is allocated once it has been used.
+	// Uses DoMWDFixed instead if fixed-point mode is set
+	void DoMWDEnergy( const unsigned short *samples, unsigned int nsamples );
+	
+	// The same as DoMWDEnergy but in integer arithmetic like the firmware,
+	// with fixed_shift fractional bits. The energies are whole numbers
+	void DoMWDFixed( const unsigned short *samples, unsigned int nsamples );
+	
 	// Set functions
 	inline void SetTrace( std::vector<unsigned short> t ){ trace = t; };
 	inline void SetRiseTime( unsigned int t ){ rise_time = t; }; // L
@@ -45,19 +60,21 @@ public:
 	inline void SetIntegrationTime( unsigned int t ){ cfd_integration_time = t; };
 	inline void SetThreshold( unsigned int t ){ threshold = t; };
 	inline void SetFraction( float f ){ fraction = f; };
+	inline void SetFixedPoint( bool f ){ fixed_point = f; };
+	inline void SetFixedShift( unsigned int s ){ fixed_shift = s; };
 
 	// Get functions
-	inline unsigned int NumberOfTriggers(){ return energy_list.size(); };
-	inline float GetEnergy( unsigned int i ){
+	inline unsigned int NumberOfTriggers() const { return energy_list.size(); };
+	inline float GetEnergy( unsigned int i ) const {
 		if( i < energy_list.size() ) return energy_list.at(i);
 		else return -99.9;
 	};
-	inline float GetCfdTime( unsigned int i ){
+	inline float GetCfdTime( unsigned int i ) const {
 		if( i < cfd_list.size() ) return cfd_list.at(i);
 		else return 0;
 	};
-	inline std::vector<float> GetEnergies(){ return energy_list; };
-	inline std::vector<float> GetCfdTimes(){ return cfd_list; };
+	inline std::vector<float> GetEnergies() const { return energy_list; };
+	inline std::vector<float> GetCfdTimes() const { return cfd_list; };
 	inline std::vector<float> GetStage1(){ return stage1; };
 	inline std::vector<float> GetStage2(){ return stage2; };
 	inline std::vector<float> GetStage3(){ return stage3; };
@@ -65,7 +82,10 @@ public:
 	inline std::vector<float> GetCfd(){ return cfd; };
 	
 	// Is it clipped?
-	inline bool IsClipped(){ return clipped; };
+	inline bool IsClipped() const { return clipped; };
+	
+	// Integer or floating point?
+	inline bool IsFixedPoint() const { return fixed_point; };
 	
 	// Graphs
 	inline TGraph* GetTraceGraph() {
@@ -111,6 +131,18 @@ private:
 	// Are any of the samples clipped?
 	bool clipped;
 	
+	// Fixed-point mode and the number of fractional bits
+	bool fixed_point;
+	unsigned int fixed_shift;
+	
+	// Rings of the last few samples of each stage for DoMWDEnergy
+	std::vector<float> ring_differential, ring_shaper, ring_stage3, ring_stage4; //!
+	std::vector<long long int> ring_fixed_differential, ring_fixed_shaper; //!
+	std::vector<long long int> ring_fixed_stage3, ring_fixed_stage4; //!
+	
+	// The batched version takes its parameters from here
+	friend class FebexMWDBatch;
+
 	// Graphs
 	inline TGraph* GetGraph( std::vector<float> &t ) {
 		std::vector<float> x;
@@ -127,10 +159,213 @@ private:
  		return GetGraph(y);
 	};
 
-	ClassDef( FebexMWD, 3 );
+	ClassDef( FebexMWD, 5 );
+	
+};
+
+/// The trigger search of FebexMWD::DoMWD, done one sample at a time as they
+/// come. It looks for the threshold on the CFD, then waits for the zero
+/// crossing, then for the peak of the flat top to get the energy. The
+/// caller keeps stage 4, so it takes the baseline from the sample given at
+/// the crossing and the energy when it is told to. T is the type of the CFD
+/// trace, i.e. float or fixed-point integers.
+
+template<typename T>
+class FebexMWDTrigger {
+	
+public:
+	
+	FebexMWDTrigger( unsigned int nsamples, unsigned int skip, unsigned int cfd_delay,
+					 unsigned int cfd_hold, T threshold, unsigned int flat_top,
+					 unsigned int baseline_length ) :
+		nsamples(nsamples), skip(skip), cfd_delay(cfd_delay), cfd_hold(cfd_hold),
+		threshold(threshold), flat_top(flat_top), baseline_length(baseline_length),
+		state(SEARCH), next(skip), armed_at(0), energy_at(0),
+		baseline_at(0), cfd_prev(0) {};
+	
+	// What was found by Step()
+	enum found_t {
+		BASELINE = 1,	// new baseline at GetBaselineSample()
+		ENERGY   = 2	// energy is stage 4 now minus the baseline
+	};
+	
+	// Nothing more to find
+	inline bool Done() const { return state == DONE; };
+	
+	// Sample i with its CFD value, the CFD times go to cfd_list
+	unsigned int Step( unsigned int i, T cfd, std::vector<float> &cfd_list ) {
+		
+		unsigned int found = 0;
+		
+		// Trigger when we pass the threshold on the CFD
+		if( state == SEARCH && i == next ) {
+			
+			if( i > cfd_delay + skip &&
+			   ( ( cfd > threshold && threshold > 0 ) ||
+				( cfd < threshold && threshold < 0 ) ) ) {
+				state = ARMED;
+				armed_at = i;
+			}
+			else next = i + 1;
+			
+		}
+		
+		// Find the zero crossing, rejecting the wrong polarity
+		else if( state == ARMED &&
+				!( threshold < 0 && cfd_prev > 0 ) &&
+				!( threshold > 0 && cfd_prev < 0 ) &&
+				( ( cfd < 0 && cfd_prev > 0 ) || ( cfd > 0 && cfd_prev < 0 ) ) ) {
+			
+			// Check we have enough trace left to analyse
+			if( nsamples - i <= flat_top ) state = DONE;
+			
+			else {
+				
+				// Mark the CFD time and the baseline, as in DoMWD
+				cfd_list.push_back( i );
+				if( cfd_list.size() == 1 ) {
+					baseline_at = i >= baseline_length ? i - baseline_length : 0;
+					found |= BASELINE;
+				}
+				else if( i >= baseline_length + cfd_list.back() ) {
+					baseline_at = i - baseline_length;
+					found |= BASELINE;
+				}
+				
+				// Wait for the peak of the flat top
+				state = WAIT;
+				energy_at = i + flat_top;
+				
+			}
+			
+		}
+		
+		// Energy from stage 4, then search again after the hold off
+		if( state == WAIT && i == energy_at ) {
+			
+			found |= ENERGY;
+			next = energy_at;
+			if( next < armed_at + cfd_hold )
+				next = armed_at + cfd_hold;
+			next++;
+			state = SEARCH;
+			
+		}
+		
+		cfd_prev = cfd;
+		return found;
+		
+	};
+	
+	inline unsigned int GetBaselineSample() const { return baseline_at; };
+	
+private:
+	
+	unsigned int nsamples, skip, cfd_delay, cfd_hold;
+	T threshold;
+	unsigned int flat_top, baseline_length;
+	
+	enum { SEARCH, ARMED, WAIT, DONE } state;
+	unsigned int next, armed_at, energy_at, baseline_at;
+	T cfd_prev;
+	
+};
+
+/// A trace for the batched MWD, with the results that come back.
+/// The samples are not copied, so they must stay valid until it is done.
+
+struct FebexMWDTrace {
+	
+	unsigned char			sfp, board, ch;
+	const unsigned short	*samples;
+	unsigned int			nsamples;
+	bool					clipped;
+	std::vector<float>		energies;
+	std::vector<float>		cfd_times;
 	
 };
 
+/// The same algorithm as FebexMWD::DoMWD, but for up to BATCH_SIZE traces
+/// with the same length and the same parameters at once. The samples of the
+/// traces are interleaved, so each step of the MWD is done for all traces
+/// together and can use SIMD instructions. The buffers are kept from one
+/// batch to the next, so there are no allocations once it has warmed up.
+
+class FebexMWDBatch {
+	
+public:
+	
+	FebexMWDBatch();
+	~FebexMWDBatch() {};
+	
+	// Maximum number of traces in a batch
+	static const unsigned int BATCH_SIZE = 64;
+	
+	// Parameters for all traces, copied from a FebexMWD
+	void SetParameters( const FebexMWD &mwd );
+	bool SameParameters( const FebexMWD &mwd ) const;
+	static bool CanBatch( const FebexMWD &mwd );
+	
+	// Add a trace, returns false if the batch is full or the length is wrong
+	bool AddTrace( const unsigned short *samples, unsigned int nsamples );
+	inline void Clear(){ ntraces = 0; };
+	
+	// Main algorithm
+	void DoMWD();
+	
+	// Results for each trace
+	inline unsigned int GetNumberOfTraces() const { return ntraces; };
+	inline unsigned int NumberOfTriggers( unsigned int k ) const { return energy_list[k].size(); };
+	inline const std::vector<float>& GetEnergies( unsigned int k ) const { return energy_list[k]; };
+	inline const std::vector<float>& GetCfdTimes( unsigned int k ) const { return cfd_list[k]; };
+	inline bool IsClipped( unsigned int k ) const { return clipped[k]; };
+
+private:
+	
+	// Traces in the batch
+	const unsigned short *traces[BATCH_SIZE];
+	unsigned int ntraces, trace_length;
+	
+	// Samples and stages. The traces are in groups of eight, with the
+	// samples of the traces in a group interleaved, see Offset()
+	unsigned int ngroups;
+	unsigned long Offset( unsigned int k ) const;
+	std::vector<int> trace, differential;
+	std::vector<float> shaper, cfd, stage3, stage4;
+	
+	// Results
+	std::vector<float> energy_list[BATCH_SIZE];
+	std::vector<float> cfd_list[BATCH_SIZE];
+	bool clipped[BATCH_SIZE];
+	
+	// Values of MWD
+	unsigned int rise_time, flat_top, window, baseline_length, decay_time;
+	
+	// Values for CFD
+	unsigned int cfd_delay, cfd_hold, cfd_shaping_time, cfd_integration_time;
+	int threshold;
+
+};
+
+
+/// Energy and time calibration of one FEBEX channel, put together after
+/// the calibration is read so each hit only needs to look up one entry.
+/// Each entry has a cache line of its own.
+
+struct alignas(64) FebexChannelCal {
+
+	double			offset, gain, gain_quadr;
+	double			mwd_offset, mwd_gain;	///< for energies from the MWD of the trace
+	long			time;
+	unsigned int	threshold;
+	float			mwd_threshold;	///< on the MWD energy before calibration
+	unsigned int	id;			///< position in the table, for the random numbers
+	unsigned char	type;		///< one of MiniballCalibration::febex_t
+	bool			valid;		///< false for the entry of unknown channels
+	bool			identity;	///< offset 0, gain 1 and no quadratic term
+
+};
+
 
 /// A class to read in the calibration file in ROOT's TConfig format.
 /// Each ASIC channel can have offset, gain and quadratic terms.
@@ -144,6 +379,9 @@ public:
 	MiniballCalibration( std::string filename, std::shared_ptr<MiniballSettings> myset );
 	~MiniballCalibration() {};
 	void ReadCalibration();
+	bool ReadCache( unsigned long long key );
+	void WriteCache( unsigned long long key );
+	void BuildFebexTable();
 	void PrintCalibration();
 	void SetFile( std::string filename ){
 		fInputFile = filename;
@@ -152,8 +390,15 @@ public:
 		return fInputFile;
 	}
 	
+	// Key for the random numbers used to spread the raw values over their
+	// bin, usually from the file name. The numbers are fixed by the key,
+	// the hit number and the channel, so they don't depend on the order
+	// the hits are done, so every caller has to give the hit number.
+	inline void SetRandomKey( unsigned long long key ){ fRandKey = key; };
+	inline unsigned long long GetRandomKey() const { return fRandKey; };
+
 	// ADC calibrations
-	float			AdcEnergy( unsigned char mod, unsigned char ch, unsigned int raw );
+	float			AdcEnergy( unsigned char mod, unsigned char ch, unsigned int raw, unsigned long long hit );
 	double			AdcOffset( unsigned char mod, unsigned char ch );
 	double			AdcGain( unsigned char mod, unsigned char ch );
 	double			AdcGainQuadr( unsigned char mod, unsigned char ch );
@@ -161,22 +406,47 @@ public:
 	long			AdcTime( unsigned char mod, unsigned char ch );
 	
 	// DGF calibrations
-	float			DgfEnergy( unsigned char mod, unsigned char ch, unsigned int raw );
+	float			DgfEnergy( unsigned char mod, unsigned char ch, unsigned int raw, unsigned long long hit );
 	double			DgfOffset( unsigned char mod, unsigned char ch );
 	double			DgfGain( unsigned char mod, unsigned char ch );
 	double			DgfGainQuadr( unsigned char mod, unsigned char ch );
 	unsigned int	DgfThreshold( unsigned char mod, unsigned char ch );
 	long			DgfTime( unsigned char mod, unsigned char ch );
 	
+	// Types of FEBEX data used for the energy
+	enum febex_t {
+		FEBEX_QSHORT  = 0,
+		FEBEX_QINT    = 1,
+		FEBEX_UNKNOWN = 2
+	};
+
+	// Calibration of a FEBEX channel from the table, or an invalid
+	// entry if the channel doesn't exist
+	inline const FebexChannelCal& GetFebexCal( unsigned char sfp, unsigned char board, unsigned char ch ) const {
+		if( sfp < fFebexNSfp && board < fFebexNBoard && ch < fFebexNCh )
+			return fFebexTable[ ( sfp * fFebexNBoard + board ) * fFebexNCh + ch ];
+		return fFebexTable.back();
+	};
+
 	// Febex calibrations
-	float			FebexEnergy( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int raw );
+	float			FebexEnergy( const FebexChannelCal &fcal, unsigned int raw, unsigned long long hit ) const;
+	void			FebexEnergy( const FebexChannelCal &fcal, const unsigned int *raw, unsigned int n,
+								 unsigned long long first_hit, float *energy ) const;
+	float			FebexMWDEnergy( const FebexChannelCal &fcal, float amplitude ) const;
+	float			FebexEnergy( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int raw, unsigned long long hit );
 	double			FebexOffset( unsigned char sfp, unsigned char board, unsigned char ch );
 	double			FebexGain( unsigned char sfp, unsigned char board, unsigned char ch );
 	double			FebexGainQuadr( unsigned char sfp, unsigned char board, unsigned char ch );
 	unsigned int	FebexThreshold( unsigned char sfp, unsigned char board, unsigned char ch );
 	std::string		FebexType( unsigned char sfp, unsigned char board, unsigned char ch );
+	inline febex_t	FebexTypeID( unsigned char sfp, unsigned char board, unsigned char ch ) const {
+		return (febex_t)GetFebexCal( sfp, board, ch ).type;
+	};
 	long			FebexTime( unsigned char sfp, unsigned char board, unsigned char ch );
+	bool			SetupMWD( unsigned char sfp, unsigned char board, unsigned char ch, FebexMWD &mwd );
 	FebexMWD		DoMWD( unsigned char sfp, unsigned char board, unsigned char ch, std::vector<unsigned short> trace );
+	const FebexMWD&	DoMWDEnergy( unsigned char sfp, unsigned char board, unsigned char ch, const std::vector<unsigned short> &trace );
+	void			DoMWD( std::vector<FebexMWDTrace> &traces );
 	
 	// Set functions for MWD
 	void SetMWDDecay( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int decay );
@@ -184,6 +454,8 @@ public:
 	void SetMWDFlatTop( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int top );
 	void SetMWDBaseline( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int baseline_length );
 	void SetMWDWindow( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int window );
+	void SetMWDFixedPoint( unsigned char sfp, unsigned char board, unsigned char ch, bool fixed );
+	void SetMWDFixedShift( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int shift );
 	void SetCFDFraction( unsigned char sfp, unsigned char board, unsigned char ch, float fraction );
 	void SetCFDDelay( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int delay );
 	void SetCFDHoldOff( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int hold );
@@ -197,6 +469,8 @@ public:
 	unsigned int GetMWDFlatTop( unsigned char sfp, unsigned char board, unsigned char ch );
 	unsigned int GetMWDBaseline( unsigned char sfp, unsigned char board, unsigned char ch );
 	unsigned int GetMWDWindow( unsigned char sfp, unsigned char board, unsigned char ch );
+	bool GetMWDFixedPoint( unsigned char sfp, unsigned char board, unsigned char ch );
+	unsigned int GetMWDFixedShift( unsigned char sfp, unsigned char board, unsigned char ch );
 	float GetCFDFraction( unsigned char sfp, unsigned char board, unsigned char ch );
 	unsigned int GetCFDDelay( unsigned char sfp, unsigned char board, unsigned char ch );
 	unsigned int GetCFDHoldOff( unsigned char sfp, unsigned char board, unsigned char ch );
@@ -210,8 +484,13 @@ public:
 	
 private:
 
+	// List of everything read from the calibration file, for the binary cache
+	template<typename A> void CacheItems( A &ar );
+
 	std::string fInputFile;
-	std::unique_ptr<TRandom3> fRand;
+
+	// Random numbers for the energies
+	unsigned long long fRandKey;
 	
 	bool default_qint;
 	
@@ -238,6 +517,13 @@ private:
 	std::vector< std::vector<std::vector<double>> > fFebexGain;
 	std::vector< std::vector<std::vector<double>> > fFebexGainQuadr;
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexThreshold;
+	std::vector< std::vector<std::vector<double>> > fFebexMWD_Offset; // linear calibration of the MWD energies,
+	std::vector< std::vector<std::vector<double>> > fFebexMWD_Gain;   // which aren't in the units of Qint or Qshort
+	std::vector< std::vector<std::vector<double>> > fFebexMWD_Threshold; // and a threshold on them in the same units
+
+	// The same, as a flat table by channel with the invalid entry at the end
+	std::vector<FebexChannelCal> fFebexTable; //!
+	unsigned int fFebexNSfp, fFebexNBoard, fFebexNCh; //!
 
 	// MWD + CFD
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Decay;
@@ -245,6 +531,8 @@ private:
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Top;
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Baseline;
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Window;
+	std::vector< std::vector<std::vector<bool>> > fFebexMWD_FixedPoint; // integer MWD like the firmware
+	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_FixedShift; // fractional bits of the integer MWD
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexCFD_Delay;
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexCFD_HoldOff;
 	std::vector< std::vector<std::vector<unsigned int>> > fFebexCFD_Shaping;
@@ -258,6 +546,8 @@ private:
 	unsigned int default_FebexMWD_Top;
 	unsigned int default_FebexMWD_Baseline;
 	unsigned int default_FebexMWD_Window;
+	bool default_FebexMWD_FixedPoint;
+	unsigned int default_FebexMWD_FixedShift;
 	float default_FebexCFD_Fraction;
 	unsigned int default_FebexCFD_Delay;
 	unsigned int default_FebexCFD_HoldOff;
@@ -266,7 +556,7 @@ private:
 	int default_FebexCFD_Threshold;
 
 	
-	ClassDef( MiniballCalibration, 4 )
+	ClassDef( MiniballCalibration, 7 )
    
 };
 
@@ -0,0 +1,153 @@
+#ifndef __CONFIGCACHE_HH
+#define __CONFIGCACHE_HH
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <type_traits>
+
+/// Binary copies of the settings and calibration after they have been read
+/// from their text files, so that the next time we don't have to go through
+/// the thousands of TEnv lookups again. The cache is a hidden file next to
+/// the text file and has a key made from a hash of the text. If the text
+/// changes, the key doesn't match and the text is read as normal.
+///
+/// The classes list their members once in a CacheItems( A &ar ) template,
+/// which is used with the writer to save them and the reader to load them,
+/// so the two can't get out of step. Change CONFIG_CACHE_VERSION when any
+/// of the lists change.
+
+const unsigned long long CONFIG_CACHE_VERSION = 4;
+
+/// Mix a value into a hash (64-bit FNV-1a)
+inline unsigned long long ConfigCacheMix( unsigned long long h, const void *p, std::size_t n ) {
+	const unsigned char *c = (const unsigned char*)p;
+	for( std::size_t i = 0; i < n; ++i ) {
+		h ^= c[i];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+};
+inline unsigned long long ConfigCacheMix( unsigned long long h, unsigned long long x ) {
+	return ConfigCacheMix( h, &x, sizeof(x) );
+};
+
+/// Hash of the contents of a text file, false if it can't be read
+bool ConfigFileHash( const std::string &file_name, unsigned long long &hash );
+
+/// Name of the cache for a text file, e.g. dir/.settings.dat.settings.cache
+std::string ConfigCacheName( const std::string &file_name, const std::string &tag );
+
+
+/// Puts the items one after the other into a buffer, then into the file
+class MiniballCacheWriter {
+
+public:
+
+	MiniballCacheWriter() {};
+	~MiniballCacheWriter() {};
+
+	template<typename T> void Item( T &x ) {
+		static_assert( std::is_trivially_copyable<T>::value, "Only plain values can be cached" );
+		buf.append( (const char*)&x, sizeof(T) );
+	};
+	void Item( std::string &s ) {
+		unsigned long n = s.size();
+		Item( n );
+		buf.append( s );
+	};
+	void Item( std::vector<bool> &v ) {
+		unsigned long n = v.size();
+		Item( n );
+		for( unsigned long i = 0; i < n; ++i ) buf.push_back( v[i] ? 1 : 0 );
+	};
+	template<typename T> void Item( std::vector<T> &v ) {
+		unsigned long n = v.size();
+		Item( n );
+		if constexpr( std::is_arithmetic<T>::value )
+			buf.append( (const char*)v.data(), n * sizeof(T) );
+		else for( auto &x : v ) Item( x );
+	};
+
+	// Write the file, or return false if we can't
+	bool Save( const std::string &cache_name, unsigned long long key );
+
+private:
+
+	std::string buf;
+
+};
+
+
+/// Memory maps a cache file and takes the items back out of it
+class MiniballCacheReader {
+
+public:
+
+	MiniballCacheReader();
+	~MiniballCacheReader();
+
+	// Map the file, false if it isn't there or has the wrong key
+	bool Open( const std::string &cache_name, unsigned long long key );
+
+	// True if everything was read and nothing is left over
+	inline bool Good() const { return good && pos == size; };
+
+	template<typename T> void Item( T &x ) {
+		static_assert( std::is_trivially_copyable<T>::value, "Only plain values can be cached" );
+		if( !Need( sizeof(T) ) ) return;
+		std::memcpy( (void*)&x, data + pos, sizeof(T) );
+		pos += sizeof(T);
+	};
+	void Item( std::string &s ) {
+		unsigned long n = 0;
+		Item( n );
+		if( !Need( n ) ) return;
+		s.assign( data + pos, n );
+		pos += n;
+	};
+	void Item( std::vector<bool> &v ) {
+		unsigned long n = 0;
+		Item( n );
+		if( !Need( n ) ) return;
+		v.resize( n );
+		for( unsigned long i = 0; i < n; ++i ) v[i] = data[pos+i];
+		pos += n;
+	};
+	template<typename T> void Item( std::vector<T> &v ) {
+		unsigned long n = 0;
+		Item( n );
+		if constexpr( std::is_arithmetic<T>::value ) {
+			if( n > size || !Need( n * sizeof(T) ) ) return;
+			v.resize( n );
+			std::memcpy( (void*)v.data(), data + pos, n * sizeof(T) );
+			pos += n * sizeof(T);
+		}
+		else {
+			if( n > size - pos ) { good = false; return; }
+			v.resize( n );
+			for( auto &x : v ) Item( x );
+		}
+	};
+
+private:
+
+	// Check there are n more bytes to read
+	inline bool Need( std::size_t n ) {
+		if( !good || n > size - pos ) good = false;
+		return good;
+	};
+
+	void *map;
+	const char *data;	///< first byte after the header
+	std::size_t size;	///< number of bytes after the header
+	std::size_t pos;
+	bool good;
+
+};
+
+#endif
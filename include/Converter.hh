@@ -10,6 +10,7 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <limits>
 
 #include <TFile.h>
 #include <TTree.h>
@@ -37,6 +38,16 @@
 # include "DataPackets.hh"
 #endif
 
+// Hit store header
+#ifndef __HITSTORE_HH
+# include "HitStore.hh"
+#endif
+
+// Radix sort header
+#ifndef __RADIXSORT_HH
+# include "RadixSort.hh"
+#endif
+
 
 class MiniballConverter {
 	
@@ -51,13 +62,15 @@ public:
 	void MakeTree();
 	void StartFile();
 	void BuildMbsIndex();
-	void SortDataVector();
-	void SortDataMap();
+	void SortDataMap( bool verbose = true );
+	void FillSortedTree();
+	void StreamHits();
+	void FlushHits( long long int watermark );
+	void SpillHits();
+	unsigned long long int MergeSpills();
 	unsigned long long int SortTree( bool do_sort = true );
-	static bool TimeComparator( const std::shared_ptr<MiniballDataPackets> &lhs,
-							    const std::shared_ptr<MiniballDataPackets> &rhs );
-	static bool MapComparator( const std::pair<unsigned long,double> &lhs,
-							   const std::pair<unsigned long,double> &rhs );
+	static bool MapComparator( const std::pair<long long int,unsigned long> &lhs,
+							   const std::pair<long long int,unsigned long> &rhs );
 
 	void SetOutput( std::string output_file_name );
 	inline void SetOutputDirectory( std::string output_dir ){ output_dir_name = output_dir; };
@@ -75,6 +88,7 @@ public:
 	inline TTree* GetTree(){ return GetSortedTree(); };
 	inline TTree* GetMbsInfo(){ return mbsinfo_tree; };
 	inline TTree* GetSortedTree(){ return sorted_tree; };
+	inline TTree* GetTraceTree(){ return trace_tree; };
 
 	inline void AddCalibration( std::shared_ptr<MiniballCalibration> mycal ){ cal = mycal; };
 	inline void SourceOnly(){ flag_source = true; };
@@ -89,6 +103,12 @@ public:
 		}
 	};
 
+	// Threads used to decode data and time order the hits
+	inline void SetNumberOfThreads( unsigned int n ){
+		if( n > 0 ) nthreads = n;
+		else nthreads = 1;
+	};
+
 	inline void AddProgressBar( std::shared_ptr<TGProgressBar> myprog ){
 		prog = myprog;
 		_prog_ = true;
@@ -147,6 +167,7 @@ protected:
 
 	// For traces
 	unsigned int nsamples;
+	static const long long FEBEX_SAMPLE_TIME = 10;	// ns per sample
 
 	// Flag depending on the data type
 	bool mbs_data, midas_data, med_data;
@@ -161,20 +182,41 @@ protected:
 	// Data types
 	std::shared_ptr<MBSInfoPackets> mbsinfo_packet = nullptr;
 	std::shared_ptr<MiniballDataPackets> write_packet = nullptr;
+	std::shared_ptr<MiniballTracePackets> trace_packet = nullptr;
 	std::shared_ptr<DgfData> dgf_data;
 	std::shared_ptr<AdcData> adc_data;
 	std::shared_ptr<FebexData> febex_data;
 	std::shared_ptr<InfoData> info_data;
 
-	// Vector for storing the data packets before time ordering
-	std::vector<std::shared_ptr<MiniballDataPackets>> data_vector;
-	std::vector<std::pair<unsigned long,double>> data_map;
+	// Number of threads for decoding and sorting
+	unsigned int nthreads = 1;
+
+	// Store for the hits before time ordering and the time-ordered index
+	MiniballHitStore hit_store;
+	std::vector<std::pair<long long int,unsigned long>> data_map;
+
+	// Streaming time ordering, when we write the hits as we go along.
+	// The watermark is the time before which everything has been written.
+	MiniballHitStore stream_store;					// hits left over after a flush
+	std::vector<long long int> stream_time;			// latest time seen from each SFP/module
+	std::vector<unsigned long> stream_block;		// block when each SFP/module last sent something
+	unsigned long stream_nblock;					// number of blocks streamed so far
+	long long int stream_watermark;
+	unsigned long stream_checked;					// hits in the store already looked at
+	unsigned long long int stream_ctr;				// hits already written to the tree
+	unsigned long long int late_ctr;				// hits that arrived behind the watermark
+
+	// Time-ordered runs of hits spilled to disk when we reach the memory limit
+	std::vector<FILE*> spill_files;
+	unsigned long long int spill_ctr;				// hits in the spill files
+	bool spill_error;								// couldn't write to disk, so we stopped trying
 
 	// Output stuff
 	std::string output_dir_name;
 	TFile *output_file;
 	TTree *sorted_tree;
 	TTree *mbsinfo_tree;
+	TTree *trace_tree;
 
 	// Counters
 	std::vector<unsigned long int> ctr_dgf_hit;						// hits on each DGF module
@@ -203,6 +245,7 @@ protected:
 	std::vector<std::vector<std::vector<TH1F*>>> hfebex_qshort;
 	std::vector<std::vector<std::vector<TH1F*>>> hfebex_cal;
 	std::vector<std::vector<std::vector<TH1F*>>> hfebex_mwd;
+	std::vector<std::vector<std::vector<TH2F*>>> hfebex_mwd_qint;	// only MIDAS channels with the fixed-point MWD
 	
 	TH1F *hhit_time;
 	
@@ -163,14 +163,14 @@ public:
 	inline void SetClipped( bool c ){ clipped = c; };
 
 	// Getters
-	inline long long				GetTime(){ return time; };
-	inline unsigned char			GetModule(){ return mod; };
-	inline unsigned char			GetChannel(){ return ch; };
-	inline unsigned long long int	GetEventID() { return eventid; };
-	inline unsigned int				GetQshort() { return Qshort; };
-	inline float					GetEnergy() { return energy; };
-	inline bool						IsOverThreshold() { return thres; };
-	inline bool						IsClipped() { return clipped; };
+	inline long long				GetTime() const { return time; };
+	inline unsigned char			GetModule() const { return mod; };
+	inline unsigned char			GetChannel() const { return ch; };
+	inline unsigned long long int	GetEventID() const { return eventid; };
+	inline unsigned int				GetQshort() const { return Qshort; };
+	inline float					GetEnergy() const { return energy; };
+	inline bool						IsOverThreshold() const { return thres; };
+	inline bool						IsClipped() const { return clipped; };
 
 protected:
 
@@ -208,27 +208,29 @@ public:
 	inline void SetLongFastTriggerTime( long long time ){ LongFastTriggerTime = time; };
 	inline void SetUserValues( std::vector<unsigned short> q ) { UserValues = q; };
 	inline void	SetTrace( std::vector<unsigned short> t ) { trace = t; };
+	inline void SetUserValues( const unsigned short *q, unsigned int n ) { UserValues.assign( q, q + n ); };
+	inline void	SetTrace( const unsigned short *t, unsigned int n ) { trace.assign( t, t + n ); };
 	inline void AddSample( unsigned short s ) { trace.push_back(s); };
 	inline void SetModule( unsigned char m ){ mod = m; };
 	inline void SetChannel( unsigned char c ){ ch = c; };
 	inline void SetThreshold( bool t ){ thres = t; };
 
 	// Getters
-	inline long long					GetTime(){ return GetLongFastTriggerTime(); };
-	inline long long					GetEventTime(){ return EventTime; };
-	inline long long					GetLongFastTriggerTime(){ return LongFastTriggerTime; };
-	inline unsigned short				GetFastTriggerTime(){ return FastTriggerTime; };
-	inline unsigned short				GetRunTime(){ return RunTime; };
-	inline unsigned char				GetModule(){ return mod; };
-	inline unsigned char				GetChannel(){ return ch; };
-	inline unsigned long long int		GetEventID() { return eventid; };
-	inline unsigned int					GetQshort() { return Qshort; };
-	inline float						GetEnergy() { return energy; };
-	inline unsigned short				GetHitPattern(){ return HitPattern; };
-	inline std::vector<unsigned short>	GetUserValues(){ return UserValues; };
-	inline bool							IsOverThreshold() { return thres; };
-	inline unsigned short				GetTraceLength() { return trace.size(); };
-	inline std::vector<unsigned short>	GetTrace() { return trace; };
+	inline long long					GetTime() const { return GetLongFastTriggerTime(); };
+	inline long long					GetEventTime() const { return EventTime; };
+	inline long long					GetLongFastTriggerTime() const { return LongFastTriggerTime; };
+	inline unsigned short				GetFastTriggerTime() const { return FastTriggerTime; };
+	inline unsigned short				GetRunTime() const { return RunTime; };
+	inline unsigned char				GetModule() const { return mod; };
+	inline unsigned char				GetChannel() const { return ch; };
+	inline unsigned long long int		GetEventID() const { return eventid; };
+	inline unsigned int					GetQshort() const { return Qshort; };
+	inline float						GetEnergy() const { return energy; };
+	inline unsigned short				GetHitPattern() const { return HitPattern; };
+	inline const std::vector<unsigned short>& GetUserValues() const { return UserValues; };
+	inline bool							IsOverThreshold() const { return thres; };
+	inline unsigned short				GetTraceLength() const { return trace.size(); };
+	inline const std::vector<unsigned short>& GetTrace() const { return trace; };
 	inline TGraph* GetTraceGraph() {
 		std::vector<int> x, y;
 		std::string title = "Trace for DGF Mod " + std::to_string( GetModule() );
@@ -243,7 +245,7 @@ public:
         g.get()->SetTitle( title.data() );
 		return (TGraph*)g.get()->Clone();
 	};
-	inline unsigned short				GetSample( unsigned int i = 0 ) {
+	inline unsigned short				GetSample( unsigned int i = 0 ) const {
 		if( i >= trace.size() ) return 0;
 		return trace.at(i);
 	};
@@ -285,6 +287,7 @@ public:
 		sfp = 0;
 		board = 0;
 		ch = 0;
+		recovered = false;
 	};
 	FebexData( long long int t, unsigned long long int id,
 			  unsigned int qi, unsigned short qs,
@@ -293,20 +296,21 @@ public:
 			  bool th, bool p, bool cl, bool f );
 	~FebexData() {};
 
-	inline long long int				GetTime() { return time; };
-	inline unsigned long long int		GetEventID() { return eventid; };
-	inline unsigned short				GetTraceLength() { return trace.size(); };
-	inline unsigned short				GetQshort() { return Qshort; };
-	inline unsigned int					GetQint() { return Qint; };
-	inline unsigned char				GetSfp() { return sfp; };
-	inline unsigned char				GetBoard() { return board; };
-	inline unsigned char				GetChannel() { return ch; };
-	inline float						GetEnergy() { return energy; };
-	inline bool							IsOverThreshold() { return thres; };
-	inline bool							IsPileup() { return pileup; };
-	inline bool							IsClipped() { return clipped; };
-	inline bool							HasFlag() { return flagbit; };
-	inline std::vector<unsigned short>	GetTrace() { return trace; };
+	inline long long int				GetTime() const { return time; };
+	inline unsigned long long int		GetEventID() const { return eventid; };
+	inline unsigned short				GetTraceLength() const { return trace.size(); };
+	inline unsigned short				GetQshort() const { return Qshort; };
+	inline unsigned int					GetQint() const { return Qint; };
+	inline unsigned char				GetSfp() const { return sfp; };
+	inline unsigned char				GetBoard() const { return board; };
+	inline unsigned char				GetChannel() const { return ch; };
+	inline float						GetEnergy() const { return energy; };
+	inline bool							IsOverThreshold() const { return thres; };
+	inline bool							IsPileup() const { return pileup; };
+	inline bool							IsClipped() const { return clipped; };
+	inline bool							HasFlag() const { return flagbit; };
+	inline bool							IsRecovered() const { return recovered; };
+	inline const std::vector<unsigned short>& GetTrace() const { return trace; };
 	inline TGraph* GetTraceGraph() {
 		std::vector<int> x, y;
 		std::string title = "Trace for SFP " + std::to_string( GetSfp() );
@@ -321,7 +325,7 @@ public:
         g.get()->SetTitle( title.data() );
 		return (TGraph*)g.get()->Clone();
 	};
-	inline unsigned short				GetSample( unsigned int i = 0 ) {
+	inline unsigned short				GetSample( unsigned int i = 0 ) const {
 		if( i >= trace.size() ) return 0;
 		return trace.at(i);
 	};
@@ -329,7 +333,13 @@ public:
 	inline void	SetTime( long long int t ) { time = t; };
 	inline void	SetEventID( unsigned long long int id ) { eventid = id; };
 	inline void	SetTrace( std::vector<unsigned short> t ) { trace = t; };
+	inline void	SetTrace( const unsigned short *t, unsigned int n ) { trace.assign( t, t + n ); };
 	inline void AddSample( unsigned short s ) { trace.push_back(s); };
+	inline unsigned short* NewSamples( unsigned int n ) {
+		trace.resize( trace.size() + n );
+		return trace.data() + trace.size() - n;
+	};
+	inline void ResizeTrace( unsigned int n ) { trace.resize(n); };
 	inline void	SetQshort( unsigned short q ) { Qshort = q; };
 	inline void	SetQint( unsigned int q ) { Qint = q; };
 	inline void SetSfp( unsigned char s ){ sfp = s; };
@@ -340,6 +350,7 @@ public:
 	inline void SetPileup( bool p ){ pileup = p; };
 	inline void SetClipped( bool cl ){ clipped = cl; };
 	inline void SetFlag( bool f ){ flagbit = f; };
+	inline void SetRecovered( bool r ){ recovered = r; };
 
 	inline void ClearTrace() { trace.clear(); };
 	void ClearData();
@@ -359,9 +370,10 @@ protected:
 	bool							pileup;		///< pileup flag from data stream
 	bool							clipped;	///< clipped pulse flag from data stream
 	bool							flagbit;	///< additional flag bit from data stream
+	bool							recovered;	///< energy from the MWD of a piled-up trace, not the firmware
 
 	
-	ClassDef( FebexData, 7 )
+	ClassDef( FebexData, 8 )
 	
 };
 
@@ -379,11 +391,11 @@ public:
 	InfoData( long long int t, unsigned long long int id, unsigned char s, unsigned char b, unsigned char m );
 	~InfoData() {};
 	
-	inline long long int			GetTime(){ return time; };
-	inline unsigned long long int	GetEventID(){ return eventid; };
-	inline unsigned char 			GetCode(){ return code; };
-	inline unsigned char			GetSfp(){ return sfp; };
-	inline unsigned char			GetBoard(){ return board; };
+	inline long long int			GetTime() const { return time; };
+	inline unsigned long long int	GetEventID() const { return eventid; };
+	inline unsigned char 			GetCode() const { return code; };
+	inline unsigned char			GetSfp() const { return sfp; };
+	inline unsigned char			GetBoard() const { return board; };
 
 	inline void SetTime( long long int t ){ time = t; };
 	inline void SetEventID( unsigned long long int id ){ eventid = id; };
@@ -439,6 +451,7 @@ public:
 	void SetData( std::shared_ptr<InfoData> data );
 
 	// These methods are not very safe for access
+	// They return a copy of the data, so use the references below to read a hit
 	inline std::shared_ptr<DgfData> GetDgfData() const {
 		return std::make_shared<DgfData>( dgf_packets.at(0) );
 	};
@@ -452,6 +465,13 @@ public:
 		return std::make_shared<InfoData>( info_packets.at(0) );
 	};
 
+	// Read the data in place, without copying. Check the type with IsFebex() etc.
+	// first and don't keep them beyond the next GetEntry() of the tree
+	inline const DgfData& GetDgfDataRef() const { return dgf_packets[0]; };
+	inline const AdcData& GetAdcDataRef() const { return adc_packets[0]; };
+	inline const FebexData& GetFebexDataRef() const { return febex_packets[0]; };
+	inline const InfoData& GetInfoDataRef() const { return info_packets[0]; };
+
 	// Complicated way to get the time...
 	unsigned long long int GetEventID() const;
 	long long int GetTime() const;
@@ -481,6 +501,45 @@ protected:
 };
 
 
+/// Traces are kept out of the mb_sort tree so that reading the hits doesn't
+/// have to read the traces too. Each one is stored here with the entry
+/// number of its hit in the mb_sort tree. The samples are delta encoded and
+/// zigzagged so that small changes are small numbers, which ROOT compresses
+/// much better than the raw ADC values.
+
+class MiniballTracePackets : public TObject {
+
+public:
+
+	MiniballTracePackets() {
+		entry = -1;
+	};
+	~MiniballTracePackets() {};
+
+	void ClearData();
+
+	// Setters, the trace is encoded as it is set
+	inline void SetEntry( long long int e ){ entry = e; };
+	void SetTrace( const unsigned short *t, unsigned short n );
+	inline void SetTrace( const std::vector<unsigned short> &t ){
+		SetTrace( t.data(), t.size() );
+	};
+
+	// Getters, the trace is decoded as it is read
+	inline long long int			GetEntry() const { return entry; };
+	inline unsigned short			GetTraceLength() const { return samples.size(); };
+	std::vector<unsigned short>		GetTrace() const;
+
+protected:
+
+	long long int					entry;		///< entry number of the hit in the mb_sort tree
+	std::vector<unsigned short>		samples;	///< delta and zigzag encoded samples
+
+	ClassDef( MiniballTracePackets, 1 )
+
+};
+
+
 class MBSInfoPackets : public TObject {
 	
 public:
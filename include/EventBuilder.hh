@@ -6,7 +6,11 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <algorithm>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include <TFile.h>
 #include <TTree.h>
@@ -69,6 +73,9 @@ public:
 		prog = myprog;
 		_prog_ = true;
 	};
+	inline void SetNumberOfThreads( unsigned int n ){
+		nthreads = n > 0 ? n : 1;
+	};
 
 	unsigned long	BuildEvents();
 
@@ -104,17 +111,34 @@ public:
 
 
 private:
-	
+
+	// Building a range of entries, all of them or one chunk of them
+	void	BuildRange( unsigned long first, unsigned long last );
+
+	// Split the input at quiet gaps and build the chunks in threads
+	void	BuildParallel();
+	void	PrescanEntry( unsigned long i );
+	void	AddChunk( MiniballEventBuilder &chunk );
+
+	// Index the Miniball hit just added by crystal
+	void	BucketMiniballHit( const MiniballChannelID &chan );
+
+	// Index the CD hit just added by detector, sector and side
+	void	BucketCDHit( const MiniballChannelID &chan );
+
+	// Output file, tree and histograms without the log file
+	void	OpenOutput( std::string output_file_name );
+
 	/// Input tree
 	TFile *input_file;
 	TTree *input_tree;
 	TTree *mbsinfo_tree;
 	MiniballDataPackets *in_data;
 	MBSInfoPackets *mbs_info;
-	std::shared_ptr<DgfData> dgf_data;
-	std::shared_ptr<AdcData> adc_data;
-	std::shared_ptr<FebexData> febex_data;
-	std::shared_ptr<InfoData> info_data;
+	const DgfData *dgf_data = nullptr;
+	const AdcData *adc_data = nullptr;
+	const FebexData *febex_data = nullptr;
+	const InfoData *info_data = nullptr;
 
 	/// Outputs
 	TFile *output_file;
@@ -149,6 +173,11 @@ private:
 	
 	// Flag to know we've opened a file on disk
 	bool flag_input_file;
+	std::string input_name;
+
+	// Threads for building the chunks in parallel
+	unsigned int nthreads;
+	std::atomic<unsigned long> *nbuilt;	///< entries done by all threads, nullptr when serial
 
 	// Build window which comes from the settings file
 	long build_window;  /// length of build window in ns
@@ -198,6 +227,11 @@ private:
 	std::vector<unsigned char>			mb_clu_list;	///< list of cluster IDs
 	std::vector<unsigned char>			mb_cry_list;	///< list of crystal IDs
 	std::vector<unsigned char>			mb_seg_list;	///< list of segment IDs
+	std::vector<unsigned int>			mb_core_index;	///< indices of the cores in the lists above
+	std::vector<std::vector<unsigned int>>	mb_seg_bucket;	///< indices of the segments for each crystal, clu * crystals + cry
+	std::vector<unsigned int>			mb_seg_bucket_used;	///< crystals with segment hits
+	std::vector<std::vector<unsigned int>>	mb_clu_gammas;	///< gamma-ray singles in each cluster, for addback
+	std::vector<bool>					mb_ab_used;		///< gamma-ray singles already added back
 
 	// CD detector specific variables
 	std::vector<float>					cd_en_list;		///< list of CD energies for ParticleFinder
@@ -206,6 +240,8 @@ private:
 	std::vector<unsigned char>			cd_sec_list;	///< list of CD sector IDs
 	std::vector<unsigned char>			cd_side_list;	///< list of CD side IDs; 0 = p, 1 = n
 	std::vector<unsigned char>			cd_strip_list;	///< list of CD strip IDs
+	std::vector<std::vector<unsigned int>>	cd_bucket;		///< indices in the CD lists for each detector, sector and side
+	std::vector<unsigned int>			cd_bucket_used;	///< detector elements with hits, det * sectors + sec
 
 	// PAD detector specific variables
 	std::vector<float>					pad_en_list;	///< list of PAD energies for ParticleFinder
@@ -0,0 +1,177 @@
+#ifndef __HITSTORE_HH
+#define __HITSTORE_HH
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cstdio>
+
+// Data packets header
+#ifndef __DATAPACKETS_HH
+# include "DataPackets.hh"
+#endif
+
+/// A compact, fixed-size record of a single hit. This holds everything
+/// that goes into a MiniballDataPackets entry, apart from the trace and the
+/// DGF user values which live in a separate pool in the MiniballHitStore.
+
+struct MiniballHit {
+
+	long long int			time;			///< timestamp, as given by MiniballDataPackets::GetTime()
+	unsigned long long int	eventid;		///< MBS event ID
+	long long int			event_time;		///< DGF event time
+	unsigned long			trace_offset;	///< position of the first sample in the trace pool
+	float					energy;			///< calibrated energy
+	unsigned int			Qint;			///< FEBEX 32-bit charge
+	unsigned short			trace_length;	///< number of samples in the trace
+	unsigned short			user_length;	///< number of DGF user values, stored after the trace
+	unsigned short			Qshort;			///< 16-bit charge
+	unsigned short			run_time;		///< DGF run time
+	unsigned short			fast_time;		///< DGF fast trigger time
+	unsigned short			hit_pattern;	///< DGF hit pattern
+	unsigned char			type;			///< one of MiniballHitStore::hit_t
+	unsigned char			sfp;			///< SFP ID, or module for DGF and ADC
+	unsigned char			board;			///< board ID
+	unsigned char			ch;				///< channel ID, or the code for info data
+	unsigned char			flags;			///< threshold, pileup, clipped, flag and recovered bits
+	unsigned int			run;			///< index of the run this hit belongs to
+
+};
+
+/// Hits from the same source, i.e. the same SFP and board, come out of the
+/// DAQ almost in time order. We keep track of these runs so that the time
+/// ordering only has to merge them, rather than sort everything again.
+
+struct MiniballHitRun {
+
+	long long int			last_time;		///< time of the last hit added to the run
+	unsigned long			nhits;			///< number of hits in the run
+	bool					ordered;		///< false if a hit came before the previous one
+
+};
+
+
+/// A class to keep all the hits from a file before they are time ordered.
+/// The hits are stored in fixed-size chunks so we never have to copy them
+/// when the store grows, and there are no per-hit heap allocations.
+
+class MiniballHitStore {
+
+public:
+
+	MiniballHitStore();
+	~MiniballHitStore() {};
+
+	// Types of hit
+	enum hit_t {
+		HIT_FEBEX = 0,
+		HIT_INFO  = 1,
+		HIT_DGF   = 2,
+		HIT_ADC   = 3
+	};
+
+	// Bits in the flags word
+	enum flag_t {
+		FLAG_THRES     = 1,
+		FLAG_PILEUP    = 2,
+		FLAG_CLIPPED   = 4,
+		FLAG_BIT       = 8,
+		FLAG_RECOVERED = 16
+	};
+
+	void Clear();
+	void Reset();
+	void Swap( MiniballHitStore &other );
+
+	// Add hits from the data types
+	void Add( std::shared_ptr<FebexData> data );
+	void Add( std::shared_ptr<InfoData> data );
+	void Add( std::shared_ptr<DgfData> data );
+	void Add( std::shared_ptr<AdcData> data );
+
+	// Copy hit number i from another store, with its samples
+	void AddHit( const MiniballHitStore &from, unsigned long i );
+
+	// Number of hits and access to them
+	inline unsigned long size() const { return nhits; };
+	inline const MiniballHit& GetHit( unsigned long i ) const {
+		return chunks[ i >> HIT_CHUNK_BITS ][ i & ( HIT_CHUNK_SIZE - 1 ) ];
+	};
+	inline long long int GetTime( unsigned long i ) const {
+		return GetHit(i).time;
+	};
+
+	// Runs of hits from each source
+	inline unsigned int GetNumberOfRuns() const { return runs.size(); };
+	inline unsigned long GetRunSize( unsigned int r ) const { return runs[r].nhits; };
+	inline bool IsRunOrdered( unsigned int r ) const { return runs[r].ordered; };
+	inline unsigned int GetRun( unsigned long i ) const {
+		return GetHit(i).run;
+	};
+
+	inline const unsigned short* GetSamples( unsigned long offset ) const {
+		return trace_chunks[ offset >> TRACE_CHUNK_BITS ].get() + ( offset & ( TRACE_CHUNK_SIZE - 1 ) );
+	};
+
+	// Put hit number i into a data packet ready to be written to the tree.
+	// If there is a trace packet, the trace goes there instead of the hit
+	void FillPacket( unsigned long i, std::shared_ptr<MiniballDataPackets> packet,
+					 std::shared_ptr<MiniballTracePackets> trace_packet = nullptr );
+	void FillPacket( const MiniballHit &hit, const unsigned short *samples,
+					 std::shared_ptr<MiniballDataPackets> packet,
+					 std::shared_ptr<MiniballTracePackets> trace_packet = nullptr );
+
+	// Write hit number i to a binary file, or read one back
+	bool WriteHit( unsigned long i, FILE *fp ) const;
+	static bool ReadHit( FILE *fp, MiniballHit &hit, std::vector<unsigned short> &samples );
+
+	// Memory allocated by the store in bytes, and the part of it in use
+	unsigned long long int GetMemoryUsage() const;
+	inline unsigned long long int GetMemoryInUse() const {
+		return nhits * sizeof(MiniballHit) + nsamples * sizeof(unsigned short);
+	};
+
+private:
+
+	// Get a new record at the end of the store
+	MiniballHit& NewHit();
+
+	// Add the hit to the run for its source, once the time and IDs are set
+	void AddToRun( MiniballHit &hit );
+
+	// Copy samples into the trace pool and return the offset
+	unsigned long AddSamples( const unsigned short *s1, unsigned long n1,
+							  const unsigned short *s2, unsigned long n2 );
+
+	// Number of samples that fit in the 16-bit lengths of a hit
+	unsigned short FitLength( std::size_t n, const char *what );
+	static const unsigned int MAX_TRACE_LENGTH = 0xFFFF;
+
+	// Get space for n samples in the trace pool
+	unsigned short* NewSamples( unsigned long n, unsigned long &offset );
+
+	// Sizes of the chunks, must be powers of two
+	static const unsigned int HIT_CHUNK_BITS = 16;
+	static const unsigned long HIT_CHUNK_SIZE = 1UL << HIT_CHUNK_BITS;
+	static const unsigned int TRACE_CHUNK_BITS = 20;
+	static const unsigned long TRACE_CHUNK_SIZE = 1UL << TRACE_CHUNK_BITS;
+
+	// The hits and the trace samples
+	std::vector<std::unique_ptr<MiniballHit[]>> chunks;
+	std::vector<std::unique_ptr<unsigned short[]>> trace_chunks;
+	unsigned long nhits;
+	unsigned long nsamples;	///< next free position in the trace pool
+
+	// Runs and the lookup from (type, SFP/module, board) to the run index
+	std::vector<MiniballHitRun> runs;
+	std::vector<int> run_lookup;
+
+	// Data items used to fill the packets
+	std::shared_ptr<FebexData> febex_hit;
+	std::shared_ptr<InfoData> info_hit;
+	std::shared_ptr<DgfData> dgf_hit;
+	std::shared_ptr<AdcData> adc_hit;
+
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __MWDSCANNER_HH
+#define __MWDSCANNER_HH
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <climits>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TH1.h>
+#include <TF1.h>
+#include <TEnv.h>
+#include <TMath.h>
+#include <TDirectory.h>
+
+// Settings header
+#ifndef __SETTINGS_HH
+# include "Settings.hh"
+#endif
+
+// Calibration header
+#ifndef __CALIBRATION_HH
+# include "Calibration.hh"
+#endif
+
+// Data packets header
+#ifndef __DATAPACKETS_HH
+# include "DataPackets.hh"
+#endif
+
+
+/// One set of MWD parameters in the scan
+struct MiniballMWDScanPoint {
+
+	unsigned int decay, rise, top, window;
+
+};
+
+/// A channel in the scan, with its CFD parameters from the calibration,
+/// the grid, the spectrum of each grid point and the traces still to do
+struct MiniballMWDScanChannel {
+
+	unsigned char sfp, board, ch;
+	unsigned int baseline, cfd_delay, cfd_hold, cfd_shaping, cfd_integration;
+	int threshold;
+
+	std::vector<MiniballMWDScanPoint>	grid;
+	std::vector<unsigned int>			tops;		///< different flat tops in the grid
+	std::vector<TH1F*>					hists;		///< spectrum of each grid point
+	std::vector<unsigned short>			samples;	///< traces waiting to be scanned
+	std::vector<unsigned int>			lengths;	///< and their lengths
+
+};
+
+/// Things that are worked out once for each trace and shared by all grid
+/// points, plus the energies that come out. One for each thread, so there
+/// are no allocations once it has warmed up.
+struct MiniballMWDScanBuffer {
+
+	std::vector<long long int>			trace_sum;	///< sum of the samples before i
+	std::vector<long long int>			sum_sum;	///< sum of trace_sum before i
+	std::vector<float>					cfd;
+	std::vector<float>					cfd_list;
+	std::vector<unsigned int>			baseline_at, energy_at;
+	std::vector<std::vector<float>>		energies;	///< for each grid point
+
+};
+
+
+/// A class to scan the MWD parameters over a grid in one pass of the data.
+/// The stages that don't depend on the parameters are done once for each
+/// trace. These are the CFD, which gives the triggers for each flat top,
+/// and the running sums of the samples, from which stage 4 of any grid
+/// point can be had at the trigger times without going through the trace.
+
+class MiniballMWDScanner {
+
+public:
+
+	MiniballMWDScanner( std::shared_ptr<MiniballSettings> myset,
+					    std::shared_ptr<MiniballCalibration> mycal );
+	~MiniballMWDScanner() {};
+
+	bool	ReadGrid( std::string grid_file_name );
+	void	SetInputFile( std::vector<std::string> input_file_names );
+	void	SetOutput( std::string output_file_name );
+	inline void SetNumberOfThreads( unsigned int n ){
+		nthreads = n > 0 ? n : 1;
+	};
+
+	unsigned long	ScanTraces();
+	void			FitResolution();
+	void			CloseOutput();
+
+	// Energies of one trace for every grid point of the channel
+	static void ScanTrace( const MiniballMWDScanChannel &chan,
+						   const unsigned short *samples, unsigned int nsamples,
+						   MiniballMWDScanBuffer &buf );
+
+	// Set up a channel with its parameters from the calibration
+	void SetupChannel( unsigned char sfp, unsigned char board, unsigned char ch,
+					   MiniballMWDScanChannel &chan );
+
+private:
+
+	// Scan all the traces waiting in each channel
+	void ScanChannels();
+
+	// Index of the channel, making it if it needs to be
+	int GetChannel( unsigned char sfp, unsigned char board, unsigned char ch );
+
+	// Settings and calibration
+	std::shared_ptr<MiniballSettings> set;
+	std::shared_ptr<MiniballCalibration> cal;
+
+	// Values of each parameter to scan, empty ones come from the calibration
+	std::vector<unsigned int> scan_decay, scan_rise, scan_top, scan_window;
+
+	// Channels to scan, all of them if empty
+	std::vector<std::string> scan_channels;
+
+	// Spectra
+	unsigned int nbins;
+	double emax;
+
+	// Channels that have been seen and the lookup from the IDs
+	std::vector<MiniballMWDScanChannel> channels;
+	std::vector<int> channel_lookup;
+
+	// Scan the waiting traces when there are this many samples
+	static const unsigned long MAX_SAMPLES = 1UL << 24;
+	unsigned long nsamples_waiting;
+
+	unsigned int nthreads;
+
+	// Input and output
+	std::vector<std::string> input_names;
+	TFile *output_file;
+
+};
+
+#endif
@@ -16,6 +16,16 @@
 # include "MbsFormat.hh"
 #endif
 
+// Trace unpacking header
+#ifndef __TRACEUNPACK_HH
+# include "TraceUnpack.hh"
+#endif
+
+// Trace worker pool header
+#ifndef __TRACEPOOL_HH
+# include "TracePool.hh"
+#endif
+
 class MiniballMbsConverter : public MiniballConverter {
 
 public:
@@ -26,6 +36,8 @@ public:
 			data = nullptr;
 			n_double_hits = 0;
 			n_single_hits = 0;
+			flag_febex_recover = false;
+			recover_energy = 0;
 			mbs_data = true;
 			midas_data = false;
 			med_data = false;
@@ -47,6 +59,16 @@ public:
 
 private:
 
+	// True if the channel gives info data rather than FEBEX hits
+	inline bool IsInfoChannel( unsigned char sfp, unsigned char board, unsigned char ch ){
+		if( set->IsPulser( sfp, board, ch ) ) return true;
+		if( sfp == set->GetEBISSfp() && board == set->GetEBISBoard() &&
+		    ch == set->GetEBISChannel() ) return true;
+		if( sfp == set->GetT1Sfp() && board == set->GetT1Board() &&
+		    ch == set->GetT1Channel() ) return true;
+		return false;
+	};
+
 	// MBS Event holder and data pointers
 	const MBSEvent *ev;
 	const UInt_t *data;
@@ -56,6 +78,21 @@ private:
 	unsigned long n_single_hits;
 	unsigned long n_double_hits;
 
+	// Hit made from an MWD trigger by the pile-up recovery, and its energy
+	bool flag_febex_recover;
+	float recover_energy;
+
+	// Channels with more than one hit in the special channel of the
+	// current event, one bit for each channel of each SFP and board
+	std::vector<unsigned int> pileup_mask;
+	inline unsigned int PileupIndex( unsigned char sfp, unsigned char board ){
+		return sfp * set->GetNumberOfFebexBoards() + board;
+	};
+
+	// Workers to do the MWD of the traces when we have more than one thread
+	MiniballTracePool trace_pool;
+	static const unsigned long DRAIN_EVENTS = 1000;
+
 };
 
 #endif
@@ -2,10 +2,35 @@
 #define __MIDASCONVERTER_HH
 
 // MiniballConverter header
+#include <sys/mman.h>
+#include <thread>
+#include <atomic>
+
 #ifndef __CONVERTER_HH
 # include "Converter.hh"
 #endif
 
+// Trace unpacking header
+#ifndef __TRACEUNPACK_HH
+# include "TraceUnpack.hh"
+#endif
+
+
+// A trace unpacked by a worker thread, with the MWD already done
+struct MidasTraceResult {
+	UInt_t start;	// word position of the trace header
+	UInt_t end;		// word position of the last sample
+	bool clipped;
+	std::vector<unsigned short> samples;
+	std::vector<float> energies;
+	std::vector<float> cfd_times;
+};
+
+// A block decoded by a worker thread, ready to be replayed in order
+struct MidasBlock {
+	std::vector<ULong64_t> words;			// words with the byte swapping done
+	std::vector<MidasTraceResult> traces;	// traces in the order they appear
+};
 
 class MiniballMidasConverter : public MiniballConverter {
 
@@ -16,6 +41,8 @@ public:
 			mbs_data = false;
 			midas_data = true;
 			med_data = false;
+			block_header = header_buffer;
+			block_data = data_buffer;
 		};
 	~MiniballMidasConverter() {};
 
@@ -32,6 +59,11 @@ public:
 	void SetBlockData( char *input_data );
 	void ProcessBlockData( long nblock );
 
+	void DecodeBlock( const char *input_header, const char *input_data,
+					 bool prev_full, MidasBlock &blk );
+	void DecodeTraces( const ULong64_t *words, UInt_t data_len,
+					  std::vector<MidasTraceResult> &traces );
+
 	bool GetFebexChanID();
 	int  ProcessTraceData( int pos );
 	void ProcessFebexData( long nblock );
@@ -50,6 +82,23 @@ private:
 	};
 	Int_t swap;
 
+	// Length of the data in 64-bit words from the block header, as it is
+	// given in the header without limiting it to the size of the block
+	static UInt_t BlockDataLength( const char *input_header );
+
+	// Check if ProcessBlockData will reject a block with this length, given
+	// if the previous block was full. We don't decode those blocks at all
+	bool RejectBlock( UInt_t data_len, bool prev_full );
+
+	// Work out the swapping mode from the header and the data words
+	Int_t FindSwapMode( const ULong64_t *words, UShort_t data_endian );
+
+	// Unpack the samples of the trace with its header at pos, returns the
+	// number of words used before the end marker. Words past the end of the
+	// block give zeros. The words must be in native order already
+	UInt_t UnpackTrace( const ULong64_t *words, int pos,
+					    UInt_t nwords, unsigned short *samples );
+
 	// Swap endianness of a 32-bit integer 0x01234567 -> 0x67452301
 	inline UInt_t Swap32(UInt_t datum) {
 		return(((datum & 0xFF000000) >> 24) |
@@ -78,21 +127,6 @@ private:
 			   ((datum & 0x00000000000000FFLL) << 56));
 	};
 	
-	// Get nth word
-	inline ULong64_t GetWord( UInt_t n = 0 ){
-
-		// If word number is out of range, return zero
-		if( n >= WORD_SIZE ) return(0);
-
-		// Perform byte swapping according to swap mode
-		ULong64_t result = data[n];
-		if (swap & SWAP_ENDIAN) result = Swap64(result);
-		if (swap & SWAP_WORDS)  result = SwapWords(result);
-		return(result);
-		
-	};
-
-	
 	// Set the size of the block and its components.
 	static const int HEADER_SIZE = 24; // Size of header in bytes
 	static const int DATA_BLOCK_SIZE = 0x10000; // Block size for FEBEX data = 64 kB?
@@ -100,9 +134,14 @@ private:
 	static const int WORD_SIZE = 5 * ( MAIN_SIZE / ( 5 * sizeof(ULong64_t) ) );
 	unsigned int BLOCKS_NUM = 0;
 
-	// Set the arrays for the block components.
-	char block_header[HEADER_SIZE];
-	char block_data[MAIN_SIZE];
+	// Local copies of the block components, used by SetBlockHeader/Data
+	char header_buffer[HEADER_SIZE];
+	char data_buffer[MAIN_SIZE];
+
+	// Pointers to the block components, either in the local copies,
+	// the DataSpy buffer or directly in the memory mapped file
+	const char *block_header;
+	const char *block_data;
 	
 	// Data words - 1 word of 64 bits (8 bytes)
 	ULong64_t word;
@@ -111,8 +150,27 @@ private:
 	UInt_t word_0;
 	UInt_t word_1;
 	
-	// Pointer to the data words
-	ULong64_t *data;
+	// Pointer to the data words, always in native order
+	const ULong64_t *data;
+
+	// Data words of the current block after the byte swapping, if needed
+	ULong64_t native_buffer[WORD_SIZE];
+
+	// Block already decoded by a worker thread, if any, and
+	// the index of the next trace to be taken from it
+	const MidasBlock *decoded_block = nullptr;
+	unsigned int trace_ctr = 0;
+
+	// Traces of the current block when there are no worker threads
+	MidasBlock serial_block;
+
+	// MWD triggers of the trace in the current hit, for pile-up recovery
+	std::vector<float> trace_energies;
+	std::vector<float> trace_cfd_times;
+
+	// Make a hit for each MWD trigger instead of the one from the firmware,
+	// returns false if there weren't any triggers with a positive energy
+	bool AddRecoveredHits( unsigned long long int time_corr, const FebexChannelCal &fcal );
 	
 	// End of data in  a block looks like:
 	// word_0 = 0xFFFFFFFF, word_1 = 0xFFFFFFFF.
@@ -30,15 +30,15 @@ public:
 	inline void SetSegment( unsigned char s ){ seg = s; };
 	
 	// Return functions
-	inline float 				GetEnergy(){ return energy; };
-	inline float 				GetSegmentSumEnergy(){ return seg_sum_energy; };
-	inline float 				GetSegmentMaxEnergy(){ return seg_max_energy; };
-	inline unsigned int			GetSegmentMultiplicity(){ return seg_mult; };
-	inline unsigned int			GetAddbackMultiplicity(){ return ab_mult; };
-	inline unsigned long long	GetTime(){ return time; };
-	inline unsigned char		GetCluster(){ return clu; };
-	inline unsigned char		GetCrystal(){ return cry; };
-	inline unsigned char		GetSegment(){ return seg; };
+	inline float 				GetEnergy() const { return energy; };
+	inline float 				GetSegmentSumEnergy() const { return seg_sum_energy; };
+	inline float 				GetSegmentMaxEnergy() const { return seg_max_energy; };
+	inline unsigned int			GetSegmentMultiplicity() const { return seg_mult; };
+	inline unsigned int			GetAddbackMultiplicity() const { return ab_mult; };
+	inline unsigned long long	GetTime() const { return time; };
+	inline unsigned char		GetCluster() const { return clu; };
+	inline unsigned char		GetCrystal() const { return cry; };
+	inline unsigned char		GetSegment() const { return seg; };
 
 private:
 
@@ -287,6 +287,9 @@ public:
 		if( i < gamma_event.size() ) return std::make_shared<GammaRayEvt>( gamma_event.at(i) );
 		else return nullptr;
 	};
+	inline const GammaRayEvt& GetGammaRayEvtRef( unsigned int i ) const {
+		return gamma_event[i];
+	};
 	inline std::shared_ptr<GammaRayAddbackEvt> GetGammaRayAddbackEvt( unsigned int i ){
 		if( i < gamma_ab_event.size() ) return std::make_shared<GammaRayAddbackEvt>( gamma_ab_event.at(i) );
 		else return nullptr;
@@ -0,0 +1,62 @@
+#ifndef __PHILOX_HH
+#define __PHILOX_HH
+
+#include <string>
+
+/// Counter-based random numbers with the Philox4x32-10 generator of
+/// Salmon et al., "Parallel random numbers: as easy as 1, 2, 3" (SC11).
+/// The numbers are a function of a counter and a key, with no state, so
+/// every hit gets its own number however the hits are shared out between
+/// threads and in whatever order they are done.
+
+/// The four 32-bit words for a 128-bit counter and a 64-bit key
+inline void Philox4x32( unsigned int ctr[4], unsigned int k0, unsigned int k1 ) {
+
+	for( unsigned int r = 0; r < 10; ++r ) {
+
+		unsigned long long p0 = 0xD2511F53ULL * ctr[0];
+		unsigned long long p1 = 0xCD9E8D57ULL * ctr[2];
+
+		unsigned int c0 = ( p1 >> 32 ) ^ ctr[1] ^ k0;
+		unsigned int c2 = ( p0 >> 32 ) ^ ctr[3] ^ k1;
+		ctr[1] = (unsigned int)p1;
+		ctr[3] = (unsigned int)p0;
+		ctr[0] = c0;
+		ctr[2] = c2;
+
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+
+	}
+
+};
+
+/// Uniform random number in [0,1) for a hit number, an ID of the
+/// channel it is in and a key for the run
+inline float PhiloxUniform( unsigned long long hit, unsigned int id,
+						    unsigned long long key ) {
+
+	unsigned int ctr[4] = { (unsigned int)hit, (unsigned int)( hit >> 32 ), id, 0 };
+	Philox4x32( ctr, (unsigned int)key, (unsigned int)( key >> 32 ) );
+
+	// 24 bits is all a float can hold
+	return ( ctr[0] >> 8 ) * ( 1.0f / 16777216.0f );
+
+};
+
+/// Key for a run from the name of its file, without the directory,
+/// so it is the same wherever the file is
+inline unsigned long long PhiloxKey( const std::string &file_name ) {
+
+	// 64-bit FNV-1a hash
+	unsigned long long h = 0xCBF29CE484222325ULL;
+	for( std::size_t i = file_name.find_last_of( '/' ) + 1; i < file_name.size(); ++i ) {
+		h ^= (unsigned char)file_name[i];
+		h *= 0x100000001B3ULL;
+	}
+
+	return h;
+
+};
+
+#endif
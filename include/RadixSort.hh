@@ -0,0 +1,25 @@
+#ifndef __RADIXSORT_HH
+#define __RADIXSORT_HH
+
+#include <vector>
+#include <utility>
+#include <thread>
+#include <algorithm>
+
+/// LSD radix sort of (timestamp, index) pairs on the native 64-bit
+/// timestamp, eight bits at a time. It is stable, so hits with equal times
+/// stay in the order they were given, which is the same order as a
+/// std::sort with MiniballConverter::MapComparator when the indices are
+/// increasing. Bytes that are the same for every hit, like the top bytes
+/// of the timestamp, are skipped. With nthreads > 1, each pass is split
+/// between the threads for large inputs.
+
+void RadixSort( std::pair<long long int,unsigned long> *data, unsigned long n,
+			    unsigned int nthreads = 1 );
+
+inline void RadixSort( std::vector<std::pair<long long int,unsigned long>> &v,
+					   unsigned int nthreads = 1 ){
+	RadixSort( v.data(), v.size(), nthreads );
+};
+
+#endif
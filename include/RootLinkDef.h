@@ -27,9 +27,12 @@
 #pragma link C++ class ScalerUnitData+;
 #pragma link C++ class DgfScalerData+;
 #pragma link C++ class MBSInfoPackets+;
+#pragma link C++ class MiniballTracePackets+;
 #pragma link C++ class MiniballReaction+;
 #pragma link C++ class MiniballParticle+;
 #pragma link C++ class MiniballAngleFitter+;
 #pragma link C++ class MiniballGUI+;
 #pragma link C++ class MyDialog+;
+#pragma link C++ function RadixSort;
+#pragma link C++ function SwapMidasWords;
 #endif
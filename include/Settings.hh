@@ -10,6 +10,16 @@
 #include "TSystem.h"
 #include "TEnv.h"
 
+/// What is plugged into a channel, one entry of the flat channel maps.
+/// The IDs depend on the type, e.g. cluster, crystal and segment for
+/// Miniball or detector, sector, side and strip for the CD.
+struct MiniballChannelID {
+
+	short			id[4];	///< detector IDs, -1 if not used
+	unsigned char	type;	///< MiniballSettings::detector_t
+
+};
+
 /// A class to read in the settings file in ROOT's TConfig format.
 /// This has the number of modules, channels and things
 /// It also defines which detectors are which
@@ -22,7 +32,16 @@ public:
 	MiniballSettings( std::string filename );
 	~MiniballSettings() {};
 	
+	// Detector types in the channel maps
+	enum detector_t {
+		DET_NONE = 0, DET_MINIBALL, DET_CD, DET_PAD, DET_SPEDE,
+		DET_BEAMDUMP, DET_IONCHAMBER, DET_PULSER
+	};
+
 	void ReadSettings();
+	bool ReadCache( unsigned long long key );
+	void WriteCache( unsigned long long key );
+	void BuildChannelMaps();
 	void TestSettings();
 	void PrintSettings();
 	void SetFile( std::string filename ){
@@ -179,11 +198,15 @@ public:
 	void SetBlockSize( unsigned int size ){ block_size = size; };
 	inline unsigned int GetBlockSize(){ return block_size; };
 	inline unsigned int IsFebexOnly(){ return flag_febex_only; };
+	inline double GetStreamWatermark(){ return stream_window; };
+	inline unsigned int GetStreamIdleBlocks(){ return stream_idle; };
+	inline unsigned int GetSortMemoryLimit(){ return sort_mem_limit; };
 
 
 	// Are we rejecting pileup and/or clipped events
 	inline bool GetPileupRejection(){ return pileup_reject; };
 	inline bool GetClippedRejection(){ return clipped_reject; };
+	inline bool GetPileupRecovery(){ return pileup_recover; };
 
 
 	// Are we rejecting full buffers?
@@ -198,9 +221,9 @@ public:
 	bool IsMiniball( unsigned int dgf, unsigned int ch );
 	bool IsMiniball( unsigned int sfp, unsigned int board, unsigned int ch );
 	int GetMiniballID( unsigned int dgf, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector );
+					  const std::vector<std::vector<std::vector<int>>> &vector );
 	int GetMiniballID( unsigned int sfp, unsigned int board, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector );
+					  const std::vector<std::vector<std::vector<int>>> &vector );
 	inline int GetMiniballCluster( unsigned int dgf, unsigned int ch ){
 		return GetMiniballID( dgf, ch, mb_cluster );
 	};
@@ -233,9 +256,9 @@ public:
 	bool IsCD( unsigned int adc, unsigned int ch );
 	bool IsCD( unsigned int sfp, unsigned int board, unsigned int ch );
 	int GetCDID( unsigned int adc, unsigned int ch,
-				std::vector<std::vector<std::vector<int>>> vector );
+				const std::vector<std::vector<std::vector<int>>> &vector );
 	int GetCDID( unsigned int sfp, unsigned int board, unsigned int ch,
-				std::vector<std::vector<std::vector<int>>> vector );
+				const std::vector<std::vector<std::vector<int>>> &vector );
 	inline int GetCDDetector( unsigned int adc, unsigned int ch ){
 		return GetCDID( adc, ch, cd_det );
 	};
@@ -302,10 +325,32 @@ public:
 	int GetPulser( unsigned int sfp, unsigned int board, unsigned int ch );
 	
 	
+	// Everything about a channel in one go, instead of the IsMiniball(), IsCD()...
+	// chain. Unknown channels get an entry with type DET_NONE
+	inline const MiniballChannelID& GetFebexChannelID( unsigned int sfp, unsigned int board, unsigned int ch ) const {
+		if( sfp < map_febex_sfp && board < map_febex_board && ch < map_febex_ch )
+			return febex_map[ ( sfp * map_febex_board + board ) * map_febex_ch + ch ];
+		return febex_map.back();
+	};
+	inline const MiniballChannelID& GetDgfChannelID( unsigned int dgf, unsigned int ch ) const {
+		if( dgf < map_dgf_mod && ch < map_dgf_ch )
+			return dgf_map[ dgf * map_dgf_ch + ch ];
+		return dgf_map.back();
+	};
+	inline const MiniballChannelID& GetAdcChannelID( unsigned int adc, unsigned int ch ) const {
+		if( adc < map_adc_mod && ch < map_adc_ch )
+			return adc_map[ adc * map_adc_ch + ch ];
+		return adc_map.back();
+	};
+	
+	
 	ClassDef( MiniballSettings, 3 )
 
 private:
 
+	// List of everything read from the settings file, for the binary cache
+	template<typename A> void CacheItems( A &ar );
+
 	std::string fInputFile;
 
 	// FEBEX settings
@@ -460,10 +505,14 @@ private:
 	// Data format
 	unsigned int block_size;		///< not yet implemented, needs C++ style reading of data files
 	bool flag_febex_only;			///< when there is only FEBEX data in the file
+	double stream_window;			///< Maximum time skew between SFPs in ns for streaming time ordering, zero to sort the whole file at the end
+	unsigned int stream_idle;		///< Number of blocks after which a quiet SFP/module no longer holds back the streaming
+	unsigned int sort_mem_limit;	///< Memory in MB for hits before they are sorted and spilled to disk, zero for no limit
 
 	// Pile-up and clipped pulse rejection
 	bool pileup_reject;				///< reject events where the pileup flag is set by the MWD firmware
 	bool clipped_reject;			///< reject events that are clipped by the ADC range
+	bool pileup_recover;			///< make a hit from each MWD trigger in a piled-up trace
 
 	// Buffer full rejection
 	bool bufferfull_reject;
@@ -477,6 +526,14 @@ private:
 	double caen_ts_units;
 	double madc_ts_units;
 
+	// The channel maps above as flat tables by channel, with the empty entry at the end
+	std::vector<MiniballChannelID> febex_map; //!
+	std::vector<MiniballChannelID> dgf_map; //!
+	std::vector<MiniballChannelID> adc_map; //!
+	unsigned int map_febex_sfp, map_febex_board, map_febex_ch; //!
+	unsigned int map_dgf_mod, map_dgf_ch; //!
+	unsigned int map_adc_mod, map_adc_ch; //!
+
 
 
 };
@@ -0,0 +1,109 @@
+#ifndef __TRACEPOOL_HH
+#define __TRACEPOOL_HH
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <TH1.h>
+
+// Calibration header
+#ifndef __CALIBRATION_HH
+# include "Calibration.hh"
+#endif
+
+
+/// A trace waiting for the MWD, in a slot of the queue. The samples
+/// vector is kept between uses so it only grows to the longest trace.
+struct MiniballTraceJob {
+
+	std::atomic<unsigned long>	seq;		///< tells who owns the slot
+	unsigned char				sfp, board, ch;
+	std::vector<unsigned short>	samples;
+
+};
+
+/// An MWD energy waiting to be filled into the histograms
+struct MiniballTraceEnergy {
+
+	unsigned char	sfp, board, ch;
+	unsigned int	Qint;
+
+};
+
+/// Energies from one thread, padded so that two threads never
+/// write to the same cache line
+struct alignas(64) MiniballTraceShard {
+
+	std::vector<MiniballTraceEnergy> energies;
+
+};
+
+
+/// A pool of worker threads to do the software MWD of the traces, so that
+/// the decoding doesn't have to wait for it. The decoding thread puts the
+/// traces into a bounded lock-free queue, where each slot has a sequence
+/// number saying whether it is free, full or being worked on. The workers
+/// claim the next full slot with a compare-and-swap, so nothing is ever
+/// locked. Each thread keeps the energies it makes in its own shard, which
+/// are only filled into the histograms by the decoding thread in Drain().
+
+class MiniballTracePool {
+
+public:
+
+	MiniballTracePool();
+	~MiniballTracePool();
+
+	// Start and stop the worker threads
+	void Start( unsigned int nworkers, std::shared_ptr<MiniballCalibration> mycal );
+	void Stop();
+	inline bool IsRunning() const { return workers.size() > 0; };
+
+	// Hand a trace to the workers, the samples are copied. If the queue is
+	// full the calling thread does some of the traces itself
+	void Submit( unsigned char sfp, unsigned char board, unsigned char ch,
+				 const unsigned short *samples, unsigned int nsamples );
+
+	// Wait for all traces so far, helping the workers while we wait,
+	// then fill the energies into the histograms
+	void Drain( std::vector<std::vector<std::vector<TH1F*>>> &hists );
+
+	// Number of traces handed over since the start
+	inline unsigned long GetNumberOfTraces() const { return nsubmitted; };
+
+private:
+
+	// Take the next trace from the queue and do the MWD, false if it's empty
+	bool RunOne( MiniballTraceShard &shard );
+
+	// Loop of each worker thread
+	void Work( unsigned int id );
+
+	// Size of the queue, must be a power of two
+	static const unsigned long QUEUE_SIZE = 1024;
+	static const unsigned long QUEUE_MASK = QUEUE_SIZE - 1;
+	std::unique_ptr<MiniballTraceJob[]> queue;
+
+	// Next slot to fill and next slot to take, on their own cache lines
+	alignas(64) std::atomic<unsigned long> head;
+	alignas(64) std::atomic<unsigned long> tail;
+
+	// Traces handed over and traces done
+	alignas(64) std::atomic<unsigned long> ndone;
+	unsigned long nsubmitted;
+
+	// Worker threads and their shards, the last shard is for the calling thread
+	std::vector<std::thread> workers;
+	std::vector<MiniballTraceShard> shards;
+	std::atomic<bool> stop;
+
+	// Calibration, which does the MWD with a copy for each thread
+	std::shared_ptr<MiniballCalibration> cal;
+
+};
+
+#endif
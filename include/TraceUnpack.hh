@@ -0,0 +1,36 @@
+#ifndef __TRACEUNPACK_HH
+#define __TRACEUNPACK_HH
+
+#include <cstring>
+
+/// Bulk unpacking of FEBEX trace samples and MIDAS data words, used by the
+/// MIDAS and MBS converters instead of going one word or one sample at a
+/// time. On x86-64 the MIDAS functions use SSSE3 or AVX2 byte shuffles when
+/// the CPU has them, otherwise they fall back to a plain loop. The MBS
+/// unpacking is a simple loop that the compiler vectorises by itself.
+
+/// Put a block of MIDAS words into native order, doing the byte and/or
+/// word swapping given by the flags. The output can be the same as the input.
+void SwapMidasWords( const unsigned long long *words, unsigned int nwords,
+					 bool swap_endian, bool swap_words,
+					 unsigned long long *out );
+
+/// MIDAS traces have four 16-bit samples in each 64-bit word. The words are
+/// byte and/or word swapped as given by the flags, then the samples are
+/// written in the order expected by ProcessTraceData. It stops at the
+/// 0x5E5E5E5E end marker and returns the number of words unpacked.
+unsigned int UnpackMidasTrace( const unsigned long long *words, unsigned int nwords,
+							   bool swap_endian, bool swap_words,
+							   unsigned short *samples );
+
+/// MBS traces have two samples in each 32-bit word, lower half first.
+/// Each sample is masked to the ADC resolution (0x3FFF or 0xFFF).
+void UnpackMbsTrace( const unsigned int *words, unsigned int nwords,
+					 unsigned short mask, unsigned short *samples );
+
+/// With the filter on, the MBS trace only has one sample in the upper
+/// half of each 32-bit word.
+void UnpackMbsFilterTrace( const unsigned int *words, unsigned int nwords,
+						   unsigned short mask, unsigned short *samples );
+
+#endif
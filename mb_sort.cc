@@ -63,6 +63,11 @@
 #endif
 
 
+// MiniballMWDScanner header
+#ifndef __MWDSCANNER_HH
+# include "MWDScanner.hh"
+#endif
+
 // Command line interface
 #ifndef __COMMAND_LINE_INTERFACE_HH
 # include "CommandLineInterface.hh"
@@ -96,6 +101,9 @@ bool help_flag = false;
 // Flag if we want to launch the GUI for sorting
 bool gui_flag = false;
 
+// Number of threads for the conversion, event building and MWD scan
+int nthreads = 1;
+
 // Input data type
 bool flag_midas = false;
 bool flag_mbs = false;
@@ -110,6 +118,10 @@ std::string cdcal_strips;
 unsigned char cdcal_pid = 12;
 unsigned char cdcal_nid = 2;
 
+// Do we want to scan the MWD parameters
+bool flag_mwdscan = false;
+std::string mwdscan_file;
+
 // DataSpy
 bool flag_spy = false;
 bool flag_alive = true;
@@ -286,6 +298,7 @@ void* monitor_run( void* ptr ){
 				// Clean up the trees before we start
 				conv_midas_mon->GetSortedTree()->Reset();
 				conv_midas_mon->GetMbsInfo()->Reset();
+				conv_midas_mon->GetTraceTree()->Reset();
 
 				// Empty the previous data vector and reset counters
 				conv_midas_mon->StartFile();
@@ -595,6 +608,7 @@ void do_convert() {
 				conv_mbs.AddCalibration( mycal );
 				conv_mbs.MakeTree();
 				conv_mbs.MakeHists();
+				conv_mbs.SetNumberOfThreads( nthreads );
 				conv_mbs.ConvertFile( name_input_file );
 
 				// Sort the tree before writing and closing
@@ -616,6 +630,7 @@ void do_convert() {
 				conv_midas.AddCalibration( mycal );
 				conv_midas.MakeTree();
 				conv_midas.MakeHists();
+				conv_midas.SetNumberOfThreads( nthreads );
 				conv_midas.ConvertFile( name_input_file );
 
 				// Sort the tree before writing and closing
@@ -632,6 +647,7 @@ void do_convert() {
 				conv_med.AddCalibration( mycal );
 				conv_med.MakeTree();
 				conv_med.MakeHists();
+				conv_med.SetNumberOfThreads( nthreads );
 				conv_med.ConvertFile( name_input_file );
 
 				// Sort the tree before writing and closing
@@ -670,6 +686,9 @@ bool do_build() {
 	// Update calibration file if given
 	if( overwrite_cal ) eb.AddCalibration( mycal );
 
+	// Build events in parallel if we have the threads
+	eb.SetNumberOfThreads( nthreads );
+
 	// Do event builder for each file individually
 	for( unsigned int i = 0; i < input_names.size(); i++ ){
 
@@ -936,6 +955,59 @@ void do_cdcal(){
 
 }
 
+void do_mwdscan(){
+
+	//----------------------------//
+	// Scan of the MWD parameters //
+	//----------------------------//
+	MiniballMWDScanner mwdscan( myset, mycal );
+	std::cout << "\n +++ Miniball Analysis:: processing MWD Scanner +++" << std::endl;
+
+	std::ifstream ftest;
+	std::string name_input_file;
+	std::vector<std::string> name_conv_files;
+
+	// Read the grid of parameters
+	if( !mwdscan.ReadGrid( mwdscan_file ) ) return;
+
+	// We need the converted files with the traces
+	for( unsigned int i = 0; i < input_names.size(); i++ ){
+
+		name_input_file = input_names.at(i).substr( input_names.at(i).find_last_of("/")+1,
+												   input_names.at(i).length() - input_names.at(i).find_last_of("/")-1 );
+		name_input_file = name_input_file.substr( 0,
+												 name_input_file.find_last_of(".") );
+		name_input_file = datadir_name + "/" + name_input_file + ".root";
+
+		ftest.open( name_input_file.data() );
+		if( !ftest.is_open() ) {
+
+			std::cerr << name_input_file << " does not exist" << std::endl;
+			continue;
+
+		}
+		else ftest.close();
+
+		name_conv_files.push_back( name_input_file );
+
+	}
+
+	// Only do something if there are valid files
+	if( name_conv_files.size() ) {
+
+		mwdscan.SetNumberOfThreads( nthreads );
+		mwdscan.SetOutput( output_name );
+		mwdscan.SetInputFile( name_conv_files );
+		mwdscan.ScanTraces();
+		mwdscan.FitResolution();
+		mwdscan.CloseOutput();
+
+	}
+
+	return;
+
+}
+
 int main( int argc, char *argv[] ){
 	
 	// Command line interface, stolen from MiniballCoulexSort
@@ -951,11 +1023,13 @@ int main( int argc, char *argv[] ){
 	interface->Add("-source", "Flag to define an source only run", &flag_source );
 	interface->Add("-ebis", "Flag to define an EBIS only run, discarding data >4ms after an EBIS event", &flag_ebis );
 	interface->Add("-midas", "Flag to define input as MIDAS data type (FEBEX with Daresbury firmware - default)", &flag_midas );
+	interface->Add("-j", "Number of threads for the data conversion, time ordering, event building and MWD scan (default 1)", &nthreads );
 	interface->Add("-mbs", "Flag to define input as MBS data type (FEBEX with GSI firmware)", &flag_mbs );
 	interface->Add("-med", "Flag to define input as MED data type (DGF and MADC)", &flag_med );
 	interface->Add("-anglefit", "Flag to run the angle fit", &flag_angle_fit );
 	interface->Add("-angledata", "File containing 22Ne segment energies", &name_angle_file );
 	interface->Add("-cdcal", "Make the CD calibration plots with pid and nid as the reference strips, given in the string format p<pid>n<nid>", &cdcal_strips );
+	interface->Add("-mwdscan", "Scan the MWD parameters over the grid given in this file, writing the spectra and resolution of each grid point", &mwdscan_file );
 	interface->Add("-spy", "Flag to run the DataSpy", &flag_spy );
 	interface->Add("-spyhists", "File containing histograms for monitoring in the spy", &spy_hists_file );
 	interface->Add("-m", "Monitor input file every X seconds", &mon_time );
@@ -972,6 +1046,14 @@ int main( int argc, char *argv[] ){
 		
 	}
 	
+	// Need at least one thread to do anything
+	if( nthreads < 1 ) {
+		
+		std::cout << "Number of threads given with -j must be at least 1, not " << nthreads << std::endl;
+		return 1;
+		
+	}
+	
 	// If we are launching the GUI
 	if( gui_flag || argc == 1 ) {
 		
@@ -1027,6 +1109,9 @@ int main( int argc, char *argv[] ){
 
 	}
 
+	// Check if we are doing the MWD scan
+	if( mwdscan_file.length() > 0 ) flag_mwdscan = true;
+
 
 	// Check if it should be MIDAS, MBS or MED format
 	if( !flag_midas && !flag_mbs && !flag_med && !flag_spy && !name_angle_file.length() ){
@@ -1143,6 +1228,12 @@ int main( int argc, char *argv[] ){
 
 			}
 
+			else if( flag_mwdscan ) {
+
+				output_name = datadir_name + "/" + name_input_file + "_mwdscan.root";
+
+			}
+
 			else if( input_names.size() > 1 ) {
 
 				output_name = datadir_name + "/" + name_input_file + "_hists_";
@@ -1328,6 +1419,9 @@ int main( int argc, char *argv[] ){
 	else if( flag_cdcal ) {
 		do_cdcal();
 	}
+	else if( flag_mwdscan ) {
+		do_mwdscan();
+	}
 	else if( !flag_source ) {
 		if( do_build() )
 			do_hist();
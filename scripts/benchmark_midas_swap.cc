@@ -0,0 +1,74 @@
+//#include "TraceUnpack.hh"
+
+R__LOAD_LIBRARY(libmb_sort.so)
+
+// Compare the old way of swapping each MIDAS word as it is read with
+// putting the whole block in native order first, as the converter does now.
+// The synthetic blocks are made big-endian and word swapped, like data
+// written on a big-endian machine, so both swaps are needed.
+void benchmark_midas_swap( unsigned int nblocks = 20000 ){
+	
+	// Same size of block as MiniballMidasConverter
+	const unsigned int nwords = 5 * ( ( 0x10000 - 24 ) / ( 5 * sizeof(ULong64_t) ) );
+	
+	// Native words that look like FEBEX data, with the top two bits set
+	std::cout << "Generating " << nblocks << " blocks of " << nwords << " words" << std::endl;
+	std::mt19937_64 rng( 12345 );
+	std::vector<ULong64_t> native( nwords );
+	for( unsigned int i = 0; i < nwords; ++i )
+		native[i] = ( rng() & 0x3FFFFFFFFFFFFFFFULL ) | ( ( 1ULL + rng() % 3 ) << 62 );
+	
+	// Then swap them to how they arrive from the big-endian DAQ
+	std::vector<ULong64_t> raw( nwords );
+	for( unsigned int i = 0; i < nwords; ++i ) {
+		ULong64_t w = __builtin_bswap64( native[i] );
+		raw[i] = ( w >> 32 ) | ( w << 32 );
+	}
+	
+	// Something to do with each word so the loops aren't thrown away
+	auto decode = []( ULong64_t w, ULong64_t &sum ) {
+		UInt_t word_0 = ( w >> 32 ) & 0xFFFFFFFF;
+		UInt_t word_1 = w & 0xFFFFFFFF;
+		sum += ( ( word_0 >> 30 ) & 0x3 ) + ( word_1 & 0xFFFF );
+	};
+	
+	// Per-word swapping like the old GetWord
+	Int_t swap = 6; // SWAP_WORDS | SWAP_ENDIAN
+	ULong64_t sum_ref = 0;
+	TStopwatch timer;
+	timer.Start();
+	for( unsigned int b = 0; b < nblocks; ++b ) {
+		for( UInt_t i = 0; i < nwords; ++i ) {
+			
+			// Same checks as the old GetWord, for every word
+			if( i >= nwords ) continue;
+			ULong64_t w = raw[i];
+			if( swap & 4 ) w = __builtin_bswap64( w );
+			if( swap & 2 ) w = ( w >> 32 ) | ( w << 32 );
+			decode( w, sum_ref );
+			
+		}
+	}
+	timer.Stop();
+	double t_ref = timer.RealTime();
+	std::cout << "Per-word swapping: " << t_ref << " s" << std::endl;
+	
+	// Block pre-pass, then reading the native words directly
+	std::vector<ULong64_t> buffer( nwords );
+	ULong64_t sum_test = 0;
+	timer.Start();
+	for( unsigned int b = 0; b < nblocks; ++b ) {
+		SwapMidasWords( raw.data(), nwords, swap & 4, swap & 2, buffer.data() );
+		for( UInt_t i = 0; i < nwords; ++i )
+			decode( buffer[i], sum_test );
+	}
+	timer.Stop();
+	
+	std::cout << "Block swapping:    " << timer.RealTime() << " s, speed up = ";
+	std::cout << t_ref / timer.RealTime();
+	if( sum_test == sum_ref && buffer == native ) std::cout << ", same data" << std::endl;
+	else std::cout << ", DIFFERENT DATA!" << std::endl;
+	
+	return;
+	
+}
@@ -0,0 +1,107 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "RadixSort.hh"
+
+// Compare std::sort with the radix sort used to time order the hits.
+// The synthetic hits come from a number of boards that each count up in
+// time, with a small fraction of them out of order, like the real data.
+// Each hit is 16 bytes and there are three copies, so 1e7 hits need about
+// 500 MB of memory. Run it in ROOT after building the library:
+//   root -l -e '.include include' -e 'gSystem->Load("lib/libmb_sort.so")' 'scripts/benchmark_time_sort.cc(1e7)'
+// or compile it on its own, as it only needs the radix sort:
+//   g++ -O3 -std=c++17 -Iinclude scripts/benchmark_time_sort.cc src/RadixSort.cc -pthread -o benchmark_time_sort
+//   ./benchmark_time_sort [nhits] [nthreads] [nboards]
+// The default is small enough for any machine. The comparison on 10^8 hits,
+// the size of a long run, needs about 5 GB of memory (16 bytes x 3 copies):
+//   ./benchmark_time_sort 1e8
+void benchmark_time_sort( unsigned long nhits = 1e7, unsigned int nthreads = 4,
+						  unsigned int nboards = 32 ){
+	
+	if( nboards == 0 ) nboards = 1;
+	
+	// Generate the hits, interleaving the boards
+	std::cout << "Generating " << nhits << " hits from " << nboards << " boards" << std::endl;
+	std::mt19937_64 rng( 12345 );
+	std::vector<long long int> board_time( nboards, 1LL << 44 );
+	std::vector<std::pair<long long int,unsigned long>> hits( nhits );
+	for( unsigned long i = 0; i < nhits; ++i ) {
+		
+		unsigned int b = rng() % nboards;
+		board_time[b] += rng() % ( 200 * nboards );
+		long long int t = board_time[b];
+		
+		// Some of them jump back a bit
+		if( rng() % 1000 == 0 ) t -= rng() % 100000;
+		hits[i] = std::make_pair( t, i );
+		
+	}
+	
+	// Same order as MiniballConverter::MapComparator
+	auto comparator = []( const std::pair<long long int,unsigned long> &lhs,
+						  const std::pair<long long int,unsigned long> &rhs ) {
+		if( lhs.first == rhs.first ) return lhs.second < rhs.second;
+		return lhs.first < rhs.first;
+	};
+	
+	// Reference with std::sort
+	std::vector<std::pair<long long int,unsigned long>> ref( hits );
+	auto start = std::chrono::steady_clock::now();
+	std::sort( ref.begin(), ref.end(), comparator );
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	double t_ref = elapsed.count();
+	std::cout << "std::sort:              " << t_ref << " s" << std::endl;
+	
+	// Radix sort in a single thread and in parallel
+	std::vector<unsigned int> threads = { 1, nthreads };
+	for( unsigned int j = 0; j < threads.size(); ++j ) {
+		
+		std::vector<std::pair<long long int,unsigned long>> test( hits );
+		start = std::chrono::steady_clock::now();
+		RadixSort( test, threads[j] );
+		elapsed = std::chrono::steady_clock::now() - start;
+		
+		std::cout << "RadixSort, " << std::setw(2) << threads[j] << " thread(s): ";
+		std::cout << elapsed.count() << " s, speed up = ";
+		std::cout << t_ref / elapsed.count();
+		if( test == ref ) std::cout << ", same order" << std::endl;
+		else std::cout << ", DIFFERENT ORDER!" << std::endl;
+		
+	}
+	
+	return;
+	
+}
+
+#ifndef __CLING__
+int main( int argc, char **argv ){
+	
+	unsigned long nhits = 1e7;
+	unsigned int nthreads = 4;
+	unsigned int nboards = 32;
+	
+	try {
+		
+		if( argc > 1 ) nhits = std::stod( argv[1] );
+		if( argc > 2 ) nthreads = std::stoul( argv[2] );
+		if( argc > 3 ) nboards = std::stoul( argv[3] );
+		
+	}
+	catch( const std::exception &e ) {
+		
+		std::cerr << "Usage: " << argv[0] << " [nhits] [nthreads] [nboards]" << std::endl;
+		return 1;
+		
+	}
+	
+	benchmark_time_sort( nhits, nthreads, nboards );
+	
+	return 0;
+	
+}
+#endif
@@ -3,6 +3,9 @@
 
 R__LOAD_LIBRARY(libmb_sort.so)
 
+// This scans one parameter for one channel. To scan a grid of parameters
+// for many channels in one pass of the data, use mb_sort -mwdscan
+
 void mwd_optimisation( std::string filename = "test/R4_13.root", unsigned int sfp = 0,
 			   unsigned board = 0, unsigned int ch = 0, std::string calfile = "default" ) {
 	
@@ -30,6 +33,15 @@ void mwd_optimisation( std::string filename = "test/R4_13.root", unsigned int sf
 	std::shared_ptr<FebexData> febex;
 	MiniballDataPackets *data = new MiniballDataPackets;
 	t->SetBranchAddress( "data", &data );
+
+	// Traces are in their own tree, indexed by the entry number in mb_sort.
+	// Older files still have them in the data packets instead
+	TTree *tt = (TTree*)f->Get("mb_trace");
+	MiniballTracePackets *trace = new MiniballTracePackets;
+	if( tt != nullptr ) {
+		tt->SetBranchAddress( "trace", &trace );
+		tt->BuildIndex( "entry" );
+	}
 	
 	// Define range of parameters to scan
 	const int Nscan = 5;
@@ -56,6 +68,12 @@ void mwd_optimisation( std::string filename = "test/R4_13.root", unsigned int sf
 		if( febex->GetSfp() == sfp &&
 		    febex->GetBoard() == board &&
 		    febex->GetChannel() == ch ) {
+
+			// Get the trace only when we need it
+			if( tt != nullptr ) {
+				if( tt->GetEntryWithIndex( i ) <= 0 ) continue;
+				febex->SetTrace( trace->GetTrace() );
+			}
 		
 			// Scan the paramters of your choosing, e.g. tau
 			for( unsigned int j = 0; j <= Nscan; ++j ){
@@ -27,6 +27,15 @@ void mwd_plots( std::string filename = "test/R4_13.root", unsigned int sfp = 0,
 	std::shared_ptr<FebexData> febex;
 	MiniballDataPackets *data = new MiniballDataPackets;
 	t->SetBranchAddress( "data", &data );
+
+	// Traces are in their own tree, indexed by the entry number in mb_sort.
+	// Older files still have them in the data packets instead
+	TTree *tt = (TTree*)f->Get("mb_trace");
+	MiniballTracePackets *trace = new MiniballTracePackets;
+	if( tt != nullptr ) {
+		tt->SetBranchAddress( "trace", &trace );
+		tt->BuildIndex( "entry" );
+	}
 	
 	// Canvas
 	TCanvas *c1 = new TCanvas( "c1", filename.data(), 900, 1000 );
@@ -54,6 +63,12 @@ void mwd_plots( std::string filename = "test/R4_13.root", unsigned int sfp = 0,
 		if( febex->GetSfp() == sfp &&
 		    febex->GetBoard() == board &&
 		    febex->GetChannel() == ch ) {
+
+			// Get the trace only when we need it
+			if( tt != nullptr ) {
+				if( tt->GetEntryWithIndex( i ) <= 0 ) continue;
+				febex->SetTrace( trace->GetTrace() );
+			}
 		
 			// MWD data
 			FebexMWD mwd = cal->DoMWD( sfp, board, ch, febex->GetTrace() );
@@ -17,6 +17,15 @@ void read_traces( std::string filename = "test/R4_13.root" ) {
 	std::shared_ptr<FebexData> febex;
 	MiniballDataPackets *data = new MiniballDataPackets;
 	t->SetBranchAddress( "data", &data );
+
+	// Traces are in their own tree, indexed by the entry number in mb_sort.
+	// Older files still have them in the data packets instead
+	TTree *tt = (TTree*)f->Get("mb_trace");
+	MiniballTracePackets *trace = new MiniballTracePackets;
+	if( tt != nullptr ) {
+		tt->SetBranchAddress( "trace", &trace );
+		tt->BuildIndex( "entry" );
+	}
 	
 	// Canvas
 	TCanvas *c1 = new TCanvas();
@@ -35,6 +44,12 @@ void read_traces( std::string filename = "test/R4_13.root" ) {
 		
 		// If it is febex, get the data packet
 		febex = data->GetFebexData();
+
+		// Get the trace only when we need it
+		if( tt != nullptr ) {
+			if( tt->GetEntryWithIndex( i ) <= 0 ) continue;
+			febex->SetTrace( trace->GetTrace() );
+		}
 		
 		// Draw trace
 		febex.get()->GetTraceGraph()->Draw("ac");
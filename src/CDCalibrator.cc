@@ -73,6 +73,9 @@ void MiniballCDCalibrator::SetInputFile( std::string input_file_name ) {
 	}
 	
 	flag_input_file = true;
+
+	// Random numbers for the calibration belong to this file
+	if( overwrite_cal ) cal->SetRandomKey( PhiloxKey( input_file_name ) );
 	
 	// Set the input tree
 	SetInputTree( (TTree*)input_file->Get("mb_sort") );
@@ -172,7 +175,7 @@ void MiniballCDCalibrator::MakeHists(){
 			set->GetNumberOfFebexBoards() > 0 &&
 			set->GetNumberOfFebexChannels() > 0 ) {
 
-		if( cal->FebexType( 1, 0, 0 ) == "Qshort" ) {
+		if( cal->FebexTypeID( 1, 0, 0 ) == MiniballCalibration::FEBEX_QSHORT ) {
 			maxQ = 65536;
 		}
 	}
@@ -719,26 +722,37 @@ unsigned long MiniballCDCalibrator::FillHists() {
 		if( in_data->IsFebex() ) {
 			
 			// Get the data
-			febex_data = in_data->GetFebexData();
+			febex_data = &in_data->GetFebexDataRef();
 			mysfp = febex_data->GetSfp();
 			myboard = febex_data->GetBoard();
 			mych = febex_data->GetChannel();
 			mypileup = febex_data->IsPileup();
 			myclipped = febex_data->IsClipped();
 
-			// Update calibration always for CD calibrator
-			unsigned int adc_tmp_value;
-			if( cal->FebexType( mysfp, myboard, mych ) == "Qshort" )
-				adc_tmp_value = febex_data->GetQshort();
-			else if( cal->FebexType( mysfp, myboard, mych ) == "Qint" )
-				adc_tmp_value = febex_data->GetQint();
-			else adc_tmp_value = febex_data->GetQshort();
+			// Update calibration always for CD calibrator, apart from
+			// the hits from pile-up recovery with no firmware charge
+			if( febex_data->IsRecovered() ) {
 
-			myenergy = cal->FebexEnergy( mysfp, myboard, mych, adc_tmp_value );
+				myenergy = febex_data->GetEnergy();
+				mythres = febex_data->IsOverThreshold();
 
-			if( adc_tmp_value > cal->FebexThreshold( mysfp, myboard, mych ) )
-				mythres = true;
-			else mythres = false;
+			}
+
+			else {
+
+				const FebexChannelCal &fcal = cal->GetFebexCal( mysfp, myboard, mych );
+				unsigned int adc_tmp_value;
+				if( fcal.type == MiniballCalibration::FEBEX_QINT )
+					adc_tmp_value = febex_data->GetQint();
+				else adc_tmp_value = febex_data->GetQshort();
+
+				myenergy = cal->FebexEnergy( fcal, adc_tmp_value, i );
+
+				if( adc_tmp_value > fcal.threshold )
+					mythres = true;
+				else mythres = false;
+
+			}
 
 			// Is it a particle from the CD?
 			if( set->IsCD( mysfp, myboard, mych ) && mythres ) {
@@ -771,14 +785,14 @@ unsigned long MiniballCDCalibrator::FillHists() {
 		if( in_data->IsAdc() ) {
 			
 			// Get the data
-			adc_data = in_data->GetAdcData();
+			adc_data = &in_data->GetAdcDataRef();
 			myadc = adc_data->GetModule();
 			mych = adc_data->GetChannel();
 			myclipped = adc_data->IsClipped();
 
 			// Update calibration always for CD calibrator
 			unsigned int adc_tmp_value = adc_data->GetQshort();
-			myenergy = cal->AdcEnergy( myadc, mych, adc_tmp_value );
+			myenergy = cal->AdcEnergy( myadc, mych, adc_tmp_value, i );
 
 			if( adc_tmp_value > cal->AdcThreshold( myadc, mych ) )
 				mythres = true;
@@ -1,8 +1,122 @@
 #include "Calibration.hh"
 
+// Binary cache header
+#ifndef __CONFIGCACHE_HH
+# include "ConfigCache.hh"
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define FEBEXMWD_X86
+# define FEBEXMWD_INLINE inline __attribute__((always_inline))
+#else
+# define FEBEXMWD_INLINE inline
+#endif
+
 ClassImp(FebexMWD)
 ClassImp(MiniballCalibration)
 
+// Find the triggers in the CFD and measure the energies from stage 4.
+// The samples of a trace are every stride elements, so that this works
+// for the interleaved traces in FebexMWDBatch as well as for FebexMWD
+static void FebexMWDTriggers( const float *cfd, const float *stage4, unsigned int stride,
+							  unsigned int trace_length, unsigned int skip,
+							  unsigned int cfd_delay, unsigned int cfd_hold, int threshold,
+							  unsigned int flat_top, unsigned int baseline_length,
+							  std::vector<float> &cfd_list, std::vector<float> &energy_list ) {
+	
+	// Baseline energy estimation
+	float baseline_energy = 0.0;
+	
+	// Loop now over the CFD trace until we trigger
+	// This is not the same as James' trigger, but it's better
+	// plus he has updated his CFD and I don't have the new one
+	for( unsigned int i = skip; i < trace_length; ++i ) {
+		
+		// Trigger when we pass the threshold on the CFD
+		if( i > cfd_delay + skip &&
+		   ( ( cfd[i*stride] > threshold && threshold > 0 ) ||
+			( cfd[i*stride] < threshold && threshold < 0 ) ) ) {
+			
+			// Mark the arming threshold point
+			unsigned int armed_at = i;
+			
+			// Find zero crossing - Liam version, but James effects the same thing
+			bool xing = false;
+			while( !xing && i + 1 < trace_length ) {
+			
+				// Move to the next sample
+				i++;
+				
+				// Reject incorrect polarity - Liam version, but James effects the same thing
+				if( threshold < 0 && cfd[(i-1)*stride] > 0 ) continue;
+				if( threshold > 0 && cfd[(i-1)*stride] < 0 ) continue;
+			
+				// Found a zero-crossing
+				if( cfd[i*stride] * cfd[(i-1)*stride] < 0 ) xing = true;
+				
+			}
+			
+			// If we didn't find a crossing, stop now
+			if( !xing ) continue;
+			
+
+			// Check we have enough trace left to analyse
+			if( trace_length - i <= flat_top )
+				break;
+			
+			// Mark the CFD time - James
+			cfd_list.push_back( i );
+
+			// Mark the CFD time - Liam
+			//float cfd_time = (float)i / TMath::Abs(cfd[i*stride]);
+			//cfd_time += (float)(i-1) / TMath::Abs(cfd[(i-1)*stride]);
+			//cfd_time /= 1.0 / TMath::Abs(cfd[i*stride]) + 1.0 / TMath::Abs(cfd[(i-1)*stride]);
+			//cfd_list.push_back( cfd_time );
+			
+			// Baseline estimation comes from averaged trace
+			// Just in case a trigger comes before the baseline length, use whatever we can
+			if( cfd_list.size() == 1 ) {
+				
+				// First trigger with good baseline
+				if( i >= baseline_length )
+					baseline_energy = stage4[(i-baseline_length)*stride];
+				
+				// Or just use the first sample
+				else baseline_energy = stage4[0];
+			}
+			
+			else {
+				
+				// Not the first trigger but still with good baseline
+				if( i >= baseline_length + cfd_list.back() )
+					baseline_energy = stage4[(i-baseline_length)*stride];
+				
+				// Otherwise don't bother updating baseline, assume its the same
+				
+			}
+			
+			// move to peak of the flat top
+			i += flat_top;
+
+			// assess the energy from stage 4 and push back
+			energy_list.push_back( stage4[i*stride] - baseline_energy );
+			//energy_list.push_back( stage4[i*stride] );
+			
+			// Move to the end of the whole thing
+			//i += M + L - flat_top;
+			
+			// Check we are beyond the trigger hold off
+			if( i < armed_at + cfd_hold )
+				i = armed_at + cfd_hold;
+
+		} // threshold passed
+		
+	} // loop over CFD
+	
+	return;
+	
+}
+
 void FebexMWD::DoMWD() {
 	
 	// For now use James' naming convention and switch later
@@ -14,9 +128,6 @@ void FebexMWD::DoMWD() {
 	// Get the trace length
 	unsigned int trace_length = trace.size();
 	
-	// Baseline energy estimation
-	float baseline_energy = 0.0;
-	
 	// resize vectors
 	stage1.resize( trace_length, 0.0 );
 	stage2.resize( trace_length, 0.0 );
@@ -32,6 +143,16 @@ void FebexMWD::DoMWD() {
 	// skip first few samples?
 	unsigned int skip = 8;
 	
+	// James' simple CFD currently on firmware
+	fraction = 1.0;
+
+	// Running sums over the moving windows, so that each sample costs the
+	// same whatever the window lengths. The trace sums are kept in integers
+	// so they are exact, the stage 3 sum in double precision to avoid drift
+	long long int diff_sum = 0;	// differential[i-cfd_integration_time..i-1]
+	long long int trace_sum = 0;	// trace[i-M..i-1]
+	double stage3_sum = 0.0;		// stage3[i-L..i-1]
+
 	// Loop over trace and analyse
 	for( unsigned int i = 0; i < trace_length; ++i ) {
 		
@@ -41,27 +162,18 @@ void FebexMWD::DoMWD() {
 
 		// Make some default values for derived pulses
 		differential[i] = 0;
-		shaper[i] = 0;
-		cfd[i] = 0;
-		//stage1[i] = 0;
-		//stage2[i] = 0;
-		//stage3[i] = 0;
-		//stage4[i] = 0;
-		
-		// James' simple CFD currently on firmware
 		shaper[i] = trace[i];
-		fraction = 1.0;
+		cfd[i] = 0;
+		stage4[i] = 0;
 
 		// Shaped pulse
 		if( i >= cfd_shaping_time + skip && i >= cfd_integration_time + skip ) {
 			
 			// James - differential-integrating shaper
-			differential[i] = trace[i] - trace[i-cfd_shaping_time];
-			for( unsigned int j = 1; j <= cfd_integration_time; ++j )
-				shaper[i] += differential[i-j];
+			differential[i] = (int)trace[i] - (int)trace[i-cfd_shaping_time];
+			shaper[i] = trace[i] + diff_sum;
 			shaper[i] /= cfd_integration_time;
 			
-			
 			// Liam - simple differential shaper
 			//shaper[i] = trace[i] - trace[i-cfd_shaping_time];
 			
@@ -84,12 +196,9 @@ void FebexMWD::DoMWD() {
 			stage1[i]  = (int)trace[i];
 			stage1[i] -= (int)trace[i-M];
 			
-		
 			// MWD stage 2 - remove decay and average
 			// this is 'MA' in James' MATLAB code
-			stage2[i] = 0;
-			for( unsigned int j = 1; j <= M; ++j )
-				stage2[i] += (int)trace[i-j];
+			stage2[i] = trace_sum;
 			stage2[i] /= torr;
 			
 			// MWD stage 3 - moving average
@@ -102,117 +211,573 @@ void FebexMWD::DoMWD() {
 		// This is 'T' in James' MWD code
 		if( i >= L + skip ){
 			
-			for( unsigned int j = 1; j <= L; ++j )
-				stage4[i] += stage3[i-j];
-			
+			stage4[i] = stage3_sum;
 			stage4[i] /= L;
 			
 		}
+		
+		// Move the windows on by one sample
+		diff_sum += (long long int)differential[i];
+		if( i >= cfd_integration_time )
+			diff_sum -= (long long int)differential[i-cfd_integration_time];
+		trace_sum += trace[i];
+		if( i >= M ) trace_sum -= trace[i-M];
+		stage3_sum += stage3[i];
+		if( i >= L ) stage3_sum -= stage3[i-L];
 				
 	} // loop over trace
 	
 	
 	// Loop now over the CFD trace until we trigger
-	// This is not the same as James' trigger, but it's better
-	// plus he has updated his CFD and I don't have the new one
-	for( unsigned int i = skip; i < trace_length; ++i ) {
+	FebexMWDTriggers( cfd.data(), stage4.data(), 1, trace_length, skip,
+					  cfd_delay, cfd_hold, threshold, flat_top, baseline_length,
+					  cfd_list, energy_list );
+	
+	return;
+	
+}
+
+// Make a ring big enough to look back n samples, and return the mask
+// that wraps the sample number into it
+template<typename T>
+static unsigned int FebexMWDRing( std::vector<T> &ring, unsigned int n ) {
+	
+	unsigned int size = 1;
+	while( size <= n ) size <<= 1;
+	ring.assign( size, 0 );
+	return size - 1;
+	
+}
+
+void FebexMWD::DoMWDEnergy( const unsigned short *samples, unsigned int nsamples ) {
+	
+	// Integer version if we want to match the firmware
+	if( fixed_point ) {
+		DoMWDFixed( samples, nsamples );
+		return;
+	}
+	
+	// Same as DoMWD
+	unsigned int L = rise_time + 3; // 3 clock cycles delay in VHDL
+	unsigned int M = window + 3; // 3 clock cycles delay in VHDL
+	unsigned int torr = decay_time;
+	unsigned int skip = 8;
+	fraction = 1.0;
+
+	// Start again
+	energy_list.clear();
+	cfd_list.clear();
+	clipped = false;
+	
+	// Rings for the stages that we need to look back at
+	unsigned int diff_mask = FebexMWDRing( ring_differential, cfd_integration_time );
+	unsigned int shaper_mask = FebexMWDRing( ring_shaper, cfd_delay );
+	unsigned int stage3_mask = FebexMWDRing( ring_stage3, L );
+	unsigned int stage4_mask = FebexMWDRing( ring_stage4, baseline_length );
+	
+	// Running sums, as in DoMWD
+	long long int diff_sum = 0;
+	long long int trace_sum = 0;
+	double stage3_sum = 0.0;
+	
+	FebexMWDTrigger<float> trigger( nsamples, skip, cfd_delay, cfd_hold,
+								    threshold, flat_top, baseline_length );
+	float baseline_energy = 0.0, stage4_first = 0.0;
+	
+	for( unsigned int i = 0; i < nsamples; ++i ) {
 		
-		// Trigger when we pass the threshold on the CFD
-		if( i > cfd_delay + skip &&
-		   ( ( cfd[i] > threshold && threshold > 0 ) ||
-			( cfd[i] < threshold && threshold < 0 ) ) ) {
-			
-			// Mark the arming threshold point
-			unsigned int armed_at = i;
-			
-			// Find zero crossing - Liam version, but James effects the same thing
-			bool xing = false;
-			while( !xing && i < trace_length ) {
-			
-				// Move to the next sample
-				i++;
-				
-				// Reject incorrect polarity - Liam version, but James effects the same thing
-				if( threshold < 0 && cfd[i-1] > 0 ) continue;
-				if( threshold > 0 && cfd[i-1] < 0 ) continue;
-			
-				// Found a zero-crossing
-				if( cfd[i] * cfd[i-1] < 0 ) xing = true;
-				
-			}
-			
-			// If we didn't find a crossing, stop now
-			if( !xing ) continue;
-			
+		// Check if we are clipped
+		if( samples[i] == 0 || (samples[i] & 0x0000FFFF) == 0x0000FFFF )
+			clipped = true;
+		
+		// Nothing more to find, only the clipping to check
+		if( trigger.Done() ) continue;
+		
+		// Shaped pulse
+		float differential = 0;
+		float shaper = samples[i];
+		if( i >= cfd_shaping_time + skip && i >= cfd_integration_time + skip ) {
+			differential = samples[i] - samples[i-cfd_shaping_time];
+			shaper = samples[i] + diff_sum;
+			shaper /= cfd_integration_time;
+		}
+		
+		// CFD trace
+		float cfd = 0;
+		if( i >= cfd_delay + skip ) {
+			cfd  = fraction * shaper;
+			cfd -= ring_shaper[ (i-cfd_delay) & shaper_mask ];
+		}
+		
+		// MWD stages 1, 2 and 3
+		float stage3 = 0;
+		if( i >= M + skip ) {
+			float stage1 = (int)samples[i];
+			stage1 -= (int)samples[i-M];
+			float stage2 = trace_sum;
+			stage2 /= torr;
+			stage3 = stage1 + stage2;
+		}
+		
+		// MWD stage 4
+		float stage4 = 0;
+		if( i >= L + skip ){
+			stage4 = stage3_sum;
+			stage4 /= L;
+		}
+		
+		// Keep this sample and move the windows on
+		ring_differential[ i & diff_mask ] = differential;
+		ring_shaper[ i & shaper_mask ] = shaper;
+		ring_stage3[ i & stage3_mask ] = stage3;
+		ring_stage4[ i & stage4_mask ] = stage4;
+		diff_sum += (long long int)differential;
+		if( i >= cfd_integration_time )
+			diff_sum -= (long long int)ring_differential[ (i-cfd_integration_time) & diff_mask ];
+		trace_sum += samples[i];
+		if( i >= M ) trace_sum -= samples[i-M];
+		stage3_sum += stage3;
+		if( i >= L ) stage3_sum -= ring_stage3[ (i-L) & stage3_mask ];
+		
+		// Look for triggers, the baseline is taken at the CFD time
+		if( i == 0 ) stage4_first = stage4;
+		unsigned int found = trigger.Step( i, cfd, cfd_list );
+		if( found & trigger.BASELINE ) {
+			if( i - trigger.GetBaselineSample() <= stage4_mask )
+				baseline_energy = ring_stage4[ trigger.GetBaselineSample() & stage4_mask ];
+			else baseline_energy = stage4_first;
+		}
+		if( found & trigger.ENERGY )
+			energy_list.push_back( stage4 - baseline_energy );
+		
+	}
+	
+	return;
+	
+}
 
-			// Check we have enough trace left to analyse
-			if( trace_length - i < flat_top )
-				break;
-			
-			// Mark the CFD time - James
-			cfd_list.push_back( i );
+// Reciprocal of n with 32 fractional bits, rounded to nearest
+static inline long long int FebexMWDReciprocal( unsigned int n ) {
+	
+	if( n == 0 ) n = 1;
+	return ( ( 1LL << 32 ) + n / 2 ) / n;
+	
+}
 
-			// Mark the CFD time - Liam
-			//float cfd_time = (float)i / TMath::Abs(cfd[i]);
-			//cfd_time += (float)(i-1) / TMath::Abs(cfd[i-1]);
-			//cfd_time /= 1.0 / TMath::Abs(cfd[i]) + 1.0 / TMath::Abs(cfd[i-1]);
-			//cfd_list.push_back( cfd_time );
-			
-			// Baseline estimation comes from averaged trace
-			// Just in case a trigger comes before the baseline length, use whatever we can
-			if( cfd_list.size() == 1 ) {
-				
-				// First trigger with good baseline
-				if( i >= baseline_length )
-					baseline_energy = stage4[i-baseline_length];
-				
-				// Or just use the first sample
-				else baseline_energy = stage4[0];
-			}
-			
-			else {
-				
-				// Not the first trigger but still with good baseline
-				if( i >= baseline_length + cfd_list.back() )
-					baseline_energy = stage4[i-baseline_length];
-				
-				// Otherwise don't bother updating baseline, assume its the same
-				
-			}
-			
-			// move to peak of the flat top
-			i += flat_top;
+// Multiply by a reciprocal and drop the extra fractional bits, rounding
+// to nearest. Done in 128 bits so the sums of long windows cannot overflow
+static inline long long int FebexMWDScale( long long int x, long long int inv, unsigned int down ) {
+	
+	__int128 y = (__int128)x * inv;
+	return (long long int)( ( y + ( (__int128)1 << ( down - 1 ) ) ) >> down );
+	
+}
 
-			// assess the energy from stage 4 and push back
-			energy_list.push_back( stage4[i] - baseline_energy );
-			//energy_list.push_back( stage4[i] );
+void FebexMWD::DoMWDFixed( const unsigned short *samples, unsigned int nsamples ) {
+	
+	// Same as DoMWD
+	unsigned int L = rise_time + 3; // 3 clock cycles delay in VHDL
+	unsigned int M = window + 3; // 3 clock cycles delay in VHDL
+	unsigned int torr = decay_time;
+	unsigned int skip = 8;
+
+	// Start again
+	energy_list.clear();
+	cfd_list.clear();
+	clipped = false;
+	
+	// Everything from the shaper and stage 2 on has fixed_shift fractional
+	// bits. The divisions become multiplications by reciprocals with 32
+	// fractional bits, then a shift back down to fixed_shift bits
+	unsigned int shift = fixed_shift > 16 ? 16 : fixed_shift;
+	unsigned int down = 32 - shift;
+	long long int one = 1LL << shift;
+	long long int inv_integration = FebexMWDReciprocal( cfd_integration_time );
+	long long int inv_torr = FebexMWDReciprocal( torr );
+	long long int inv_L = FebexMWDReciprocal( L );
+	
+	// Rings for the stages that we need to look back at
+	unsigned int diff_mask = FebexMWDRing( ring_fixed_differential, cfd_integration_time );
+	unsigned int shaper_mask = FebexMWDRing( ring_fixed_shaper, cfd_delay );
+	unsigned int stage3_mask = FebexMWDRing( ring_fixed_stage3, L );
+	unsigned int stage4_mask = FebexMWDRing( ring_fixed_stage4, baseline_length );
+	
+	// Running sums, all exact
+	long long int diff_sum = 0;
+	long long int trace_sum = 0;
+	long long int stage3_sum = 0;
+	
+	FebexMWDTrigger<long long int> trigger( nsamples, skip, cfd_delay, cfd_hold,
+										    threshold * one, flat_top, baseline_length );
+	long long int baseline_energy = 0, stage4_first = 0;
+	
+	for( unsigned int i = 0; i < nsamples; ++i ) {
+		
+		// Check if we are clipped
+		if( samples[i] == 0 || (samples[i] & 0x0000FFFF) == 0x0000FFFF )
+			clipped = true;
+		
+		// Nothing more to find, only the clipping to check
+		if( trigger.Done() ) continue;
+		
+		// Shaped pulse, CFD fraction is always 1 in the firmware
+		int differential = 0;
+		long long int shaper = samples[i] * one;
+		if( i >= cfd_shaping_time + skip && i >= cfd_integration_time + skip ) {
+			differential = (int)samples[i] - (int)samples[i-cfd_shaping_time];
+			shaper = FebexMWDScale( samples[i] + diff_sum, inv_integration, down );
+		}
+		
+		// CFD trace
+		long long int cfd = 0;
+		if( i >= cfd_delay + skip )
+			cfd = shaper - ring_fixed_shaper[ (i-cfd_delay) & shaper_mask ];
+		
+		// MWD stages 1, 2 and 3
+		long long int stage3 = 0;
+		if( i >= M + skip ) {
+			stage3  = ( (int)samples[i] - (int)samples[i-M] ) * one;
+			stage3 += FebexMWDScale( trace_sum, inv_torr, down );
+		}
+		
+		// MWD stage 4
+		long long int stage4 = 0;
+		if( i >= L + skip )
+			stage4 = FebexMWDScale( stage3_sum, inv_L, 32 );
+		
+		// Keep this sample and move the windows on
+		ring_fixed_differential[ i & diff_mask ] = differential;
+		ring_fixed_shaper[ i & shaper_mask ] = shaper;
+		ring_fixed_stage3[ i & stage3_mask ] = stage3;
+		ring_fixed_stage4[ i & stage4_mask ] = stage4;
+		diff_sum += differential;
+		if( i >= cfd_integration_time )
+			diff_sum -= ring_fixed_differential[ (i-cfd_integration_time) & diff_mask ];
+		trace_sum += samples[i];
+		if( i >= M ) trace_sum -= samples[i-M];
+		stage3_sum += stage3;
+		if( i >= L ) stage3_sum -= ring_fixed_stage3[ (i-L) & stage3_mask ];
+		
+		// Look for triggers, the energy is rounded to an integer
+		if( i == 0 ) stage4_first = stage4;
+		unsigned int found = trigger.Step( i, cfd, cfd_list );
+		if( found & trigger.BASELINE ) {
+			if( i - trigger.GetBaselineSample() <= stage4_mask )
+				baseline_energy = ring_fixed_stage4[ trigger.GetBaselineSample() & stage4_mask ];
+			else baseline_energy = stage4_first;
+		}
+		if( found & trigger.ENERGY )
+			energy_list.push_back( ( stage4 - baseline_energy + one / 2 ) >> shift );
+		
+	}
+	
+	return;
+	
+}
+
+FebexMWDBatch::FebexMWDBatch() {
+	
+	ntraces = 0;
+	trace_length = 0;
+	ngroups = 0;
+	
+}
+
+void FebexMWDBatch::SetParameters( const FebexMWD &mwd ) {
+	
+	rise_time = mwd.rise_time;
+	flat_top = mwd.flat_top;
+	window = mwd.window;
+	baseline_length = mwd.baseline_length;
+	decay_time = mwd.decay_time;
+	cfd_delay = mwd.cfd_delay;
+	cfd_hold = mwd.cfd_hold;
+	cfd_shaping_time = mwd.cfd_shaping_time;
+	cfd_integration_time = mwd.cfd_integration_time;
+	threshold = mwd.threshold;
+	
+	// The fraction is always 1.0 in FebexMWD::DoMWD for now
+	
+}
+
+bool FebexMWDBatch::SameParameters( const FebexMWD &mwd ) const {
+	
+	return rise_time == mwd.rise_time && flat_top == mwd.flat_top &&
+		   window == mwd.window && baseline_length == mwd.baseline_length &&
+		   decay_time == mwd.decay_time && cfd_delay == mwd.cfd_delay &&
+		   cfd_hold == mwd.cfd_hold && cfd_shaping_time == mwd.cfd_shaping_time &&
+		   cfd_integration_time == mwd.cfd_integration_time &&
+		   threshold == mwd.threshold;
+	
+}
+
+bool FebexMWDBatch::CanBatch( const FebexMWD &mwd ) {
+	
+	// The running sums of up to 32767 samples fit in 32-bit integers,
+	// and the batch is only done in floating point
+	return mwd.window + 3 < 32768 && mwd.cfd_integration_time < 32768 &&
+		!mwd.fixed_point;
+	
+}
+
+bool FebexMWDBatch::AddTrace( const unsigned short *samples, unsigned int nsamples ) {
+	
+	// All traces need to be the same length as the first one
+	if( ntraces == 0 ) trace_length = nsamples;
+	else if( nsamples != trace_length || ntraces >= BATCH_SIZE )
+		return false;
+	
+	traces[ntraces++] = samples;
+	return true;
+	
+}
+
+// Traces are done in groups of this many, the width of an AVX register
+static const unsigned int MWD_LANES = 8;
+
+// One sample of the MWD for a group of traces, see FebexMWD::DoMWD for
+// what each step is. The sums of the trace and differential are exact in
+// 32-bit integers, see FebexMWDBatch::CanBatch, and the stage 3 sum is a
+// double as in FebexMWD, so the results are exactly the same. Each step
+// is its own loop over the traces, without branches, so it vectorises
+static FEBEXMWD_INLINE void FebexMWDBatchSample( unsigned int i,
+										unsigned int L, unsigned int M, unsigned int torr,
+										unsigned int cfd_delay, unsigned int cfd_shaping_time,
+										unsigned int cfd_integration_time, unsigned int skip,
+										const int *__restrict__ trace, int *__restrict__ differential,
+										float *__restrict__ shaper, float *__restrict__ cfd,
+										float *__restrict__ stage3, float *__restrict__ stage4,
+										int *__restrict__ diff_sum, int *__restrict__ trace_sum,
+										double *__restrict__ stage3_sum, unsigned char *__restrict__ clipped ) {
+	
+	// Offsets back to earlier samples of the same trace
+	const long shaping_back = (long)cfd_shaping_time * MWD_LANES;
+	const long integration_back = (long)cfd_integration_time * MWD_LANES;
+	const long delay_back = (long)cfd_delay * MWD_LANES;
+	const long M_back = (long)M * MWD_LANES;
+	const long L_back = (long)L * MWD_LANES;
+	const float fraction = 1.0;
+	
+	// Check if we are clipped
+	for( unsigned int k = 0; k < MWD_LANES; ++k )
+		clipped[k] |= ( trace[k] == 0 || trace[k] == 0xFFFF );
+	
+	// Shaped pulse
+	if( i >= cfd_shaping_time + skip && i >= cfd_integration_time + skip ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k ) {
+			differential[k] = trace[k] - trace[k-shaping_back];
+			shaper[k] = (float)( trace[k] + diff_sum[k] ) / cfd_integration_time;
+		}
+	}
+	else {
+		for( unsigned int k = 0; k < MWD_LANES; ++k ) {
+			differential[k] = 0;
+			shaper[k] = trace[k];
+		}
+	}
+	
+	// CFD trace
+	if( i >= cfd_delay + skip ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			cfd[k] = fraction * shaper[k] - shaper[k-delay_back];
+	}
+	else {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			cfd[k] = 0;
+	}
+	
+	// MWD stages 1, 2 and 3
+	if( i >= M + skip ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			stage3[k] = ( (float)trace[k] - (float)trace[k-M_back] ) + (float)trace_sum[k] / torr;
+	}
+	else {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			stage3[k] = 0;
+	}
+	
+	// MWD stage 4
+	if( i >= L + skip ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			stage4[k] = (float)stage3_sum[k] / L;
+	}
+	else {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			stage4[k] = 0;
+	}
+	
+	// Move the windows on by one sample
+	for( unsigned int k = 0; k < MWD_LANES; ++k ) {
+		diff_sum[k] += differential[k];
+		trace_sum[k] += trace[k];
+		stage3_sum[k] += stage3[k];
+	}
+	if( i >= cfd_integration_time ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			diff_sum[k] -= differential[k-integration_back];
+	}
+	if( i >= M ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			trace_sum[k] -= trace[k-M_back];
+	}
+	if( i >= L ) {
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			stage3_sum[k] -= stage3[k-L_back];
+	}
+	
+}
+
+// The whole MWD for all the groups of traces. It is compiled twice on
+// x86-64, the second time for AVX2, so the loops over the traces in a
+// group can use the wider registers. The running sums stay in registers.
+// It has to be inlined by force, otherwise GCC won't inline it into the
+// AVX2 version as it has different target options
+static FEBEXMWD_INLINE void FebexMWDBatchLoop( unsigned int trace_length, unsigned int ngroups,
+									  unsigned int L, unsigned int M, unsigned int torr,
+									  unsigned int cfd_delay, unsigned int cfd_shaping_time,
+									  unsigned int cfd_integration_time, unsigned int skip,
+									  const int *trace, int *differential, float *shaper,
+									  float *cfd, float *stage3, float *stage4,
+									  unsigned char *clipped ) {
+	
+	for( unsigned int g = 0; g < ngroups; ++g ) {
+		
+		int diff_sum[MWD_LANES] = {}, trace_sum[MWD_LANES] = {};
+		double stage3_sum[MWD_LANES] = {};
+		unsigned char clip[MWD_LANES] = {};
+		
+		for( unsigned int i = 0; i < trace_length; ++i ) {
 			
-			// Move to the end of the whole thing
-			//i += M + L - flat_top;
+			unsigned long o = ( (unsigned long)g * trace_length + i ) * MWD_LANES;
+			FebexMWDBatchSample( i, L, M, torr, cfd_delay, cfd_shaping_time,
+								 cfd_integration_time, skip, trace + o, differential + o,
+								 shaper + o, cfd + o, stage3 + o, stage4 + o,
+								 diff_sum, trace_sum, stage3_sum, clip );
 			
-			// Check we are beyond the trigger hold off
-			if( i < armed_at + cfd_hold )
-				i = armed_at + cfd_hold;
+		}
+		
+		for( unsigned int k = 0; k < MWD_LANES; ++k )
+			clipped[ g * MWD_LANES + k ] = clip[k];
+		
+	}
+	
+}
 
-		} // threshold passed
+#ifdef FEBEXMWD_X86
+__attribute__((target("avx2")))
+static void FebexMWDBatchLoopAVX2( unsigned int trace_length, unsigned int ngroups,
+								   unsigned int L, unsigned int M, unsigned int torr,
+								   unsigned int cfd_delay, unsigned int cfd_shaping_time,
+								   unsigned int cfd_integration_time, unsigned int skip,
+								   const int *trace, int *differential, float *shaper,
+								   float *cfd, float *stage3, float *stage4,
+								   unsigned char *clipped ) {
+	
+	FebexMWDBatchLoop( trace_length, ngroups, L, M, torr, cfd_delay, cfd_shaping_time,
+					   cfd_integration_time, skip, trace, differential, shaper,
+					   cfd, stage3, stage4, clipped );
+	
+}
+#endif
+
+void FebexMWDBatch::DoMWD() {
+	
+	// Same as FebexMWD::DoMWD
+	unsigned int L = rise_time + 3; // 3 clock cycles delay in VHDL
+	unsigned int M = window + 3; // 3 clock cycles delay in VHDL
+	unsigned int torr = decay_time;
+	unsigned int skip = 8;
+	
+	// Groups of traces, the last one is filled up with zeros
+	ngroups = ( ntraces + MWD_LANES - 1 ) / MWD_LANES;
+	unsigned long nelements = (unsigned long)ngroups * trace_length * MWD_LANES;
+	trace.assign( nelements, 0 );
+	differential.resize( nelements );
+	shaper.resize( nelements );
+	cfd.resize( nelements );
+	stage3.resize( nelements );
+	stage4.resize( nelements );
+	
+	// Interleave the samples of the traces in each group
+	for( unsigned int k = 0; k < ntraces; ++k ) {
 		
-	} // loop over CFD
+		int *t = trace.data() + Offset( k );
+		for( unsigned int i = 0; i < trace_length; ++i )
+			t[ i * MWD_LANES ] = traces[k][i];
+		
+	}
+	
+	// Run the MWD on all of them
+	unsigned char clip[BATCH_SIZE];
+#ifdef FEBEXMWD_X86
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if( has_avx2 )
+		FebexMWDBatchLoopAVX2( trace_length, ngroups, L, M, torr, cfd_delay, cfd_shaping_time,
+							   cfd_integration_time, skip, trace.data(), differential.data(),
+							   shaper.data(), cfd.data(), stage3.data(), stage4.data(), clip );
+	else
+#endif
+	FebexMWDBatchLoop( trace_length, ngroups, L, M, torr, cfd_delay, cfd_shaping_time,
+					   cfd_integration_time, skip, trace.data(), differential.data(),
+					   shaper.data(), cfd.data(), stage3.data(), stage4.data(), clip );
+	
+	// Triggers and energies, one trace at a time
+	for( unsigned int k = 0; k < ntraces; ++k ) {
+		
+		clipped[k] = clip[k];
+		energy_list[k].clear();
+		cfd_list[k].clear();
+		FebexMWDTriggers( cfd.data() + Offset( k ), stage4.data() + Offset( k ), MWD_LANES,
+						  trace_length, skip, cfd_delay, cfd_hold, threshold, flat_top,
+						  baseline_length, cfd_list[k], energy_list[k] );
+		
+	}
 	
 	return;
 	
 }
 
+// Position of the first sample of trace k in the interleaved buffers
+unsigned long FebexMWDBatch::Offset( unsigned int k ) const {
+	
+	return (unsigned long)( k / MWD_LANES ) * trace_length * MWD_LANES + k % MWD_LANES;
+	
+}
+
 MiniballCalibration::MiniballCalibration( std::string filename, std::shared_ptr<MiniballSettings> myset ) {
 
 	SetFile( filename );
 	set = myset;
-	fRand = std::make_unique<TRandom3>();
+	fRandKey = 0;
 	default_qint = false;
 
+	// Only the invalid entry until we read the calibration
+	fFebexNSfp = fFebexNBoard = fFebexNCh = 0;
+	BuildFebexTable();
+
 }
 
 void MiniballCalibration::ReadCalibration() {
 
+	// If the file hasn't changed since last time, take it from the cache.
+	// The sizes of everything come from the settings, so they go in the key
+	unsigned long long key;
+	bool cache = ConfigFileHash( fInputFile, key );
+	if( cache ) {
+		
+		key = ConfigCacheMix( key, set->GetNumberOfFebexSfps() );
+		key = ConfigCacheMix( key, set->GetNumberOfFebexBoards() );
+		key = ConfigCacheMix( key, set->GetNumberOfFebexChannels() );
+		key = ConfigCacheMix( key, set->GetNumberOfDgfModules() );
+		key = ConfigCacheMix( key, set->GetNumberOfDgfChannels() );
+		key = ConfigCacheMix( key, set->GetNumberOfAdcModules() );
+		key = ConfigCacheMix( key, set->GetMaximumNumberOfAdcChannels() );
+		key = ConfigCacheMix( key, default_qint );
+		
+		if( ReadCache( key ) ) return;
+		
+	}
+
 	std::unique_ptr<TEnv> config = std::make_unique<TEnv>( fInputFile.data() );
 	
 	default_FebexMWD_Decay			= 5000;
@@ -220,6 +785,8 @@ void MiniballCalibration::ReadCalibration() {
 	default_FebexMWD_Top			= 870; // mwd_cfd_trig_delay
 	default_FebexMWD_Baseline		= 60;  // delay MWD in James' firmware
 	default_FebexMWD_Window			= 880; // M
+	default_FebexMWD_FixedPoint		= false;
+	default_FebexMWD_FixedShift		= 16;  // fractional bits, 16 at most
 	default_FebexCFD_Delay			= 30;
 	default_FebexCFD_HoldOff		= 100; // prevent double triggering?
 	default_FebexCFD_Shaping		= 15;
@@ -232,6 +799,9 @@ void MiniballCalibration::ReadCalibration() {
 	fFebexGain.resize( set->GetNumberOfFebexSfps() );
 	fFebexGainQuadr.resize( set->GetNumberOfFebexSfps() );
 	fFebexThreshold.resize( set->GetNumberOfFebexSfps() );
+	fFebexMWD_Offset.resize( set->GetNumberOfFebexSfps() );
+	fFebexMWD_Gain.resize( set->GetNumberOfFebexSfps() );
+	fFebexMWD_Threshold.resize( set->GetNumberOfFebexSfps() );
 	fFebexType.resize( set->GetNumberOfFebexSfps() );
 	fFebexTime.resize( set->GetNumberOfFebexSfps() );
 	fFebexMWD_Decay.resize( set->GetNumberOfFebexSfps() );
@@ -239,6 +809,8 @@ void MiniballCalibration::ReadCalibration() {
 	fFebexMWD_Top.resize( set->GetNumberOfFebexSfps() );
 	fFebexMWD_Baseline.resize( set->GetNumberOfFebexSfps() );
 	fFebexMWD_Window.resize( set->GetNumberOfFebexSfps() );
+	fFebexMWD_FixedPoint.resize( set->GetNumberOfFebexSfps() );
+	fFebexMWD_FixedShift.resize( set->GetNumberOfFebexSfps() );
 	fFebexCFD_Delay.resize( set->GetNumberOfFebexSfps() );
 	fFebexCFD_HoldOff.resize( set->GetNumberOfFebexSfps() );
 	fFebexCFD_Shaping.resize( set->GetNumberOfFebexSfps() );
@@ -254,11 +826,16 @@ void MiniballCalibration::ReadCalibration() {
 	std::string default_FebexType = config->GetValue( "febex.Type", "Qshort" );
 	if( default_qint ) default_FebexType = "Qint"; // override for MBS
 	long default_FebexTime = (long)config->GetValue( "febex.Time", (double)0 );
+	double default_FebexMWD_Offset = (double)config->GetValue( "febex.MWD.Offset", (double)0 );
+	double default_FebexMWD_Gain = (double)config->GetValue( "febex.MWD.Gain", (double)1 );
+	double default_FebexMWD_Threshold = (double)config->GetValue( "febex.MWD.Threshold", (double)0 );
 	default_FebexMWD_Decay = (unsigned int)config->GetValue( "febex.MWD.DecayTime", (double)default_FebexMWD_Decay );
 	default_FebexMWD_Rise = (unsigned int)config->GetValue( "febex_.MWD.RiseTime", (double)default_FebexMWD_Rise );
 	default_FebexMWD_Top = (unsigned int)config->GetValue( "febex.MWD.FlatTop", (double)default_FebexMWD_Top );
 	default_FebexMWD_Baseline = (unsigned int)config->GetValue( "febex.MWD.Baseline", (double)default_FebexMWD_Baseline );
 	default_FebexMWD_Window = (unsigned int)config->GetValue( "febex.MWD.Window", (double)default_FebexMWD_Window );
+	default_FebexMWD_FixedPoint = config->GetValue( "febex.MWD.FixedPoint", default_FebexMWD_FixedPoint );
+	default_FebexMWD_FixedShift = (unsigned int)config->GetValue( "febex.MWD.FixedShift", (double)default_FebexMWD_FixedShift );
 	default_FebexCFD_Delay = (unsigned int)config->GetValue( "febex.CFD.DelayTime", (double)default_FebexCFD_Delay );
 	default_FebexCFD_HoldOff = (unsigned int)config->GetValue( "febex.CFD.HoldOff", (double)default_FebexCFD_HoldOff );
 	default_FebexCFD_Shaping = (unsigned int)config->GetValue( "febex.CFD.ShapingTime", (double)default_FebexCFD_Shaping );
@@ -274,6 +851,9 @@ void MiniballCalibration::ReadCalibration() {
 		fFebexGain[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexGainQuadr[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexThreshold[i].resize( set->GetNumberOfFebexBoards() );
+		fFebexMWD_Offset[i].resize( set->GetNumberOfFebexBoards() );
+		fFebexMWD_Gain[i].resize( set->GetNumberOfFebexBoards() );
+		fFebexMWD_Threshold[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexType[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexTime[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexMWD_Decay[i].resize( set->GetNumberOfFebexBoards() );
@@ -281,6 +861,8 @@ void MiniballCalibration::ReadCalibration() {
 		fFebexMWD_Top[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexMWD_Baseline[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexMWD_Window[i].resize( set->GetNumberOfFebexBoards() );
+		fFebexMWD_FixedPoint[i].resize( set->GetNumberOfFebexBoards() );
+		fFebexMWD_FixedShift[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexCFD_Delay[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexCFD_HoldOff[i].resize( set->GetNumberOfFebexBoards() );
 		fFebexCFD_Shaping[i].resize( set->GetNumberOfFebexBoards() );
@@ -294,11 +876,16 @@ void MiniballCalibration::ReadCalibration() {
 		unsigned int sfpFebexThreshold = (unsigned int)config->GetValue( Form( "febex_%d.Threshold", i ), (double)default_FebexThreshold );
 		std::string sfpFebexType = config->GetValue( Form( "febex_%d.Type", i ), default_FebexType.data() );
 		long sfpFebexTime = (long)config->GetValue( Form( "febex_%d.Time", i ), (double)default_FebexTime );
+		double sfpFebexMWD_Offset = (double)config->GetValue( Form( "febex_%d.MWD.Offset", i ), (double)default_FebexMWD_Offset );
+		double sfpFebexMWD_Gain = (double)config->GetValue( Form( "febex_%d.MWD.Gain", i ), (double)default_FebexMWD_Gain );
+		double sfpFebexMWD_Threshold = (double)config->GetValue( Form( "febex_%d.MWD.Threshold", i ), (double)default_FebexMWD_Threshold );
 		unsigned int sfpFebexMWD_Decay = (unsigned int)config->GetValue( Form( "febex_%d.MWD.DecayTime", i ), (double)default_FebexMWD_Decay );
 		unsigned int sfpFebexMWD_Rise = (unsigned int)config->GetValue( Form( "febex_%d.MWD.RiseTime", i ), (double)default_FebexMWD_Rise );
 		unsigned int sfpFebexMWD_Top = (unsigned int)config->GetValue( Form( "febex_%d.MWD.FlatTop", i ), (double)default_FebexMWD_Top );
 		unsigned int sfpFebexMWD_Baseline = (unsigned int)config->GetValue( Form( "febex_%d.MWD.Baseline", i ), (double)default_FebexMWD_Baseline );
 		unsigned int sfpFebexMWD_Window = (unsigned int)config->GetValue( Form( "febex_%d.MWD.Window", i ), (double)default_FebexMWD_Window );
+		bool sfpFebexMWD_FixedPoint = config->GetValue( Form( "febex_%d.MWD.FixedPoint", i ), default_FebexMWD_FixedPoint );
+		unsigned int sfpFebexMWD_FixedShift = (unsigned int)config->GetValue( Form( "febex_%d.MWD.FixedShift", i ), (double)default_FebexMWD_FixedShift );
 		unsigned int sfpFebexCFD_Delay = (unsigned int)config->GetValue( Form( "febex_%d.CFD.DelayTime", i ), (double)default_FebexCFD_Delay );
 		unsigned int sfpFebexCFD_HoldOff = (unsigned int)config->GetValue( Form( "febex_%d.CFD.HoldOff", i ), (double)default_FebexCFD_HoldOff );
 		unsigned int sfpFebexCFD_Shaping = (unsigned int)config->GetValue( Form( "febex_%d.CFD.ShapingTime", i ), (double)default_FebexCFD_Shaping );
@@ -312,6 +899,9 @@ void MiniballCalibration::ReadCalibration() {
 			fFebexGain[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexGainQuadr[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexThreshold[i][j].resize( set->GetNumberOfFebexChannels() );
+			fFebexMWD_Offset[i][j].resize( set->GetNumberOfFebexChannels() );
+			fFebexMWD_Gain[i][j].resize( set->GetNumberOfFebexChannels() );
+			fFebexMWD_Threshold[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexType[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexTime[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexMWD_Decay[i][j].resize( set->GetNumberOfFebexChannels() );
@@ -319,6 +909,8 @@ void MiniballCalibration::ReadCalibration() {
 			fFebexMWD_Top[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexMWD_Baseline[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexMWD_Window[i][j].resize( set->GetNumberOfFebexChannels() );
+			fFebexMWD_FixedPoint[i][j].resize( set->GetNumberOfFebexChannels() );
+			fFebexMWD_FixedShift[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexCFD_Delay[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexCFD_HoldOff[i][j].resize( set->GetNumberOfFebexChannels() );
 			fFebexCFD_Shaping[i][j].resize( set->GetNumberOfFebexChannels() );
@@ -332,11 +924,16 @@ void MiniballCalibration::ReadCalibration() {
 			unsigned int boardFebexThreshold = (unsigned int)config->GetValue( Form( "febex_%d_%d.Threshold", i, j ), (double)sfpFebexThreshold );
 			std::string boardFebexType = config->GetValue( Form( "febex_%d_%d.Type", i, j ), sfpFebexType.data() );
 			long boardFebexTime = (long)config->GetValue( Form( "febex_%d_%d.Time", i, j ), (double)sfpFebexTime );
+			double boardFebexMWD_Offset = (double)config->GetValue( Form( "febex_%d_%d.MWD.Offset", i, j ), (double)sfpFebexMWD_Offset );
+			double boardFebexMWD_Gain = (double)config->GetValue( Form( "febex_%d_%d.MWD.Gain", i, j ), (double)sfpFebexMWD_Gain );
+			double boardFebexMWD_Threshold = (double)config->GetValue( Form( "febex_%d_%d.MWD.Threshold", i, j ), (double)sfpFebexMWD_Threshold );
 			unsigned int boardFebexMWD_Decay = (unsigned int)config->GetValue( Form( "febex_%d_%d.MWD.DecayTime", i, j ), (double)sfpFebexMWD_Decay );
 			unsigned int boardFebexMWD_Rise = (unsigned int)config->GetValue( Form( "febex_%d_%d.MWD.RiseTime", i, j ), (double)sfpFebexMWD_Rise );
 			unsigned int boardFebexMWD_Top = (unsigned int)config->GetValue( Form( "febex_%d_%d.MWD.FlatTop", i, j ), (double)sfpFebexMWD_Top );
 			unsigned int boardFebexMWD_Baseline = (unsigned int)config->GetValue( Form( "febex_%d_%d.MWD.Baseline", i, j ), (double)sfpFebexMWD_Baseline );
 			unsigned int boardFebexMWD_Window = (unsigned int)config->GetValue( Form( "febex_%d_%d.MWD.Window", i, j ), (double)sfpFebexMWD_Window );
+			bool boardFebexMWD_FixedPoint = config->GetValue( Form( "febex_%d_%d.MWD.FixedPoint", i, j ), sfpFebexMWD_FixedPoint );
+			unsigned int boardFebexMWD_FixedShift = (unsigned int)config->GetValue( Form( "febex_%d_%d.MWD.FixedShift", i, j ), (double)sfpFebexMWD_FixedShift );
 			unsigned int boardFebexCFD_Delay = (unsigned int)config->GetValue( Form( "febex_%d_%d.CFD.DelayTime", i, j ), (double)sfpFebexCFD_Delay );
 			unsigned int boardFebexCFD_HoldOff = (unsigned int)config->GetValue( Form( "febex_%d_%d.CFD.HoldOff", i, j ), (double)sfpFebexCFD_HoldOff );
 			unsigned int boardFebexCFD_Shaping = (unsigned int)config->GetValue( Form( "febex_%d_%d.CFD.ShapingTime", i, j ), (double)sfpFebexCFD_Shaping );
@@ -352,11 +949,23 @@ void MiniballCalibration::ReadCalibration() {
 				fFebexThreshold[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.Threshold", i, j, k ), (double)boardFebexThreshold );
 				fFebexType[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.Type", i, j, k ), boardFebexType.data() );
 				fFebexTime[i][j][k] = (long)config->GetValue( Form( "febex_%d_%d_%d.Time", i, j, k ), (double)boardFebexTime );
+				fFebexMWD_Offset[i][j][k] = (double)config->GetValue( Form( "febex_%d_%d_%d.MWD.Offset", i, j, k ), (double)boardFebexMWD_Offset );
+				fFebexMWD_Gain[i][j][k] = (double)config->GetValue( Form( "febex_%d_%d_%d.MWD.Gain", i, j, k ), (double)boardFebexMWD_Gain );
+				fFebexMWD_Threshold[i][j][k] = (double)config->GetValue( Form( "febex_%d_%d_%d.MWD.Threshold", i, j, k ), (double)boardFebexMWD_Threshold );
 				fFebexMWD_Decay[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.MWD.DecayTime", i, j, k ), (double)boardFebexMWD_Decay );
 				fFebexMWD_Rise[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.MWD.RiseTime", i, j, k ), (double)boardFebexMWD_Rise );
 				fFebexMWD_Top[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.MWD.FlatTop", i, j, k ), (double)boardFebexMWD_Top );
 				fFebexMWD_Baseline[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.MWD.Baseline", i, j, k ), (double)boardFebexMWD_Baseline );
 				fFebexMWD_Window[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.MWD.Window", i, j, k ), (double)boardFebexMWD_Window );
+				fFebexMWD_FixedPoint[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.MWD.FixedPoint", i, j, k ), boardFebexMWD_FixedPoint );
+				fFebexMWD_FixedShift[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.MWD.FixedShift", i, j, k ), (double)boardFebexMWD_FixedShift );
+				
+				// More fractional bits would overflow the 64-bit sums
+				if( fFebexMWD_FixedShift[i][j][k] > 16 ) {
+					std::cerr << "MWD.FixedShift of febex_" << (int)i << "_" << (int)j << "_" << (int)k;
+					std::cerr << " is too large, using 16" << std::endl;
+					fFebexMWD_FixedShift[i][j][k] = 16;
+				}
 				fFebexCFD_Delay[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.CFD.DelayTime", i, j, k ), (double)boardFebexCFD_Delay );
 				fFebexCFD_HoldOff[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.CFD.HoldOff", i, j, k ), (double)boardFebexCFD_HoldOff );
 				fFebexCFD_Shaping[i][j][k] = (unsigned int)config->GetValue( Form( "febex_%d_%d_%d.CFD.ShapingTime", i, j, k ), (double)boardFebexCFD_Shaping );
@@ -438,29 +1047,182 @@ void MiniballCalibration::ReadCalibration() {
 
 	}
 
+	// Put the FEBEX values in the table used for each hit
+	fFebexNSfp = set->GetNumberOfFebexSfps();
+	fFebexNBoard = set->GetNumberOfFebexBoards();
+	fFebexNCh = set->GetNumberOfFebexChannels();
+	BuildFebexTable();
+
+	// Save it for next time
+	if( cache ) WriteCache( key );
+
+}
+
+template<typename A>
+void MiniballCalibration::CacheItems( A &ar ) {
+
+	// ADCs
+	ar.Item( fAdcTime );
+	ar.Item( fAdcOffset );
+	ar.Item( fAdcGain );
+	ar.Item( fAdcGainQuadr );
+	ar.Item( fAdcThreshold );
+
+	// DGFs
+	ar.Item( fDgfTime );
+	ar.Item( fDgfOffset );
+	ar.Item( fDgfGain );
+	ar.Item( fDgfGainQuadr );
+	ar.Item( fDgfThreshold );
+
+	// FEBEX
+	ar.Item( fFebexType );
+	ar.Item( fFebexTime );
+	ar.Item( fFebexOffset );
+	ar.Item( fFebexGain );
+	ar.Item( fFebexGainQuadr );
+	ar.Item( fFebexThreshold );
+	ar.Item( fFebexMWD_Offset );
+	ar.Item( fFebexMWD_Gain );
+	ar.Item( fFebexMWD_Threshold );
+
+	// MWD + CFD
+	ar.Item( fFebexMWD_Decay );
+	ar.Item( fFebexMWD_Rise );
+	ar.Item( fFebexMWD_Top );
+	ar.Item( fFebexMWD_Baseline );
+	ar.Item( fFebexMWD_Window );
+	ar.Item( fFebexMWD_FixedPoint );
+	ar.Item( fFebexMWD_FixedShift );
+	ar.Item( fFebexCFD_Delay );
+	ar.Item( fFebexCFD_HoldOff );
+	ar.Item( fFebexCFD_Shaping );
+	ar.Item( fFebexCFD_Integration );
+	ar.Item( fFebexCFD_Threshold );
+	ar.Item( fFebexCFD_Fraction );
+
+	// MWD defaults
+	ar.Item( default_FebexMWD_Decay );
+	ar.Item( default_FebexMWD_Rise );
+	ar.Item( default_FebexMWD_Top );
+	ar.Item( default_FebexMWD_Baseline );
+	ar.Item( default_FebexMWD_Window );
+	ar.Item( default_FebexMWD_FixedPoint );
+	ar.Item( default_FebexMWD_FixedShift );
+	ar.Item( default_FebexCFD_Fraction );
+	ar.Item( default_FebexCFD_Delay );
+	ar.Item( default_FebexCFD_HoldOff );
+	ar.Item( default_FebexCFD_Shaping );
+	ar.Item( default_FebexCFD_Integration );
+	ar.Item( default_FebexCFD_Threshold );
+
 }
 
-float MiniballCalibration::FebexEnergy( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int raw ) {
+bool MiniballCalibration::ReadCache( unsigned long long key ) {
+
+	MiniballCacheReader ar;
+	if( !ar.Open( ConfigCacheName( fInputFile, "calibration" ), key ) )
+		return false;
+
+	CacheItems( ar );
+	if( !ar.Good() ) {
+
+		// Something was wrong with it, so we'll read the text instead
+		std::cerr << "Ignoring bad calibration cache for " << fInputFile << std::endl;
+		return false;
+
+	}
+
+	// The table is made again rather than cached, it's quick
+	fFebexNSfp = set->GetNumberOfFebexSfps();
+	fFebexNBoard = set->GetNumberOfFebexBoards();
+	fFebexNCh = set->GetNumberOfFebexChannels();
+	BuildFebexTable();
+
+	return true;
+
+}
+
+void MiniballCalibration::WriteCache( unsigned long long key ) {
+
+	// It doesn't matter if this fails, we just read the text next time
+	MiniballCacheWriter ar;
+	CacheItems( ar );
+	ar.Save( ConfigCacheName( fInputFile, "calibration" ), key );
+
+}
+
+void MiniballCalibration::BuildFebexTable() {
+
+	// One entry for each channel, then the invalid one
+	fFebexTable.resize( fFebexNSfp * fFebexNBoard * fFebexNCh + 1 );
+
+	for( unsigned int i = 0; i < fFebexNSfp; i++ ){
+
+		for( unsigned int j = 0; j < fFebexNBoard; j++ ){
+
+			for( unsigned int k = 0; k < fFebexNCh; k++ ){
+
+				FebexChannelCal &fcal = fFebexTable[ ( i * fFebexNBoard + j ) * fFebexNCh + k ];
+				fcal.offset		= fFebexOffset[i][j][k];
+				fcal.gain		= fFebexGain[i][j][k];
+				fcal.gain_quadr	= fFebexGainQuadr[i][j][k];
+				fcal.mwd_offset	= fFebexMWD_Offset[i][j][k];
+				fcal.mwd_gain	= fFebexMWD_Gain[i][j][k];
+				fcal.mwd_threshold	= fFebexMWD_Threshold[i][j][k];
+				fcal.time		= fFebexTime[i][j][k];
+				fcal.threshold	= fFebexThreshold[i][j][k];
+				fcal.id			= ( i * fFebexNBoard + j ) * fFebexNCh + k;
+				fcal.valid		= true;
+
+				if( fFebexType[i][j][k] == "Qshort" ) fcal.type = FEBEX_QSHORT;
+				else if( fFebexType[i][j][k] == "Qint" ) fcal.type = FEBEX_QINT;
+				else fcal.type = FEBEX_UNKNOWN;
+
+				// Check if we have defaults
+				fcal.identity = TMath::Abs( fcal.gain_quadr ) < 1e-6 &&
+								TMath::Abs( fcal.gain - 1.0 ) < 1e-6 &&
+								TMath::Abs( fcal.offset ) < 1e-6;
+
+			}
+
+		}
+
+	}
+
+	// The same values as the functions give for a channel that doesn't exist
+	FebexChannelCal &invalid = fFebexTable.back();
+	invalid.offset		= 0.0;
+	invalid.gain		= 1.0;
+	invalid.gain_quadr	= 0.0;
+	invalid.mwd_offset	= 0.0;
+	invalid.mwd_gain	= 1.0;
+	invalid.mwd_threshold	= 0.0;
+	invalid.time		= 0;
+	invalid.threshold	= -1;
+	invalid.id			= fFebexTable.size() - 1;
+	invalid.type		= FEBEX_UNKNOWN;
+	invalid.valid		= false;
+	invalid.identity	= true;
+
+	return;
+
+}
+
+float MiniballCalibration::FebexEnergy( const FebexChannelCal &fcal, unsigned int raw, unsigned long long hit ) const {
 	
 	float energy, raw_rand;
 	
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
+	if( fcal.valid ) {
 
-		raw_rand = raw + 0.5 - fRand->Uniform();
+		raw_rand = raw + 0.5 - PhiloxUniform( hit, fcal.id, fRandKey );
 
-		energy  = fFebexGainQuadr[sfp][board][ch] * raw_rand * raw_rand;
-		energy += fFebexGain[sfp][board][ch] * raw_rand;
-		energy += fFebexOffset[sfp][board][ch];
+		energy  = fcal.gain_quadr * raw_rand * raw_rand;
+		energy += fcal.gain * raw_rand;
+		energy += fcal.offset;
 
 		// Check if we have defaults
-		if( TMath::Abs( fFebexGainQuadr[sfp][board][ch] ) < 1e-6 &&
-		    TMath::Abs( fFebexGain[sfp][board][ch] - 1.0 ) < 1e-6 &&
-		    TMath::Abs( fFebexOffset[sfp][board][ch] ) < 1e-6 )
-			
-			return raw;
-		
+		if( fcal.identity ) return raw;
 		else return energy;
 		
 	}
@@ -469,14 +1231,58 @@ float MiniballCalibration::FebexEnergy( unsigned char sfp, unsigned char board,
 	
 }
 
-float MiniballCalibration::DgfEnergy( unsigned char mod, unsigned char ch, unsigned int raw ) {
+float MiniballCalibration::FebexMWDEnergy( const FebexChannelCal &fcal, float amplitude ) const {
+	
+	// The MWD amplitude isn't an integer, so there is nothing to spread
+	if( fcal.valid ) return fcal.mwd_gain * amplitude + fcal.mwd_offset;
+	
+	return -1;
+	
+}
+
+void MiniballCalibration::FebexEnergy( const FebexChannelCal &fcal, const unsigned int *raw, unsigned int n,
+										unsigned long long first_hit, float *energy ) const {
+
+	// Nothing shared between the hits, so the compiler can vectorise it
+	if( !fcal.valid ) {
+		for( unsigned int i = 0; i < n; ++i ) energy[i] = -1;
+		return;
+	}
+
+	if( fcal.identity ) {
+		for( unsigned int i = 0; i < n; ++i ) energy[i] = raw[i];
+		return;
+	}
+
+	for( unsigned int i = 0; i < n; ++i ) {
+
+		float raw_rand = raw[i] + 0.5 - PhiloxUniform( first_hit + i, fcal.id, fRandKey );
+		energy[i]  = fcal.gain_quadr * raw_rand * raw_rand;
+		energy[i] += fcal.gain * raw_rand;
+		energy[i] += fcal.offset;
+
+	}
+
+	return;
+
+}
+
+float MiniballCalibration::FebexEnergy( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int raw, unsigned long long hit ) {
+	
+	return FebexEnergy( GetFebexCal( sfp, board, ch ), raw, hit );
+	
+}
+
+float MiniballCalibration::DgfEnergy( unsigned char mod, unsigned char ch, unsigned int raw, unsigned long long hit ) {
 	
 	float energy, raw_rand;
 	
 	if( mod < set->GetNumberOfDgfModules() &&
 	     ch < set->GetNumberOfDgfChannels() ) {
 
-		raw_rand = raw + 0.5 - fRand->Uniform();
+		// DGF channels come after the FEBEX ones for the random numbers
+		unsigned int id = ( 1U << 24 ) | ( mod << 8 ) | ch;
+		raw_rand = raw + 0.5 - PhiloxUniform( hit, id, fRandKey );
 
 		energy = fDgfGainQuadr[mod][ch] * raw_rand * raw_rand;
 		energy += fDgfGain[mod][ch] * raw_rand;
@@ -496,14 +1302,16 @@ float MiniballCalibration::DgfEnergy( unsigned char mod, unsigned char ch, unsig
 	
 }
 
-float MiniballCalibration::AdcEnergy( unsigned char mod, unsigned char ch, unsigned int raw ) {
+float MiniballCalibration::AdcEnergy( unsigned char mod, unsigned char ch, unsigned int raw, unsigned long long hit ) {
 	
 	float energy, raw_rand;
 	
 	if( mod < set->GetNumberOfAdcModules() &&
 	     ch < set->GetMaximumNumberOfAdcChannels() ) {
 
-		raw_rand = raw + 0.5 - fRand->Uniform();
+		// and then the ADC channels
+		unsigned int id = ( 2U << 24 ) | ( mod << 8 ) | ch;
+		raw_rand = raw + 0.5 - PhiloxUniform( hit, id, fRandKey );
 
 		energy  = fAdcGain[mod][ch] * raw_rand;
 		energy += fAdcOffset[mod][ch];
@@ -522,10 +1330,7 @@ float MiniballCalibration::AdcEnergy( unsigned char mod, unsigned char ch, unsig
 	
 }
 
-FebexMWD MiniballCalibration::DoMWD( unsigned char sfp, unsigned char board, unsigned char ch, std::vector<unsigned short> trace ) {
-	
-	// Create a FebexMWD class to hold the info
-	FebexMWD mwd;
+bool MiniballCalibration::SetupMWD( unsigned char sfp, unsigned char board, unsigned char ch, FebexMWD &mwd ) {
 	
 	// Check if it's a valid event first
 	if(   sfp < set->GetNumberOfFebexSfps() &&
@@ -533,12 +1338,13 @@ FebexMWD MiniballCalibration::DoMWD( unsigned char sfp, unsigned char board, uns
 	       ch < set->GetNumberOfFebexChannels() ) {
 
 		// Set the parameters of the MWD
-		mwd.SetTrace( trace );
 		mwd.SetRiseTime( fFebexMWD_Rise[sfp][board][ch] );
 		mwd.SetDecayTime( fFebexMWD_Decay[sfp][board][ch] );
 		mwd.SetFlatTop( fFebexMWD_Top[sfp][board][ch] );
 		mwd.SetBaseline( fFebexMWD_Baseline[sfp][board][ch] );
 		mwd.SetWindow( fFebexMWD_Window[sfp][board][ch] );
+		mwd.SetFixedPoint( fFebexMWD_FixedPoint[sfp][board][ch] );
+		mwd.SetFixedShift( fFebexMWD_FixedShift[sfp][board][ch] );
 		mwd.SetDelayTime( fFebexCFD_Delay[sfp][board][ch] );
 		mwd.SetHoldOff( fFebexCFD_HoldOff[sfp][board][ch] );
 		mwd.SetShapingTime( fFebexCFD_Shaping[sfp][board][ch] );
@@ -546,7 +1352,23 @@ FebexMWD MiniballCalibration::DoMWD( unsigned char sfp, unsigned char board, uns
 		mwd.SetThreshold( fFebexCFD_Threshold[sfp][board][ch] );
 		mwd.SetFraction( fFebexCFD_Fraction[sfp][board][ch] );
 
-		// Run the MWD
+		return true;
+		
+	}
+
+	return false;
+	
+}
+
+FebexMWD MiniballCalibration::DoMWD( unsigned char sfp, unsigned char board, unsigned char ch, std::vector<unsigned short> trace ) {
+	
+	// Create a FebexMWD class to hold the info
+	FebexMWD mwd;
+	
+	// Set the parameters and run the MWD if it's a valid event
+	if( SetupMWD( sfp, board, ch, mwd ) ) {
+
+		mwd.SetTrace( trace );
 		mwd.DoMWD();
 		
 	}
@@ -555,6 +1377,120 @@ FebexMWD MiniballCalibration::DoMWD( unsigned char sfp, unsigned char board, uns
 	
 }
 
+const FebexMWD& MiniballCalibration::DoMWDEnergy( unsigned char sfp, unsigned char board, unsigned char ch, const std::vector<unsigned short> &trace ) {
+	
+	// One for each thread, reused every time
+	static thread_local FebexMWD mwd;
+	
+	// Set the parameters and run the MWD if it's a valid event
+	if( SetupMWD( sfp, board, ch, mwd ) )
+		mwd.DoMWDEnergy( trace.data(), trace.size() );
+	else mwd.DoMWDEnergy( nullptr, 0 );
+
+	return mwd;
+	
+}
+
+void MiniballCalibration::DoMWD( std::vector<FebexMWDTrace> &traces ) {
+	
+	// One batch for each thread, so that the buffers are kept
+	static thread_local FebexMWDBatch batch;
+	
+	// The MWD set up for each channel in these traces, done once per channel
+	// rather than for every trace we try to put in a batch. Also kept
+	static thread_local std::vector<int> chan_setup;
+	static thread_local std::vector<FebexMWD> setups;
+	unsigned int nsetups = 0;
+	chan_setup.assign( set->GetNumberOfFebexSfps() * set->GetNumberOfFebexBoards() *
+					   set->GetNumberOfFebexChannels(), -1 );
+	
+	// Set up for each trace, or -1 for an invalid channel
+	std::vector<int> trace_setup( traces.size(), -1 );
+	for( unsigned int j = 0; j < traces.size(); ++j ) {
+		
+		if( traces[j].sfp >= set->GetNumberOfFebexSfps() ||
+		    traces[j].board >= set->GetNumberOfFebexBoards() ||
+		    traces[j].ch >= set->GetNumberOfFebexChannels() ) continue;
+		
+		unsigned int idx = ( traces[j].sfp * set->GetNumberOfFebexBoards() +
+							 traces[j].board ) * set->GetNumberOfFebexChannels() + traces[j].ch;
+		if( chan_setup[idx] < 0 ) {
+			
+			if( nsetups == setups.size() ) setups.emplace_back();
+			SetupMWD( traces[j].sfp, traces[j].board, traces[j].ch, setups[nsetups] );
+			chan_setup[idx] = nsetups++;
+			
+		}
+		trace_setup[j] = chan_setup[idx];
+		
+	}
+	
+	// Traces that are done already
+	std::vector<bool> done( traces.size(), false );
+	std::vector<unsigned int> members;
+	members.reserve( FebexMWDBatch::BATCH_SIZE );
+	
+	for( unsigned int j = 0; j < traces.size(); ++j ) {
+		
+		if( done[j] ) continue;
+		
+		// Nothing to do for an invalid channel
+		traces[j].clipped = false;
+		traces[j].energies.clear();
+		traces[j].cfd_times.clear();
+		if( trace_setup[j] < 0 ) {
+			done[j] = true;
+			continue;
+		}
+		FebexMWD &mwd = setups[ trace_setup[j] ];
+		
+		// Windows that are too long for the batch are done on their own
+		if( !FebexMWDBatch::CanBatch( mwd ) ) {
+			
+			mwd.DoMWDEnergy( traces[j].samples, traces[j].nsamples );
+			traces[j].clipped = mwd.IsClipped();
+			traces[j].energies = mwd.GetEnergies();
+			traces[j].cfd_times = mwd.GetCfdTimes();
+			done[j] = true;
+			continue;
+			
+		}
+		
+		// Fill a batch with this trace and those after it that
+		// have the same length and the same MWD parameters
+		batch.SetParameters( mwd );
+		batch.Clear();
+		members.clear();
+		for( unsigned int k = j; k < traces.size() &&
+			 members.size() < FebexMWDBatch::BATCH_SIZE; ++k ) {
+			
+			if( done[k] || traces[k].nsamples != traces[j].nsamples ) continue;
+			if( trace_setup[k] != trace_setup[j] && ( trace_setup[k] < 0 ||
+				!batch.SameParameters( setups[ trace_setup[k] ] ) ) ) continue;
+			
+			batch.AddTrace( traces[k].samples, traces[k].nsamples );
+			members.push_back( k );
+			done[k] = true;
+			
+		}
+		
+		// Run it and copy the results back
+		batch.DoMWD();
+		for( unsigned int m = 0; m < members.size(); ++m ) {
+			
+			FebexMWDTrace &t = traces[ members[m] ];
+			t.clipped = batch.IsClipped( m );
+			t.energies = batch.GetEnergies( m );
+			t.cfd_times = batch.GetCfdTimes( m );
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
 double MiniballCalibration::FebexOffset( unsigned char sfp, unsigned char board, unsigned char ch ) {
 	
 	if(   sfp < set->GetNumberOfFebexSfps() &&
@@ -599,29 +1535,13 @@ double MiniballCalibration::FebexGainQuadr( unsigned char sfp, unsigned char boa
 
 unsigned int MiniballCalibration::FebexThreshold( unsigned char sfp, unsigned char board, unsigned char ch ) {
 	
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
-
-		return fFebexThreshold[sfp][board][ch];
-		
-	}
-	
-	return -1;
+	return GetFebexCal( sfp, board, ch ).threshold;
 	
 }
 
 long MiniballCalibration::FebexTime( unsigned char sfp, unsigned char board, unsigned char ch ){
 	
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
-
-		return fFebexTime[sfp][board][ch];
-		
-	}
-	
-	return 0;
+	return GetFebexCal( sfp, board, ch ).time;
 	
 }
 
@@ -845,6 +1765,36 @@ void MiniballCalibration::SetMWDWindow( unsigned char sfp, unsigned char board,
 	
 }
 
+void MiniballCalibration::SetMWDFixedPoint( unsigned char sfp, unsigned char board, unsigned char ch, bool fixed ){
+	
+	if(   sfp < set->GetNumberOfFebexSfps() &&
+	    board < set->GetNumberOfFebexBoards() &&
+	       ch < set->GetNumberOfFebexChannels() ) {
+		
+		fFebexMWD_FixedPoint[sfp][board][ch] = fixed;
+		return;
+		
+	}
+	
+	else return;
+	
+}
+
+void MiniballCalibration::SetMWDFixedShift( unsigned char sfp, unsigned char board, unsigned char ch, unsigned int shift ){
+	
+	if(   sfp < set->GetNumberOfFebexSfps() &&
+	    board < set->GetNumberOfFebexBoards() &&
+	       ch < set->GetNumberOfFebexChannels() ) {
+		
+		fFebexMWD_FixedShift[sfp][board][ch] = shift > 16 ? 16 : shift;
+		return;
+		
+	}
+	
+	else return;
+	
+}
+
 void MiniballCalibration::SetCFDFraction( unsigned char sfp, unsigned char board, unsigned char ch, float fraction ){
 	
 	if(   sfp < set->GetNumberOfFebexSfps() &&
@@ -1005,6 +1955,34 @@ unsigned int MiniballCalibration::GetMWDWindow( unsigned char sfp, unsigned char
 	
 }
 
+bool MiniballCalibration::GetMWDFixedPoint( unsigned char sfp, unsigned char board, unsigned char ch ){
+	
+	if(   sfp < set->GetNumberOfFebexSfps() &&
+	    board < set->GetNumberOfFebexBoards() &&
+	       ch < set->GetNumberOfFebexChannels() ) {
+		
+		return fFebexMWD_FixedPoint[sfp][board][ch];
+		
+	}
+	
+	else return false;
+	
+}
+
+unsigned int MiniballCalibration::GetMWDFixedShift( unsigned char sfp, unsigned char board, unsigned char ch ){
+	
+	if(   sfp < set->GetNumberOfFebexSfps() &&
+	    board < set->GetNumberOfFebexBoards() &&
+	       ch < set->GetNumberOfFebexChannels() ) {
+		
+		return fFebexMWD_FixedShift[sfp][board][ch];
+		
+	}
+	
+	else return 0;
+	
+}
+
 float MiniballCalibration::GetCFDFraction( unsigned char sfp, unsigned char board, unsigned char ch ){
 	
 	if(   sfp < set->GetNumberOfFebexSfps() &&
@@ -0,0 +1,124 @@
+#include "ConfigCache.hh"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Header at the start of every cache file
+struct ConfigCacheHeader {
+
+	char				magic[8];	///< "MBCACHE" and a zero
+	unsigned long long	version;
+	unsigned long long	key;
+	unsigned long long	size;		///< number of bytes after the header
+
+};
+
+static const char CONFIG_CACHE_MAGIC[8] = "MBCACHE";
+
+bool ConfigFileHash( const std::string &file_name, unsigned long long &hash ) {
+
+	std::ifstream file( file_name, std::ios::in|std::ios::binary );
+	if( !file.is_open() ) return false;
+
+	std::stringstream ss;
+	ss << file.rdbuf();
+	std::string text = ss.str();
+
+	hash = ConfigCacheMix( 0xCBF29CE484222325ULL, text.data(), text.size() );
+	hash = ConfigCacheMix( hash, CONFIG_CACHE_VERSION );
+
+	return true;
+
+}
+
+std::string ConfigCacheName( const std::string &file_name, const std::string &tag ) {
+
+	std::size_t slash = file_name.find_last_of( '/' );
+	if( slash == std::string::npos )
+		return "." + file_name + "." + tag + ".cache";
+
+	return file_name.substr( 0, slash + 1 ) + "." +
+		   file_name.substr( slash + 1 ) + "." + tag + ".cache";
+
+}
+
+bool MiniballCacheWriter::Save( const std::string &cache_name, unsigned long long key ) {
+
+	ConfigCacheHeader header;
+	std::memcpy( header.magic, CONFIG_CACHE_MAGIC, sizeof(header.magic) );
+	header.version = CONFIG_CACHE_VERSION;
+	header.key = key;
+	header.size = buf.size();
+
+	// Write to a temporary file and rename it, so that another process
+	// never sees half a file. It's fine if the directory is read-only.
+	std::string tmp_name = cache_name + "." + std::to_string( getpid() );
+	std::ofstream file( tmp_name, std::ios::out|std::ios::binary|std::ios::trunc );
+	if( !file.is_open() ) return false;
+
+	file.write( (const char*)&header, sizeof(header) );
+	file.write( buf.data(), buf.size() );
+	file.close();
+
+	if( file.fail() || std::rename( tmp_name.data(), cache_name.data() ) != 0 ) {
+		std::remove( tmp_name.data() );
+		return false;
+	}
+
+	return true;
+
+}
+
+MiniballCacheReader::MiniballCacheReader() {
+
+	map = nullptr;
+	data = nullptr;
+	size = 0;
+	pos = 0;
+	good = false;
+
+}
+
+MiniballCacheReader::~MiniballCacheReader() {
+
+	if( map != nullptr )
+		munmap( map, size + sizeof(ConfigCacheHeader) );
+
+}
+
+bool MiniballCacheReader::Open( const std::string &cache_name, unsigned long long key ) {
+
+	int fd = open( cache_name.data(), O_RDONLY );
+	if( fd < 0 ) return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || (std::size_t)st.st_size < sizeof(ConfigCacheHeader) ) {
+		close( fd );
+		return false;
+	}
+
+	void *m = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( m == MAP_FAILED ) return false;
+
+	// Check it's ours, for this text and this version
+	ConfigCacheHeader header;
+	std::memcpy( &header, m, sizeof(header) );
+	if( std::memcmp( header.magic, CONFIG_CACHE_MAGIC, sizeof(header.magic) ) != 0 ||
+	    header.version != CONFIG_CACHE_VERSION || header.key != key ||
+	    header.size != st.st_size - sizeof(header) ) {
+		munmap( m, st.st_size );
+		return false;
+	}
+
+	map = m;
+	data = (const char*)m + sizeof(header);
+	size = header.size;
+	pos = 0;
+	good = true;
+
+	return true;
+
+}
@@ -13,6 +13,9 @@ MiniballConverter::MiniballConverter( std::shared_ptr<MiniballSettings> myset )
 	ctr_febex_pause.resize( set->GetNumberOfFebexSfps() );
 	ctr_febex_resume.resize( set->GetNumberOfFebexSfps() );
 	ctr_febex_sync.resize( set->GetNumberOfFebexSfps() );
+	ctr_dgf_hit.resize( set->GetNumberOfDgfModules(), 0 );
+	ctr_madc_hit.resize( set->GetNumberOfAdcModules(), 0 );
+	ctr_caen_hit.resize( set->GetNumberOfAdcModules(), 0 );
 
 	first_data.resize( set->GetNumberOfFebexSfps(), true );
 
@@ -43,6 +46,13 @@ MiniballConverter::MiniballConverter( std::shared_ptr<MiniballSettings> myset )
 	// No progress bar by default
 	_prog_ = false;
 
+	// No tree until MakeTree() is called
+	sorted_tree = nullptr;
+
+	// One slot for each type of data and SFP/module
+	stream_time.resize( 4 << 8 );
+	stream_block.resize( 4 << 8 );
+
 	// Histogrammer options
 	//TH1::AddDirectory(kFALSE);
 
@@ -85,6 +95,11 @@ void MiniballConverter::StartFile(){
 
 	}
 
+	// Hits on each DGF and ADC module
+	std::fill( ctr_dgf_hit.begin(), ctr_dgf_hit.end(), 0 );
+	std::fill( ctr_madc_hit.begin(), ctr_madc_hit.end(), 0 );
+	std::fill( ctr_caen_hit.begin(), ctr_caen_hit.end(), 0 );
+
 	jump_ctr = 0;	// timestamp jumps (jumps more than 300s in same board)
 	warp_ctr = 0;	// timestamp warps (goes back in time, wrong board ID)
 	mash_ctr = 0;	// timestamp mashes (mangled bits, with 16-bit shift)
@@ -100,9 +115,31 @@ void MiniballConverter::StartFile(){
 	flag_febex_data3 = false;
 	flag_febex_trace = false;
 
-	// clear the data vectors
-	std::vector<std::shared_ptr<MiniballDataPackets>>().swap(data_vector);
-	std::vector<std::pair<unsigned long,double>>().swap(data_map);
+	// clear the stored hits
+	hit_store.Clear();
+	std::vector<std::pair<long long int,unsigned long>>().swap(data_map);
+	stream_store.Clear();
+
+	// Nothing streamed yet. The tree is filled as we go along
+	// in streaming mode, so it has to be emptied here instead
+	std::fill( stream_time.begin(), stream_time.end(), std::numeric_limits<long long int>::min() );
+	std::fill( stream_block.begin(), stream_block.end(), 0 );
+	stream_nblock = 0;
+	stream_watermark = std::numeric_limits<long long int>::min();
+	stream_checked = 0;
+	stream_ctr = 0;
+	late_ctr = 0;
+	if( set->GetStreamWatermark() > 0 && sorted_tree != nullptr ) {
+		sorted_tree->Reset();
+		trace_tree->Reset();
+	}
+
+	// Get rid of any spill files that weren't merged
+	for( unsigned int i = 0; i < spill_files.size(); ++i )
+		fclose( spill_files[i] );
+	spill_files.clear();
+	spill_ctr = 0;
+	spill_error = false;
 
 	return;
 	
@@ -129,9 +166,16 @@ void MiniballConverter::MakeTree() {
 	mbsinfo_packet = std::make_shared<MBSInfoPackets>();
 	sorted_tree->Branch( "data", "MiniballDataPackets", write_packet.get(), bufsize, splitLevel );
 	mbsinfo_tree->Branch( "mbsinfo", "MBSInfoPackets", mbsinfo_packet.get(), sizeof(MBSInfoPackets), 0 );
+
+	// Traces have their own tree, split so that the entry number
+	// can be used to build an index when they are read back
+	trace_tree = new TTree( "mb_trace", "Traces for the hits in mb_sort" );
+	trace_packet = std::make_shared<MiniballTracePackets>();
+	trace_tree->Branch( "trace", "MiniballTracePackets", trace_packet.get(), sizeof(MiniballTracePackets), 99 );
 	
 	sorted_tree->SetDirectory( output_file->GetDirectory("/") );
 	mbsinfo_tree->SetDirectory( output_file->GetDirectory("/") );
+	trace_tree->SetDirectory( output_file->GetDirectory("/") );
 
 	dgf_data = std::make_shared<DgfData>();
 	adc_data = std::make_shared<AdcData>();
@@ -165,6 +209,7 @@ void MiniballConverter::MakeHists() {
 	hfebex_qint.resize( set->GetNumberOfFebexSfps() );
 	hfebex_cal.resize( set->GetNumberOfFebexSfps() );
 	hfebex_mwd.resize( set->GetNumberOfFebexSfps() );
+	hfebex_mwd_qint.resize( set->GetNumberOfFebexSfps() );
 	hfebex_hit.resize( set->GetNumberOfFebexSfps() );
 	hfebex_pause.resize( set->GetNumberOfFebexSfps() );
 	hfebex_resume.resize( set->GetNumberOfFebexSfps() );
@@ -177,6 +222,7 @@ void MiniballConverter::MakeHists() {
 		hfebex_qint[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_cal[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_mwd[i].resize( set->GetNumberOfFebexBoards() );
+		hfebex_mwd_qint[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_hit[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_pause[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_resume[i].resize( set->GetNumberOfFebexBoards() );
@@ -189,6 +235,7 @@ void MiniballConverter::MakeHists() {
 			hfebex_qint[i][j].resize( set->GetNumberOfFebexChannels() );
 			hfebex_cal[i][j].resize( set->GetNumberOfFebexChannels() );
 			hfebex_mwd[i][j].resize( set->GetNumberOfFebexChannels() );
+			hfebex_mwd_qint[i][j].resize( set->GetNumberOfFebexChannels(), nullptr );
 
 			dirname  = maindirname + "sfp_" + std::to_string(i);
 			dirname += "/board_" + std::to_string(j);
@@ -245,8 +292,8 @@ void MiniballConverter::MakeHists() {
 				float emax = 4000.0 + emin; // 4 MeV range
 				
 				// Check if we have particles with low gain preamps (heavy ions, Coulex)
-				if( ( cal->FebexType(i,j,k) == "Qshort" && cal->FebexGain(i,j,k) > 5 )
-				   || ( cal->FebexType(i,j,k) == "Qint" && cal->FebexGain(i,j,k) > 0.0005 ) ) {
+				if( ( cal->FebexTypeID(i,j,k) == MiniballCalibration::FEBEX_QSHORT && cal->FebexGain(i,j,k) > 5 )
+				   || ( cal->FebexTypeID(i,j,k) == MiniballCalibration::FEBEX_QINT && cal->FebexGain(i,j,k) > 0.0005 ) ) {
 					
 					ebins = 8000.0;
 					emin = -125.0;
@@ -255,8 +302,8 @@ void MiniballConverter::MakeHists() {
 				}
 				
 				// Check if we have particles with high gain preamps (light ions, transfer)
-				else if( ( cal->FebexType(i,j,k) == "Qshort" && cal->FebexGain(i,j,k) > 0.1 )
-				   || ( cal->FebexType(i,j,k) == "Qint" && cal->FebexGain(i,j,k) > 0.00001 ) ) {
+				else if( ( cal->FebexTypeID(i,j,k) == MiniballCalibration::FEBEX_QSHORT && cal->FebexGain(i,j,k) > 0.1 )
+				   || ( cal->FebexTypeID(i,j,k) == MiniballCalibration::FEBEX_QINT && cal->FebexGain(i,j,k) > 0.00001 ) ) {
 					
 					ebins = 8000.0;
 					emin = -12.5;
@@ -282,6 +329,26 @@ void MiniballConverter::MakeHists() {
 				hfebex_mwd[i][j][k] = new TH1F( hname.data(), htitle.data(), 32768, -0.25, 16383.75 );
 				histlist->Add(hfebex_mwd[i][j][k]);
 
+				// Fixed-point MWD against the firmware, to tune it until they agree.
+				// Only MIDAS data has both for the same hit
+				if( midas_data && cal->GetMWDFixedPoint(i,j,k) ) {
+					
+					hname = "febex_" + std::to_string(i);
+					hname += "_" + std::to_string(j);
+					hname += "_" + std::to_string(k);
+					hname += "_mwd_qint";
+					
+					htitle = "Fixed-point MWD versus Qint for SFP " + std::to_string(i);
+					htitle += ", board " + std::to_string(j);
+					htitle += ", channel " + std::to_string(k);
+					htitle += ";Qint;MWD energy";
+					
+					hfebex_mwd_qint[i][j][k] = new TH2F( hname.data(), htitle.data(),
+														 1024, 0, qmax_default, 1024, -0.25, 16383.75 );
+					histlist->Add(hfebex_mwd_qint[i][j][k]);
+					
+				}
+
 			} // k - channel
 
 			// Hit ID vs timestamp
@@ -458,59 +525,399 @@ void MiniballConverter::BuildMbsIndex(){
 	
 }
 
-bool MiniballConverter::TimeComparator( const std::shared_ptr<MiniballDataPackets> &lhs,
-									    const std::shared_ptr<MiniballDataPackets> &rhs ) {
+bool MiniballConverter::MapComparator( const std::pair<long long int,unsigned long> &lhs,
+									   const std::pair<long long int,unsigned long> &rhs ) {
+
+	// Equal times stay in the order they were read
+	if( lhs.first == rhs.first ) return lhs.second < rhs.second;
+	return lhs.first < rhs.first;
+
+}
+
+void MiniballConverter::SortDataMap( bool verbose ) {
+
+	// Hits from each SFP/board are already (almost) in time order, so we
+	// gather them in their runs, sort only the runs that are out of order
+	// and then do a k-way merge of the runs with a heap
+	unsigned long n_ents = hit_store.size();
+	unsigned int n_runs = hit_store.GetNumberOfRuns();
+	
+	// Start of each run in the list
+	std::vector<unsigned long> run_start( n_runs + 1, 0 );
+	for( unsigned int r = 0; r < n_runs; ++r )
+		run_start[r+1] = run_start[r] + hit_store.GetRunSize(r);
+	
+	// Put the hits in their runs, keeping the order they were read
+	std::vector<std::pair<long long int,unsigned long>> run_list( n_ents );
+	std::vector<unsigned long> run_fill( run_start.begin(), run_start.end() - 1 );
+	for( unsigned long i = 0; i < n_ents; ++i )
+		run_list[ run_fill[ hit_store.GetRun(i) ]++ ] = std::make_pair( hit_store.GetTime(i), i );
+	std::vector<unsigned long>().swap(run_fill);
+	
+	// Sort the runs that had jumps or warps. The runs are in the order
+	// the hits were read, so a stable sort on the time alone is enough
+	// and big ones go through the radix sort on the integer timestamp
+	unsigned int n_sorted = 0;
+	for( unsigned int r = 0; r < n_runs; ++r ) {
+		
+		if( hit_store.IsRunOrdered(r) ) continue;
+		if( run_start[r+1] - run_start[r] < 1024 )
+			std::sort( run_list.begin() + run_start[r], run_list.begin() + run_start[r+1], MapComparator );
+		else RadixSort( run_list.data() + run_start[r], run_start[r+1] - run_start[r], nthreads );
+		n_sorted++;
+		
+	}
+	
+	if( verbose ) {
+		std::cout << " " << n_runs << " runs of hits, " << n_sorted;
+		std::cout << " out of order and sorted locally" << std::endl;
+	}
+
+	// Heap with the next item from each run, earliest at the front
+	std::vector<std::pair<std::pair<long long int,unsigned long>,unsigned int>> heap;
+	auto heap_cmp = []( const std::pair<std::pair<long long int,unsigned long>,unsigned int> &lhs,
+					    const std::pair<std::pair<long long int,unsigned long>,unsigned int> &rhs ) {
+		return MapComparator( rhs.first, lhs.first );
+	};
+	
+	std::vector<unsigned long> run_pos( run_start.begin(), run_start.end() - 1 );
+	for( unsigned int r = 0; r < n_runs; ++r )
+		if( run_start[r] < run_start[r+1] )
+			heap.push_back( std::make_pair( run_list[ run_start[r] ], r ) );
+	std::make_heap( heap.begin(), heap.end(), heap_cmp );
+
+	// Merge the runs into the time-ordered index
+	std::vector<std::pair<long long int,unsigned long>>().swap(data_map);
+	data_map.reserve( n_ents );
+	while( heap.size() ) {
+		
+		// Take the earliest item
+		std::pop_heap( heap.begin(), heap.end(), heap_cmp );
+		unsigned int r = heap.back().second;
+		data_map.push_back( heap.back().first );
+		heap.pop_back();
+		
+		// And replace it with the next one from the same run
+		if( ++run_pos[r] < run_start[r+1] ) {
+			
+			heap.push_back( std::make_pair( run_list[ run_pos[r] ], r ) );
+			std::push_heap( heap.begin(), heap.end(), heap_cmp );
+			
+		}
+		
+	}
 
-	return lhs->GetTime() < rhs->GetTime();
+	return;
 
 }
 
-bool MiniballConverter::MapComparator( const std::pair<unsigned long,double> &lhs,
-									   const std::pair<unsigned long,double> &rhs ) {
+void MiniballConverter::FillSortedTree(){
+
+	// The trace goes in the other tree, with the entry number of its hit
+	if( trace_packet->GetTraceLength() ) {
 
-	return lhs.second < rhs.second;
+		trace_packet->SetEntry( sorted_tree->GetEntries() );
+		trace_tree->Fill();
+
+	}
+
+	sorted_tree->Fill();
+
+	return;
+
+}
+
+void MiniballConverter::StreamHits(){
+
+	// Only in streaming mode, and never for source runs that aren't sorted
+	if( set->GetStreamWatermark() <= 0 || flag_source ) return;
+
+	// Look at the hits that came in since last time
+	stream_nblock++;
+	for( ; stream_checked < hit_store.size(); ++stream_checked ) {
+
+		const MiniballHit &hit = hit_store.GetHit( stream_checked );
+
+		// Info data comes down the same SFP as the FEBEX data
+		unsigned int type = hit.type;
+		if( type == MiniballHitStore::HIT_INFO ) type = MiniballHitStore::HIT_FEBEX;
+
+		// Latest time from this SFP/module
+		unsigned int key = ( type << 8 ) | hit.sfp;
+		if( hit.time > stream_time[key] ) stream_time[key] = hit.time;
+		stream_block[key] = stream_nblock;
+
+		// Too late, we already wrote hits after this one
+		if( hit.time < stream_watermark ) late_ctr++;
+
+	}
+
+	// Everything up to the watermark is safe to write once every
+	// SFP/module that we've seen has gone past it. One that has gone
+	// quiet, like a pulser that stopped or an SFP that dropped out,
+	// doesn't hold the rest back forever. If it comes back, anything
+	// behind the watermark is counted as late.
+	long long int watermark = std::numeric_limits<long long int>::max();
+	for( unsigned int i = 0; i < stream_time.size(); ++i )
+		if( stream_time[i] != std::numeric_limits<long long int>::min() &&
+		    stream_nblock - stream_block[i] <= set->GetStreamIdleBlocks() )
+			watermark = std::min( watermark, stream_time[i] );
+	if( watermark == std::numeric_limits<long long int>::max() ) return;
+	watermark -= (long long int)set->GetStreamWatermark();
+
+	// Write them once we've moved on by at least the width of the watermark
+	// since last time. Each flush sorts and copies all the hits it keeps,
+	// so this way it writes about as many as it keeps, rather than paying
+	// for the whole window again on every block
+	if( watermark <= stream_watermark ) return;
+	if( stream_watermark == std::numeric_limits<long long int>::min() ||
+	    watermark - stream_watermark >= (long long int)set->GetStreamWatermark() )
+		FlushHits( watermark );
+
+	return;
+
+}
+
+void MiniballConverter::FlushHits( long long int watermark ){
+
+	// Time order what we have so far
+	SortDataMap( false );
+
+	// Write everything before the watermark and keep the rest, in time
+	// order, in the spare store that is then swapped in as the new one
+	stream_store.Reset();
+	for( unsigned long i = 0; i < data_map.size(); ++i ) {
+
+		if( data_map[i].first < watermark ) {
+
+			hit_store.FillPacket( data_map[i].second, write_packet, trace_packet );
+			FillSortedTree();
+			stream_ctr++;
+
+		}
+
+		else stream_store.AddHit( hit_store, data_map[i].second );
+
+	}
+
+	hit_store.Swap( stream_store );
+	data_map.clear();
+
+	stream_watermark = watermark;
+	stream_checked = hit_store.size();
+
+	return;
 
 }
 
-void MiniballConverter::SortDataVector() {
+void MiniballConverter::SpillHits(){
 
-	// Sort the data vector as we go along
-	std::sort( data_vector.begin(), data_vector.end(), TimeComparator );
+	// Only when there's a memory limit, but not in streaming mode because
+	// that keeps the memory down by itself. In MBS event mode, everything
+	// is needed at the end to put it back in the readout order
+	if( set->GetSortMemoryLimit() == 0 || flag_source || spill_error ) return;
+	if( set->GetStreamWatermark() > 0 ) return;
+	if( ( mbs_data || med_data ) && set->GetMbsEventMode() ) return;
+
+	// Memory for the hits, plus the index and run list needed to sort them
+	unsigned long long int mem = hit_store.GetMemoryInUse();
+	mem += hit_store.size() * 2 * sizeof( std::pair<long long int,unsigned long> );
+	if( mem < (unsigned long long int)set->GetSortMemoryLimit() << 20 ) return;
+
+	// Open a new run file next to the output file, and unlink it
+	// straight away so that it disappears when it is closed
+	std::string spill_name = output_file->GetName();
+	spill_name += ".spill" + std::to_string( spill_files.size() );
+	FILE *fp = fopen( spill_name.data(), "w+b" );
+	if( !fp ) {
+
+		std::cerr << "Cannot open " << spill_name << " to spill hits to disk,";
+		std::cerr << " keeping them in memory" << std::endl;
+		spill_error = true;
+		return;
+
+	}
+	remove( spill_name.data() );
+
+	// Time order the hits and write them out
+	SortDataMap( false );
+	for( unsigned long i = 0; i < data_map.size(); ++i ) {
+
+		if( !hit_store.WriteHit( data_map[i].second, fp ) ) {
+
+			std::cerr << "Failed to write hits to " << spill_name << ",";
+			std::cerr << " keeping them in memory" << std::endl;
+			fclose( fp );
+			spill_error = true;
+			return;
+
+		}
+
+	}
+
+	std::cout << "Spilled " << hit_store.size() << " time-ordered data items to disk";
+	std::cout << " (run " << spill_files.size() << ")" << std::endl;
+
+	// Start again with an empty store, but keep the memory for the next lot
+	spill_files.push_back( fp );
+	spill_ctr += hit_store.size();
+	hit_store.Reset();
+	data_map.clear();
+
+	return;
 
 }
 
-void MiniballConverter::SortDataMap() {
+unsigned long long int MiniballConverter::MergeSpills(){
+
+	// The hits that are still in memory are the last run to be merged
+	SortDataMap( false );
+	unsigned int n_files = spill_files.size();
+	unsigned long long int n_total = spill_ctr + data_map.size();
+	std::cout << "Merging " << n_total << " time-ordered data items from ";
+	std::cout << n_files << " runs on disk and memory..." << std::endl;
+
+	// The next hit from each of the files
+	std::vector<MiniballHit> head( n_files );
+	std::vector<std::vector<unsigned short>> head_samples( n_files );
 
-	// Sort the data vector as we go along
-	std::sort( data_map.begin(), data_map.end(), MapComparator );
+	// Heap with the time of the next hit from each run, earliest at the front.
+	// For equal times, the lower run number was read first, so it goes first
+	std::vector<std::pair<long long int,unsigned long>> heap;
+	auto heap_cmp = []( const std::pair<long long int,unsigned long> &lhs,
+					    const std::pair<long long int,unsigned long> &rhs ) {
+		return MapComparator( rhs, lhs );
+	};
+
+	for( unsigned int f = 0; f < n_files; ++f ) {
+
+		rewind( spill_files[f] );
+		if( MiniballHitStore::ReadHit( spill_files[f], head[f], head_samples[f] ) )
+			heap.push_back( std::make_pair( head[f].time, f ) );
+
+	}
+
+	unsigned long mem_pos = 0;
+	if( data_map.size() )
+		heap.push_back( std::make_pair( data_map[0].first, n_files ) );
+	std::make_heap( heap.begin(), heap.end(), heap_cmp );
+
+	// Merge everything into the sorted tree
+	unsigned long long int n_ents = 0;
+	while( heap.size() ) {
+
+		// Take the earliest item
+		std::pop_heap( heap.begin(), heap.end(), heap_cmp );
+		unsigned int f = heap.back().second;
+		heap.pop_back();
+
+		// Fill the tree from the file or the store and get the next one
+		if( f == n_files ) {
+
+			hit_store.FillPacket( data_map[mem_pos].second, write_packet, trace_packet );
+			if( ++mem_pos < data_map.size() ) {
+				heap.push_back( std::make_pair( data_map[mem_pos].first, f ) );
+				std::push_heap( heap.begin(), heap.end(), heap_cmp );
+			}
+
+		}
+
+		else {
+
+			const unsigned short *samples = nullptr;
+			if( head_samples[f].size() ) samples = head_samples[f].data();
+			hit_store.FillPacket( head[f], samples, write_packet, trace_packet );
+
+			if( MiniballHitStore::ReadHit( spill_files[f], head[f], head_samples[f] ) ) {
+				heap.push_back( std::make_pair( head[f].time, f ) );
+				std::push_heap( heap.begin(), heap.end(), heap_cmp );
+			}
+
+		}
+
+		FillSortedTree();
+		n_ents++;
+
+		// Progress bar
+		if( n_ents % ( n_total / 100 + 1 ) == 0 || n_ents == n_total ) {
+
+			// Percent complete
+			float percent = (float)n_ents*100.0/(float)n_total;
+
+			// Progress bar in GUI
+			if( _prog_ ) {
+
+				prog->SetPosition( percent );
+				gSystem->ProcessEvents();
+
+			}
+
+			// Progress bar in terminal
+			std::cout << " " << std::setw(6) << std::setprecision(4);
+			std::cout << percent << "%    \r";
+			std::cout.flush();
+
+		} // progress bar
+
+	}
+
+	// Check we got everything back
+	if( n_ents != n_total ) {
+
+		std::cerr << "Only " << n_ents << " of " << n_total;
+		std::cerr << " data items could be read back from disk" << std::endl;
+
+	}
+
+	// Close the files, which also deletes them
+	for( unsigned int f = 0; f < n_files; ++f )
+		fclose( spill_files[f] );
+	spill_files.clear();
+	spill_ctr = 0;
+
+	return n_ents;
 
 }
 
 unsigned long long int MiniballConverter::SortTree( bool do_sort ){
 
-	// Reset the sorted tree so it's empty before we start
-	sorted_tree->Reset();
+	// Reset the sorted tree so it's empty before we start,
+	// unless we've been writing to it already in streaming mode
+	if( stream_ctr == 0 ) {
+		sorted_tree->Reset();
+		trace_tree->Reset();
+	}
+	else {
+
+		std::cout << stream_ctr << " data items were already written in time order, ";
+		std::cout << late_ctr << " arrived behind the watermark" << std::endl;
+
+	}
+
+	// Hits that went to disk are merged back with the rest
+	if( spill_files.size() ) return MergeSpills();
 
 	// Get number of data packets
-	long long int n_ents = data_vector.size();	// std::vector method
+	long long int n_ents = hit_store.size();
 
 	// Check we have entries and build time-ordered index
 	if( n_ents && do_sort ) {
 		std::cout << "Time ordering " << n_ents << " data items..." << std::endl;
 		SortDataMap();
 	}
-	else if( n_ents == 0 ) return 0;
+	else if( n_ents == 0 ) return stream_ctr;
 
 	// Loop on t_raw entries and fill t
 	std::cout << "Writing time-ordered data items to the output tree..." << std::endl;
 	for( long long int i = 0; i < n_ents; ++i ) {
 
-		// Get the data item back from the vector
-		unsigned long idx = data_map[i].first;
-		write_packet->SetData( data_vector[idx] );
+		// Get the data item back from the store
+		unsigned long idx = i;
+		if( do_sort ) idx = data_map[i].second;
+		hit_store.FillPacket( idx, write_packet, trace_packet );
 
 		// Fill the sorted tree
-		sorted_tree->Fill();
+		FillSortedTree();
 
 		// Progress bar
 		bool update_progress = false;
@@ -541,7 +948,7 @@ unsigned long long int MiniballConverter::SortTree( bool do_sort ){
 
 	} // i
 
-	return n_ents;
+	return n_ents + stream_ctr;
 
 }
 
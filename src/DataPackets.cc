@@ -9,6 +9,7 @@ ClassImp(AdcData)
 ClassImp(DgfData)
 ClassImp(MiniballDataPackets)
 ClassImp(MBSInfoPackets)
+ClassImp(MiniballTracePackets)
 
 FebexData::FebexData( long long int t, unsigned long long int id,
 					unsigned int qi, unsigned short qs,
@@ -16,7 +17,8 @@ FebexData::FebexData( long long int t, unsigned long long int id,
 					unsigned char s, unsigned char b, unsigned char c,
 				    bool th, bool p, bool cl, bool f ) :
 					time(t), eventid(id), Qint(qi), Qshort(qs), trace(tr), sfp(s),
-					board(b), ch(c), thres(th), pileup(p), clipped(cl), flagbit(f) {}
+					board(b), ch(c), thres(th), pileup(p), clipped(cl), flagbit(f),
+					recovered(false) {}
 
 InfoData::InfoData( long long int t, unsigned long long int id, unsigned char c,
 				    unsigned char s, unsigned char b ) :
@@ -94,6 +96,7 @@ void MiniballDataPackets::SetData( std::shared_ptr<FebexData> data ){
 	fill_data.SetPileup( data->IsPileup() );
 	fill_data.SetClipped( data->IsClipped() );
 	fill_data.SetFlag( data->HasFlag() );
+	fill_data.SetRecovered( data->IsRecovered() );
 
 	febex_packets.push_back( fill_data );
 
@@ -129,10 +132,10 @@ void MiniballDataPackets::ClearData(){
 
 unsigned long long int MiniballDataPackets::GetEventID() const {
 
-	if( this->IsDgf() )		return GetDgfData()->GetEventID();
-	if( this->IsAdc() )		return GetAdcData()->GetEventID();
-	if( this->IsFebex() )	return GetFebexData()->GetEventID();
-	if( this->IsInfo() )	return GetInfoData()->GetEventID();
+	if( this->IsDgf() )		return GetDgfDataRef().GetEventID();
+	if( this->IsAdc() )		return GetAdcDataRef().GetEventID();
+	if( this->IsFebex() )	return GetFebexDataRef().GetEventID();
+	if( this->IsInfo() )	return GetInfoDataRef().GetEventID();
 
 	return 0;
 	
@@ -140,10 +143,10 @@ unsigned long long int MiniballDataPackets::GetEventID() const {
 
 long long int MiniballDataPackets::GetTime() const {
 
-	if( this->IsDgf() )			return GetDgfData()->GetTime();
-	if( this->IsAdc() )			return GetAdcData()->GetTime();
-	if( this->IsFebex() )		return GetFebexData()->GetTime();
-	if( this->IsInfo() )		return GetInfoData()->GetTime();
+	if( this->IsDgf() )			return GetDgfDataRef().GetTime();
+	if( this->IsAdc() )			return GetAdcDataRef().GetTime();
+	if( this->IsFebex() )		return GetFebexDataRef().GetTime();
+	if( this->IsInfo() )		return GetInfoDataRef().GetTime();
 
 	return 0;
 	
@@ -163,8 +166,8 @@ UInt_t MiniballDataPackets::GetTimeLSB() const {
 
 unsigned char MiniballDataPackets::GetSfp() const {
 
-	if( IsFebex() )		return GetFebexData()->GetSfp();
-	if( IsInfo() )		return GetInfoData()->GetSfp();
+	if( IsFebex() )		return GetFebexDataRef().GetSfp();
+	if( IsInfo() )		return GetInfoDataRef().GetSfp();
 	
 	return 0;
 	
@@ -172,10 +175,10 @@ unsigned char MiniballDataPackets::GetSfp() const {
 
 unsigned char MiniballDataPackets::GetBoard() const {
 
-	if( IsDgf() )		return GetDgfData()->GetModule();
-	if( IsAdc() )		return GetAdcData()->GetModule();
-	if( IsFebex() )		return GetFebexData()->GetBoard();
-	if( IsInfo() )		return GetInfoData()->GetBoard();
+	if( IsDgf() )		return GetDgfDataRef().GetModule();
+	if( IsAdc() )		return GetAdcDataRef().GetModule();
+	if( IsFebex() )		return GetFebexDataRef().GetBoard();
+	if( IsInfo() )		return GetInfoDataRef().GetBoard();
 	
 	return 0;
 	
@@ -183,10 +186,10 @@ unsigned char MiniballDataPackets::GetBoard() const {
 
 unsigned char MiniballDataPackets::GetModule() const {
 
-	if( IsDgf() )		return GetDgfData()->GetModule();
-	if( IsAdc() )		return GetAdcData()->GetModule();
-	if( IsFebex() )		return GetFebexData()->GetBoard();
-	if( IsInfo() )		return GetInfoData()->GetBoard();
+	if( IsDgf() )		return GetDgfDataRef().GetModule();
+	if( IsAdc() )		return GetAdcDataRef().GetModule();
+	if( IsFebex() )		return GetFebexDataRef().GetBoard();
+	if( IsInfo() )		return GetInfoDataRef().GetBoard();
 	
 	return 0;
 	
@@ -194,9 +197,9 @@ unsigned char MiniballDataPackets::GetModule() const {
 
 unsigned char MiniballDataPackets::GetChannel() const {
 
-	if( IsDgf() )		return GetDgfData()->GetChannel();
-	if( IsAdc() )		return GetAdcData()->GetChannel();
-	if( IsFebex() )		return GetFebexData()->GetChannel();
+	if( IsDgf() )		return GetDgfDataRef().GetChannel();
+	if( IsAdc() )		return GetAdcDataRef().GetChannel();
+	if( IsFebex() )		return GetFebexDataRef().GetChannel();
 	if( IsInfo() )		return 0;
 	
 	return 0;
@@ -269,6 +272,7 @@ void FebexData::ClearData(){
 	pileup = false;
 	clipped = false;
 	flagbit = false;
+	recovered = false;
 
 	return;
 	
@@ -298,3 +302,45 @@ void MBSInfoPackets::ClearData(){
 
 }
 
+
+void MiniballTracePackets::ClearData(){
+
+	entry = -1;
+	samples.clear();
+
+}
+
+void MiniballTracePackets::SetTrace( const unsigned short *t, unsigned short n ){
+
+	// Difference from the previous sample, wrapped to 16 bits so that it
+	// always fits, then zigzag it so the sign goes in the lowest bit
+	samples.resize( n );
+	unsigned short prev = 0;
+	for( unsigned short i = 0; i < n; ++i ) {
+
+		short diff = (short)( t[i] - prev );
+		samples[i] = (unsigned short)( ( diff << 1 ) ^ ( diff >> 15 ) );
+		prev = t[i];
+
+	}
+
+	return;
+
+}
+
+std::vector<unsigned short> MiniballTracePackets::GetTrace() const {
+
+	// Undo the zigzag and add up the differences again
+	std::vector<unsigned short> trace( samples.size() );
+	unsigned short prev = 0;
+	for( unsigned short i = 0; i < samples.size(); ++i ) {
+
+		short diff = (short)( ( samples[i] >> 1 ) ^ -( samples[i] & 1 ) );
+		prev += diff;
+		trace[i] = prev;
+
+	}
+
+	return trace;
+
+}
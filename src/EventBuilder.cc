@@ -14,9 +14,19 @@ MiniballEventBuilder::MiniballEventBuilder( std::shared_ptr<MiniballSettings> my
 	// Progress bar starts as false
 	_prog_ = false;
 
+	// Single thread unless we're told otherwise
+	nthreads = 1;
+	nbuilt = nullptr;
+
 	// Start at MBS event 0
 	preveventid = 0;
 
+	// No EBIS, T1, SuperCycle or laser seen yet
+	ebis_time = 0;
+	t1_time = 0;
+	sc_time = 0;
+	laser_time = 0;
+
 	// ------------------------------- //
 	// Initialise variables and flags  //
 	// ------------------------------- //
@@ -41,6 +51,13 @@ MiniballEventBuilder::MiniballEventBuilder( std::shared_ptr<MiniballSettings> my
 	flag_resume.resize( set->GetNumberOfFebexSfps() );
 
 	n_pulser.resize( set->GetNumberOfPulsers() );
+
+	// Segment buckets for every Miniball crystal, gamma rays for every cluster
+	mb_seg_bucket.resize( set->GetNumberOfMiniballClusters() * set->GetNumberOfMiniballCrystals() );
+	mb_clu_gammas.resize( set->GetNumberOfMiniballClusters() );
+
+	// p- and n-side buckets for every CD detector and sector
+	cd_bucket.resize( set->GetNumberOfCDDetectors() * set->GetNumberOfCDSectors() * 2 );
 	pulser_time.resize( set->GetNumberOfPulsers() );
 	pulser_prev.resize( set->GetNumberOfPulsers() );
 
@@ -164,6 +181,10 @@ void MiniballEventBuilder::SetInputFile( std::string input_file_name ) {
 	}
 	
 	flag_input_file = true;
+	input_name = input_file_name;
+
+	// Random numbers for the calibration belong to this file
+	if( overwrite_cal ) cal->SetRandomKey( PhiloxKey( input_file_name ) );
 	
 	// Set the input tree
 	SetInputTree( (TTree*)input_file->Get("mb_sort") );
@@ -198,6 +219,21 @@ void MiniballEventBuilder::SetMBSInfoTree( TTree *user_tree ){
 
 void MiniballEventBuilder::SetOutput( std::string output_file_name, bool cWrite ) {
 
+	// Output file, events tree and histograms
+	OpenOutput( output_file_name );
+
+	// Create log file.
+	std::string log_file_name = output_file_name.substr( 0, output_file_name.find_last_of(".") );
+	log_file_name += ".log";
+	log_file.open( log_file_name.data(), std::ios::app );
+
+	// Write once at the start
+	if( cWrite ) output_file->Write();
+
+}
+
+void MiniballEventBuilder::OpenOutput( std::string output_file_name ) {
+
 	// These are the branches we need
 	write_evts = std::make_unique<MiniballEvts>();
 	gamma_evt = std::make_shared<GammaRayEvt>();
@@ -215,17 +251,9 @@ void MiniballEventBuilder::SetOutput( std::string output_file_name, bool cWrite
 	output_tree->Branch( "MiniballEvts", "MiniballEvts", write_evts.get() );
 	output_tree->SetAutoFlush();
 
-	// Create log file.
-	std::string log_file_name = output_file_name.substr( 0, output_file_name.find_last_of(".") );
-	log_file_name += ".log";
-	log_file.open( log_file_name.data(), std::ios::app );
-
 	// Hisograms in separate function
 	MakeEventHists();
 
-	// Write once at the start
-	if( cWrite ) output_file->Write();
-
 }
 
 void MiniballEventBuilder::Initialise(){
@@ -243,12 +271,24 @@ void MiniballEventBuilder::Initialise(){
 	std::vector<unsigned char>().swap(mb_cry_list);
 	std::vector<unsigned char>().swap(mb_seg_list);
 
+	mb_core_index.clear();
+	for( unsigned int k = 0; k < mb_seg_bucket_used.size(); ++k )
+		mb_seg_bucket[mb_seg_bucket_used[k]].clear();
+	mb_seg_bucket_used.clear();
+
 	std::vector<float>().swap(cd_en_list);
 	std::vector<unsigned long long>().swap(cd_ts_list);
 	std::vector<unsigned char>().swap(cd_det_list);
 	std::vector<unsigned char>().swap(cd_sec_list);
 	std::vector<unsigned char>().swap(cd_side_list);
 	std::vector<unsigned char>().swap(cd_strip_list);
+
+	// Empty only the buckets we used, but keep them for the next event
+	for( unsigned int k = 0; k < cd_bucket_used.size(); ++k ) {
+		cd_bucket[2*cd_bucket_used[k]].clear();
+		cd_bucket[2*cd_bucket_used[k]+1].clear();
+	}
+	cd_bucket_used.clear();
 	
 	std::vector<float>().swap(pad_en_list);
 	std::vector<unsigned long long>().swap(pad_ts_list);
@@ -274,6 +314,52 @@ void MiniballEventBuilder::Initialise(){
 }
 
 
+void MiniballEventBuilder::BucketMiniballHit( const MiniballChannelID &chan ){
+
+	/// Keep the index of the Miniball hit that was just added to the lists,
+	/// either in the list of cores or in the bucket of segments for its
+	/// crystal, so that GammaRayFinder gives each core only its own segments
+
+	if( chan.id[2] == 0 ) {
+
+		mb_core_index.push_back( mb_en_list.size() - 1 );
+		return;
+
+	}
+
+	if( (unsigned int)chan.id[0] >= set->GetNumberOfMiniballClusters() ||
+	    (unsigned int)chan.id[1] >= set->GetNumberOfMiniballCrystals() ) return;
+
+	unsigned int k = chan.id[0] * set->GetNumberOfMiniballCrystals() + chan.id[1];
+	if( mb_seg_bucket[k].empty() )
+		mb_seg_bucket_used.push_back( k );
+
+	mb_seg_bucket[k].push_back( mb_en_list.size() - 1 );
+
+	return;
+
+}
+
+void MiniballEventBuilder::BucketCDHit( const MiniballChannelID &chan ){
+
+	/// Put the CD hit that was just added to the lists into the bucket
+	/// for its detector, sector and side, so that ParticleFinder only has
+	/// to look at the detector elements that were hit
+
+	if( (unsigned int)chan.id[0] >= set->GetNumberOfCDDetectors() ||
+	    (unsigned int)chan.id[1] >= set->GetNumberOfCDSectors() ||
+	    chan.id[2] < 0 || chan.id[2] > 1 ) return;
+
+	unsigned int k = chan.id[0] * set->GetNumberOfCDSectors() + chan.id[1];
+	if( cd_bucket[2*k].empty() && cd_bucket[2*k+1].empty() )
+		cd_bucket_used.push_back( k );
+
+	cd_bucket[2*k+chan.id[2]].push_back( cd_en_list.size() - 1 );
+
+	return;
+
+}
+
 void MiniballEventBuilder::MakeEventHists(){
 	
 	std::string hname, htitle;
@@ -568,16 +654,15 @@ void MiniballEventBuilder::GammaRayFinder() {
 	float AbSumEnergy; // add core energies for addback
 	unsigned char seg_mul; // segment multiplicity
 	unsigned char ab_mul; // addback multiplicity
-	std::vector<unsigned char> ab_index; // index of addback already used
 	
-	// Loop over all the events in Miniball detectors
-	for( unsigned int i = 0; i < mb_en_list.size(); ++i ) {
+	// Loop over all the core events in Miniball detectors
+	for( unsigned int c = 0; c < mb_core_index.size(); ++c ) {
 	
-		// Check if it's a core event
-		if( mb_seg_list.at(i) != 0 ) continue;
+		unsigned int i = mb_core_index[c];
 
 		// Segment veto start as false
 		bool segment_veto = false;
+		unsigned int veto_idx = mb_en_list.size(); // first vetoed segment
 
 		// Reset addback variables
 		MaxSegId = 0; // initialise as core (if no segment hit (dead), use core!)
@@ -585,29 +670,17 @@ void MiniballEventBuilder::GammaRayFinder() {
 		SegSumEnergy = 0.;
 		seg_mul = 0;
 		
-		// Loop again to find the matching segments
-		for( unsigned int j = 0; j < mb_en_list.size(); ++j ) {
-
-			// Skip the same event
-			if( i == j ) continue;
-			
-			// Skip if it's a core again, also fill time diff plot
-			if( mb_seg_list.at(j) == 0 ) {
-				
-				// Fill the time difference spectrum
-				mb_td_core_core->Fill( (long long)mb_ts_list.at(i) - (long long)mb_ts_list.at(j) );
-				continue;
-				
-			}
+		// Loop over the segments of the same crystal and cluster
+		unsigned int k = mb_clu_list.at(i) * set->GetNumberOfMiniballCrystals() + mb_cry_list.at(i);
+		for( unsigned int s = 0; s < mb_seg_bucket.at(k).size(); ++s ) {
 
-			// Skip if it's not the same crystal and cluster
-			if( mb_clu_list.at(i) != mb_clu_list.at(j) ||
-			    mb_cry_list.at(i) != mb_cry_list.at(j) ) continue;
+			unsigned int j = mb_seg_bucket[k][s];
 
 			// Check for a vetoed segment
 			if( set->IsMiniballSegmentVetoed( mb_clu_list.at(i), mb_cry_list.at(i), mb_seg_list.at(j) ) ) {
 
 				segment_veto = true;
+				veto_idx = j;
 				break;
 
 			}
@@ -631,7 +704,19 @@ void MiniballEventBuilder::GammaRayFinder() {
 				
 			}
 			
-		} // j: matching segments
+		} // s: matching segments
+
+		// Fill the time difference spectrum with the other cores,
+		// up to the vetoed segment like it always has been
+		for( unsigned int d = 0; d < mb_core_index.size(); ++d ) {
+
+			unsigned int j = mb_core_index[d];
+			if( j >= veto_idx ) break;
+			if( i == j ) continue;
+
+			mb_td_core_core->Fill( (long long)mb_ts_list.at(i) - (long long)mb_ts_list.at(j) );
+
+		} // d: other cores
 
 
 		// If any one of the segments that triggered are being vetoed, skip this gamma ray
@@ -659,60 +744,64 @@ void MiniballEventBuilder::GammaRayFinder() {
 		gamma_evt->SetTime( mb_ts_list.at(i) );
 		write_evts->AddEvt( gamma_evt );
 
-	} // i: core events
+		// Keep it with the others in this cluster for addback
+		mb_clu_gammas.at( mb_clu_list.at(i) ).push_back( write_evts->GetGammaRayMultiplicity() - 1 );
+
+	} // c: core events
 	
 	
+	// Which gamma-ray singles have already been added back
+	mb_ab_used.assign( write_evts->GetGammaRayMultiplicity(), false );
+
 	// Loop over all the gamma-ray singles for addback
 	for( unsigned int i = 0; i < write_evts->GetGammaRayMultiplicity(); ++i ) {
 
 		// Check we haven't already used this event
-		if( std::find( ab_index.begin(), ab_index.end(), i ) != ab_index.end() )
-			continue;
+		if( mb_ab_used[i] ) continue;
 
 		// Reset addback variables
-		AbSumEnergy = write_evts->GetGammaRayEvt(i)->GetEnergy();
-		MaxCryId = write_evts->GetGammaRayEvt(i)->GetCrystal();
-		MaxSegId = write_evts->GetGammaRayEvt(i)->GetSegment();
+		const GammaRayEvt &gamma_i = write_evts->GetGammaRayEvtRef(i);
+		AbSumEnergy = gamma_i.GetEnergy();
+		MaxCryId = gamma_i.GetCrystal();
+		MaxSegId = gamma_i.GetSegment();
 		MaxEnergy = AbSumEnergy;
-		MaxSegEnergy = write_evts->GetGammaRayEvt(i)->GetSegmentMaxEnergy();
-		SegSumEnergy = write_evts->GetGammaRayEvt(i)->GetSegmentSumEnergy();
-		MaxTime = write_evts->GetGammaRayEvt(i)->GetTime();
-		seg_mul = write_evts->GetGammaRayEvt(i)->GetSegmentMultiplicity();
+		MaxSegEnergy = gamma_i.GetSegmentMaxEnergy();
+		SegSumEnergy = gamma_i.GetSegmentSumEnergy();
+		MaxTime = gamma_i.GetTime();
+		seg_mul = gamma_i.GetSegmentMultiplicity();
 		ab_mul = 1;	// this is already the first event
 		
-		// Loop to find a matching event for addback
-		for( unsigned int j = i+1; j < write_evts->GetGammaRayMultiplicity(); ++j ) {
+		// Loop to find a matching event for addback, only in the same cluster
+		// and after this one. In the future we might consider a more
+		// intelligent algorithm, which uses the line-of-sight idea
+		const std::vector<unsigned int> &same_clu = mb_clu_gammas.at( gamma_i.GetCluster() );
+		for( auto it = std::upper_bound( same_clu.begin(), same_clu.end(), i ); it != same_clu.end(); ++it ) {
+
+			unsigned int j = *it;
+			const GammaRayEvt &gamma_j = write_evts->GetGammaRayEvtRef(j);
 
-			// Make sure we are in the same cluster
-			// In the future we might consider a more intelligent
-			// algorithm, which uses the line-of-sight idea
-			if( write_evts->GetGammaRayEvt(i)->GetCluster() !=
-				write_evts->GetGammaRayEvt(j)->GetCluster() ) continue;
-			
 			// Skip if we are outside of the hit window
-			if( TMath::Abs( (double)write_evts->GetGammaRayEvt(i)->GetTime() -
-						    (double)write_evts->GetGammaRayEvt(j)->GetTime() )
+			if( TMath::Abs( (double)gamma_i.GetTime() - (double)gamma_j.GetTime() )
 				> set->GetMiniballAddbackHitWindow() ) continue;
 
 			// Check we haven't already used this event
-			if( std::find( ab_index.begin(), ab_index.end(), j ) != ab_index.end() )
-				continue;
+			if( mb_ab_used[j] ) continue;
 
 			// Then we can add them back
 			ab_mul++;
-			AbSumEnergy += write_evts->GetGammaRayEvt(j)->GetEnergy();
-			SegSumEnergy += write_evts->GetGammaRayEvt(j)->GetSegmentSumEnergy();
-			seg_mul += write_evts->GetGammaRayEvt(j)->GetSegmentMultiplicity();
-			ab_index.push_back(j);
+			AbSumEnergy += gamma_j.GetEnergy();
+			SegSumEnergy += gamma_j.GetSegmentSumEnergy();
+			seg_mul += gamma_j.GetSegmentMultiplicity();
+			mb_ab_used[j] = true;
 
 			// Is this bigger than the current maximum energy?
-			if( write_evts->GetGammaRayEvt(j)->GetEnergy() > MaxEnergy ){
+			if( gamma_j.GetEnergy() > MaxEnergy ){
 				
-				MaxEnergy = write_evts->GetGammaRayEvt(j)->GetEnergy();
-				MaxSegEnergy = write_evts->GetGammaRayEvt(j)->GetSegmentMaxEnergy();
-				MaxCryId = write_evts->GetGammaRayEvt(j)->GetCrystal();
-				MaxSegId = write_evts->GetGammaRayEvt(j)->GetSegment();
-				MaxTime = write_evts->GetGammaRayEvt(j)->GetTime();
+				MaxEnergy = gamma_j.GetEnergy();
+				MaxSegEnergy = gamma_j.GetSegmentMaxEnergy();
+				MaxCryId = gamma_j.GetCrystal();
+				MaxSegId = gamma_j.GetSegment();
+				MaxTime = gamma_j.GetTime();
 
 			}
 
@@ -725,13 +814,17 @@ void MiniballEventBuilder::GammaRayFinder() {
 		gamma_ab_evt->SetSegmentSumEnergy( SegSumEnergy );
 		gamma_ab_evt->SetSegmentMultiplicity( seg_mul );
 		gamma_ab_evt->SetAddbackMultiplicity( ab_mul );
-		gamma_ab_evt->SetCluster( write_evts->GetGammaRayEvt(i)->GetCluster() );
+		gamma_ab_evt->SetCluster( gamma_i.GetCluster() );
 		gamma_ab_evt->SetCrystal( MaxCryId );
 		gamma_ab_evt->SetSegment( MaxSegId );
 		gamma_ab_evt->SetTime( MaxTime );
 		write_evts->AddEvt( gamma_ab_evt );
 		
 	} // i: gamma-ray singles
+
+	// Empty the clusters for the next event
+	for( unsigned int k = 0; k < mb_clu_gammas.size(); ++k )
+		mb_clu_gammas[k].clear();
 	
 	return;
 	
@@ -740,161 +833,180 @@ void MiniballEventBuilder::GammaRayFinder() {
 
 void MiniballEventBuilder::ParticleFinder() {
 
-	// Variables for the finder algorithm
-	std::vector<unsigned char> pindex;
-	std::vector<unsigned char> nindex;
+	// Only the detector elements that were hit, in the order of
+	// detector and sector, using the hits bucketed in BuildRange
+	std::sort( cd_bucket_used.begin(), cd_bucket_used.end() );
+	for( unsigned int b = 0; b < cd_bucket_used.size(); ++b ){
 
-	// Loop over each detector and sector
-	for( unsigned int i = 0; i < set->GetNumberOfCDDetectors(); ++i ){
+		unsigned int i = cd_bucket_used[b] / set->GetNumberOfCDSectors();
+		unsigned int j = cd_bucket_used[b] % set->GetNumberOfCDSectors();
+		const std::vector<unsigned int> &pindex = cd_bucket[2*cd_bucket_used[b]];
+		const std::vector<unsigned int> &nindex = cd_bucket[2*cd_bucket_used[b]+1];
 
-		for( unsigned int j = 0; j < set->GetNumberOfCDSectors(); ++j ){
-			
-			// Reset variables for a new detector element
-			pindex.clear();
-			nindex.clear();
-			std::vector<unsigned char>().swap(pindex);
-			std::vector<unsigned char>().swap(nindex);
-			int pmax_idx = -1, nmax_idx = -1;
-			float pmax_en = -999., nmax_en = -999.;
-			float pad_coinc_en = 0.0;
-			float psum_en, nsum_en;
-			unsigned long long pad_coinc_ts = 0;
-			unsigned int padmult = 0;
-			
-			// Calculate p/n side multiplicities and get indicies
-			for( unsigned int k = 0; k < cd_en_list.size(); ++k ){
-				
-				// Test that we have the correct detector and quadrant
-				if( i != cd_det_list.at(k) || j != cd_sec_list.at(k) )
-					continue;
+		// Reset variables for a new detector element
+		int pmax_idx = -1, nmax_idx = -1;
+		float pmax_en = -999., nmax_en = -999.;
+		float pad_coinc_en = 0.0;
+		float psum_en, nsum_en;
+		unsigned long long pad_coinc_ts = 0;
+		unsigned int padmult = 0;
 
-				// Check max energy and push back the multiplicity
-				if( cd_side_list.at(k) == 0 ) {
-				
-					pindex.push_back(k);
-					
-					// Check if it is max energy
-					if( cd_en_list.at(k) > pmax_en ){
-					
-						pmax_en = cd_en_list.at(k);
-						pmax_idx = k;
-					
-					}
-				
-				} // p-side
-				
-				else if( cd_side_list.at(k) == 1 ) {
-					
-					nindex.push_back(k);
-				
-					// Check if it is max energy
-					if( cd_en_list.at(k) > nmax_en ){
-					
-						nmax_en = cd_en_list.at(k);
-						nmax_idx = k;
-					
-					}
+		// Find the maximum energy on each side
+		for( unsigned int k = 0; k < pindex.size(); ++k ){
 
-				} // n-side
-			
-			} // k: all CD events
+			if( cd_en_list.at( pindex[k] ) > pmax_en ){
 
-			// Look for pad events
-			for( unsigned int k = 0; k < pad_en_list.size(); ++k ){
-				
-				// Test that we have the correct detector and quadrant
-				//if( i != pad_det_list.at(k) || j != pad_sec_list.at(k) )
-				//	continue;
-				
-				// The following is a hack because of the cabling of the Pad
-				// detector in September 2023 for the IS656 run
-				//if( i != pad_det_list.at(k) ) continue;
-				//if( ( j == 0 || j == 3 ) && pad_sec_list.at(k) != 0 ) continue;
-				//if( ( j == 1 || j == 2 ) && pad_sec_list.at(k) != 1 ) continue;
-				
-				// Count the pad multiplicity (panic if it is >1)
-				padmult++;
-				
-				// Plot time differences
-				for( unsigned int p1 = 0; p1 < pindex.size(); ++p1 ){
-				
-					cd_ppad_td[i][j]->Fill( (double)cd_ts_list.at( pindex[p1] ) -
-										  (double)pad_ts_list.at(k) );
-				
-				}
-				
-				//// Check if it is coincident with the p-side
-				if( pmax_idx >= 0 ) {
-					
-					if( TMath::Abs( (long long)pad_ts_list.at(k) - (long long)cd_ts_list.at( pmax_idx ) )
-						< set->GetPadHitWindow() ){
-					
-						pad_coinc_en = pad_en_list.at(k);
-						pad_coinc_ts = pad_ts_list.at(k);
+				pmax_en = cd_en_list.at( pindex[k] );
+				pmax_idx = pindex[k];
 
-						pad_en_id[i]->Fill( j, pad_coinc_en );
+			}
 
-					}
-				
-				}
-				
-				// Hack to recalibrate the pads that are coupled
-				// IS595 - 10th October 2023
-				//if( i == 0 && j == 1 ) pad_coinc_en *= 9.8;
+		} // k: p-side
 
-			} // k: all pad events
-			
+		for( unsigned int k = 0; k < nindex.size(); ++k ){
+
+			if( cd_en_list.at( nindex[k] ) > nmax_en ){
+
+				nmax_en = cd_en_list.at( nindex[k] );
+				nmax_idx = nindex[k];
+
+			}
 
-			// Plot multiplcities
-			if( pindex.size() || nindex.size() )
-				cd_pn_mult[i][j]->Fill( pindex.size(), nindex.size() );
+		} // k: n-side
+
+		// Look for pad events
+		for( unsigned int k = 0; k < pad_en_list.size(); ++k ){
+			
+			// Test that we have the correct detector and quadrant
+			//if( i != pad_det_list.at(k) || j != pad_sec_list.at(k) )
+			//	continue;
+			
+			// The following is a hack because of the cabling of the Pad
+			// detector in September 2023 for the IS656 run
+			//if( i != pad_det_list.at(k) ) continue;
+			//if( ( j == 0 || j == 3 ) && pad_sec_list.at(k) != 0 ) continue;
+			//if( ( j == 1 || j == 2 ) && pad_sec_list.at(k) != 1 ) continue;
+			
+			// Count the pad multiplicity (panic if it is >1)
+			padmult++;
 			
 			// Plot time differences
 			for( unsigned int p1 = 0; p1 < pindex.size(); ++p1 ){
-
-				for( unsigned int n1 = 0; n1 < nindex.size(); ++n1 ){
-					
-					cd_pn_td[i][j]->Fill( (double)cd_ts_list.at( pindex[p1] ) -
-										  (double)cd_ts_list.at( nindex[n1] ) );
-					
-				} // n1
+			
+				cd_ppad_td[i][j]->Fill( (double)cd_ts_list.at( pindex[p1] ) -
+									  (double)pad_ts_list.at(k) );
+			
+			}
+			
+			//// Check if it is coincident with the p-side
+			if( pmax_idx >= 0 ) {
 				
-				for( unsigned int p2 = p1+1; p2 < pindex.size(); ++p2 ){
-					
-					cd_pp_td[i][j]->Fill( (double)cd_ts_list.at( pindex[p1] ) -
-										  (double)cd_ts_list.at( pindex[p2] ) );
-					
-				} // p2
+				if( TMath::Abs( (long long)pad_ts_list.at(k) - (long long)cd_ts_list.at( pmax_idx ) )
+					< set->GetPadHitWindow() ){
+				
+					pad_coinc_en = pad_en_list.at(k);
+					pad_coinc_ts = pad_ts_list.at(k);
 
-			} // p1
+					pad_en_id[i]->Fill( j, pad_coinc_en );
+
+				}
 			
-			for( unsigned int n1 = 0; n1 < nindex.size(); ++n1 ){
+			}
+			
+			// Hack to recalibrate the pads that are coupled
+			// IS595 - 10th October 2023
+			//if( i == 0 && j == 1 ) pad_coinc_en *= 9.8;
 
-				for( unsigned int n2 = n1+1; n2 < nindex.size(); ++n2 ){
-					
-					cd_nn_td[i][j]->Fill( (double)cd_ts_list.at( nindex[n1] ) -
-										  (double)cd_ts_list.at( nindex[n2] ) );
+		} // k: all pad events
+		
 
-				} // n2
+		// Plot multiplcities
+		if( pindex.size() || nindex.size() )
+			cd_pn_mult[i][j]->Fill( pindex.size(), nindex.size() );
+		
+		// Plot time differences
+		for( unsigned int p1 = 0; p1 < pindex.size(); ++p1 ){
 
+			for( unsigned int n1 = 0; n1 < nindex.size(); ++n1 ){
+				
+				cd_pn_td[i][j]->Fill( (double)cd_ts_list.at( pindex[p1] ) -
+									  (double)cd_ts_list.at( nindex[n1] ) );
+				
 			} // n1
 			
-			
-			// ----------------------- //
-			// Particle reconstruction //
-			// ----------------------- //
-			// 1 vs 1 - easiest situation
-			if( pindex.size() == 1 && nindex.size() == 1 ) {
+			for( unsigned int p2 = p1+1; p2 < pindex.size(); ++p2 ){
+				
+				cd_pp_td[i][j]->Fill( (double)cd_ts_list.at( pindex[p1] ) -
+									  (double)cd_ts_list.at( pindex[p2] ) );
+				
+			} // p2
+
+		} // p1
+		
+		for( unsigned int n1 = 0; n1 < nindex.size(); ++n1 ){
+
+			for( unsigned int n2 = n1+1; n2 < nindex.size(); ++n2 ){
+				
+				cd_nn_td[i][j]->Fill( (double)cd_ts_list.at( nindex[n1] ) -
+									  (double)cd_ts_list.at( nindex[n2] ) );
 
+			} // n2
+
+		} // n1
+		
+		
+		// ----------------------- //
+		// Particle reconstruction //
+		// ----------------------- //
+		// 1 vs 1 - easiest situation
+		if( pindex.size() == 1 && nindex.size() == 1 ) {
+
+			// Set event
+			particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
+			particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
+			particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
+			particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
+			particle_evt->SetDetector( i );
+			particle_evt->SetSector( j );
+			particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
+			particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
+			particle_evt->SetEnergyPad( pad_coinc_en );
+			particle_evt->SetTimePad( pad_coinc_ts );
+
+			// Fill tree
+			write_evts->AddEvt( particle_evt );
+			cd_ctr++;
+
+			// Fill histograms
+			cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
+								  cd_en_list.at( pindex[0] ) );
+			cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex[0] ),
+								  cd_en_list.at( nindex[0] ) );
+			cd_pn_1v1[i][j]->Fill( cd_en_list.at( pindex[0] ),
+								  cd_en_list.at( nindex[0] ) );
+			cd_ppad_mult[i][j]->Fill( 1, padmult );
+
+		} // 1 vs 1
+		
+		// 1 vs 2 - n-side charge sharing?
+		else if( pindex.size() == 1 && nindex.size() == 2 ) {
+
+			// Neighbour strips
+			if( TMath::Abs( cd_strip_list.at( nindex[0] ) - cd_strip_list.at( nindex[1] ) ) == 1 ) {
+
+				// Simple sum of both energies, cross-talk not included yet
+				nsum_en  = cd_en_list.at( nindex[0] );
+				nsum_en += cd_en_list.at( nindex[1] );
+				
 				// Set event
 				particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
-				particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
+				particle_evt->SetEnergyN( nsum_en );
 				particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
-				particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
 				particle_evt->SetDetector( i );
 				particle_evt->SetSector( j );
 				particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
-				particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
+				particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
 				particle_evt->SetEnergyPad( pad_coinc_en );
 				particle_evt->SetTimePad( pad_coinc_ts );
 
@@ -905,444 +1017,405 @@ void MiniballEventBuilder::ParticleFinder() {
 				// Fill histograms
 				cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
 									  cd_en_list.at( pindex[0] ) );
-				cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex[0] ),
-									  cd_en_list.at( nindex[0] ) );
-				cd_pn_1v1[i][j]->Fill( cd_en_list.at( pindex[0] ),
+				cd_nen_id[i][j]->Fill( nsum_en,
+									  cd_en_list.at( nmax_idx ) );
+				cd_pn_1v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
 									  cd_en_list.at( nindex[0] ) );
-				cd_ppad_mult[i][j]->Fill( 1, padmult );
+				cd_pn_1v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
+									  cd_en_list.at( nindex[1] ) );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
 
-			} // 1 vs 1
+			} // neighbour strips
 			
-			// 1 vs 2 - n-side charge sharing?
-			else if( pindex.size() == 1 && nindex.size() == 2 ) {
+			// otherwise treat as 1 vs 1
+			else {
+				
+				// Set event
+				particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
+				particle_evt->SetEnergyN( cd_en_list.at( nmax_idx ) );
+				particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
+				particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
 
-				// Neighbour strips
-				if( TMath::Abs( cd_strip_list.at( nindex[0] ) - cd_strip_list.at( nindex[1] ) ) == 1 ) {
+				// Fill tree
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
 
-					// Simple sum of both energies, cross-talk not included yet
-					nsum_en  = cd_en_list.at( nindex[0] );
-					nsum_en += cd_en_list.at( nindex[1] );
-					
-					// Set event
-					particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
-					particle_evt->SetEnergyN( nsum_en );
-					particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
-					particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
-										  cd_en_list.at( pindex[0] ) );
-					cd_nen_id[i][j]->Fill( nsum_en,
-										  cd_en_list.at( nmax_idx ) );
-					cd_pn_1v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_pn_1v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
-										  cd_en_list.at( nindex[1] ) );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
-
-				} // neighbour strips
-				
-				// otherwise treat as 1 vs 1
-				else {
-					
-					// Set event
-					particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
-					particle_evt->SetEnergyN( cd_en_list.at( nmax_idx ) );
-					particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
-					particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
-										  cd_en_list.at( pindex[0] ) );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
-										  cd_en_list.at( nmax_idx ) );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
+									  cd_en_list.at( pindex[0] ) );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
+									  cd_en_list.at( nmax_idx ) );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
 
-					
-				} // treat as 1 vs 1
+				
+			} // treat as 1 vs 1
 
-			} // 1 vs 2
-			
-			// 2 vs 1 - p-side charge sharing?
-			else if( pindex.size() == 2 && nindex.size() == 1 ) {
+		} // 1 vs 2
+		
+		// 2 vs 1 - p-side charge sharing?
+		else if( pindex.size() == 2 && nindex.size() == 1 ) {
 
-				// Neighbour strips
-				if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 ) {
+			// Neighbour strips
+			if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 ) {
 
-					// Simple sum of both energies, cross-talk not included yet
-					psum_en  = cd_en_list.at( pindex[0] );
-					psum_en += cd_en_list.at( pindex[1] );
-					
-					// Set event
-					particle_evt->SetEnergyP( psum_en );
-					particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
-					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-					particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( psum_en,
-										  cd_en_list.at( pmax_idx ) );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex[0] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_pn_2v1[i][j]->Fill( cd_en_list.at( pindex[0] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_pn_2v1[i][j]->Fill( cd_en_list.at( pindex[1] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
-
-				} // neighbour strips
-
-				// otherwise treat as 1 vs 1
-				else {
-					
-					// Set event
-					particle_evt->SetEnergyP( cd_en_list.at( pmax_idx ) );
-					particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
-					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-					particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
-										  cd_en_list.at( pmax_idx ) );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex[0] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
+				// Simple sum of both energies, cross-talk not included yet
+				psum_en  = cd_en_list.at( pindex[0] );
+				psum_en += cd_en_list.at( pindex[1] );
+				
+				// Set event
+				particle_evt->SetEnergyP( psum_en );
+				particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
+				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+				particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
 
-					
-				} // treat as 1 vs 1
-
-			} // 2 vs 1
-			
-			// 2 vs 2 - charge sharing on both or two particles?
-			else if( pindex.size() == 2 && nindex.size() == 2 ) {
-
-				// Neighbour strips - p-side + n-side
-				if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 &&
-				    TMath::Abs( cd_strip_list.at( nindex[0] ) - cd_strip_list.at( nindex[1] ) ) == 1 ) {
-
-					// Simple sum of both energies, cross-talk not included yet
-					psum_en  = cd_en_list.at( pindex[0] );
-					psum_en += cd_en_list.at( pindex[1] );
-					nsum_en  = cd_en_list.at( nindex[0] );
-					nsum_en += cd_en_list.at( nindex[1] );
-
-					// Set event
-					particle_evt->SetEnergyP( psum_en );
-					particle_evt->SetEnergyN( nsum_en );
-					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-					particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
-										  psum_en );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
-										  nsum_en );
-					cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
-										  cd_en_list.at( nindex[1] ) );
-					cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[1] ),
-										  cd_en_list.at( nindex[0] ) );
-					cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[1] ),
-										  cd_en_list.at( nindex[1] ) );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
-
-				} // neighbour strips - p-side + n-side
-
-				// Neighbour strips - p-side only
-				else if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 ) {
-
-					// Simple sum of both energies, cross-talk not included yet
-					psum_en  = cd_en_list.at( pindex.at(0) );
-					psum_en += cd_en_list.at( pindex.at(1) );
-
-					// Set event
-					particle_evt->SetEnergyP( psum_en );
-					particle_evt->SetEnergyN( nmax_en );
-					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-					particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
-										  psum_en );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
-										  cd_en_list.at( nmax_idx ) );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
-
-				} // neighbour strips - p-side only
-
-				// Neighbour strips - n-side only
-				else if( TMath::Abs( cd_strip_list.at( nindex[0] ) - cd_strip_list.at( nindex[1] ) ) == 1 ) {
-
-					// Simple sum of both energies, cross-talk not included yet
-					nsum_en  = cd_en_list.at( nindex.at(0) );
-					nsum_en += cd_en_list.at( nindex.at(1) );
-
-					// Set event
-					particle_evt->SetEnergyP( cd_en_list.at( pmax_idx ) );
-					particle_evt->SetEnergyN( nsum_en );
-					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-					particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
-										  cd_en_list.at( pmax_idx ) );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
-										  nsum_en );
-					cd_ppad_mult[i][i]->Fill( 1, padmult );
-
-				} // neighbour strips - n-side only
-
-				// Neither of them are neighbours... 2 events?
-				else {
+				// Fill tree
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
 
-					// Event 1 is with first p-side, but which n-side?
-					unsigned int nfriend_idx = nindex.at(0);
-					if( TMath::Abs( cd_en_list.at( pindex.at(0) ) - cd_en_list.at( nindex.at(1) ) )
-					    < TMath::Abs( cd_en_list.at( pindex.at(0) ) - cd_en_list.at( nindex.at(0) ) ) )
-						nfriend_idx = nindex.at(1);
-					
-					// Set event
-					particle_evt->SetEnergyP( cd_en_list.at( pindex.at(0) ) );
-					particle_evt->SetEnergyN( cd_en_list.at( nfriend_idx ) );
-					particle_evt->SetTimeP( cd_ts_list.at( pindex.at(0) ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nfriend_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pindex.at(0) ) );
-					particle_evt->SetStripN( cd_strip_list.at( nfriend_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree for first hit
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
-
-					// Event 2 is with first p-side, but which n-side?
-					if( nfriend_idx == nindex.at(1) ) nfriend_idx = nindex.at(0);
-					else nfriend_idx = nindex.at(1);
-					
-					// Set event
-					particle_evt->SetEnergyP( cd_en_list.at( pindex.at(1) ) );
-					particle_evt->SetEnergyN( cd_en_list.at( nfriend_idx ) );
-					particle_evt->SetTimeP( cd_ts_list.at( pindex.at(1) ) );
-					particle_evt->SetTimeN( cd_ts_list.at( nfriend_idx ) );
-					particle_evt->SetDetector( i );
-					particle_evt->SetSector( j );
-					particle_evt->SetStripP( cd_strip_list.at( pindex.at(1) ) );
-					particle_evt->SetStripN( cd_strip_list.at( nfriend_idx ) );
-					particle_evt->SetEnergyPad( pad_coinc_en );
-					particle_evt->SetTimePad( pad_coinc_ts );
-
-					// Fill tree for second hit
-					write_evts->AddEvt( particle_evt );
-					cd_ctr++;
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( psum_en,
+									  cd_en_list.at( pmax_idx ) );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex[0] ),
+									  cd_en_list.at( nindex[0] ) );
+				cd_pn_2v1[i][j]->Fill( cd_en_list.at( pindex[0] ),
+									  cd_en_list.at( nindex[0] ) );
+				cd_pn_2v1[i][j]->Fill( cd_en_list.at( pindex[1] ),
+									  cd_en_list.at( nindex[0] ) );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
 
-					
-					// Fill histograms
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex.at(0) ),
-										  cd_en_list.at( pindex.at(0) ) );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex.at(0) ),
-										  cd_en_list.at( nindex.at(0) ) );
-					cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex.at(1) ),
-										  cd_en_list.at( pindex.at(1) ) );
-					cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex.at(1) ),
-										  cd_en_list.at( nindex.at(1) ) );
-					cd_ppad_mult[i][i]->Fill( 2, padmult );
-
-				} // neighbour strips - n-side only
-
-			} // 2 vs 2
-			
-//			// 1 vs 0 - p-side only, do we carry on?
-//			if( pindex.size() == 1 && nindex.size() == 0 ) {
-//
-//				// Set event
-//				particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
-//				particle_evt->SetEnergyN( cd_en_list.at( 0.0 ) );
-//				particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
-//				particle_evt->SetTimeN( cd_ts_list.at( pindex[0] ) );
-//				particle_evt->SetDetector( i );
-//				particle_evt->SetSector( j );
-//				particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
-//				particle_evt->SetStripN( 5.0 );
-//
-//				// Fill tree
-//				write_evts->AddEvt( particle_evt );
-//				cd_ctr++;
-//
-//				// Fill histograms
-//				cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
-//									  cd_en_list.at( pindex[0] ) );
-//
-//			} // 1 vs 0
-//
-//			// 2 vs 0 - p-side charge sharing? and no n-side
-//			else if( pindex.size() == 2 && nindex.size() == 0 ) {
-//
-//				// Neighbour strips
-//				if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 ) {
-//
-//					// Simple sum of both energies, cross-talk not included yet
-//					psum_en  = cd_en_list.at( pindex[0] );
-//					psum_en += cd_en_list.at( pindex[1] );
-//
-//					// Set event
-//					particle_evt->SetEnergyP( psum_en );
-//					particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
-//					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-//					particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
-//					particle_evt->SetDetector( i );
-//					particle_evt->SetSector( j );
-//					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-//					particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
-//
-//					// Fill tree
-//					write_evts->AddEvt( particle_evt );
-//					cd_ctr++;
-//
-//					// Fill histograms
-//					cd_pen_id[i][j]->Fill( psum_en,
-//										  cd_en_list.at( pmax_idx ) );
-//
-//				} // neighbour strips
-//
-//				// otherwise treat as 1 vs 0
-//				else {
-//
-//					// Set event
-//					particle_evt->SetEnergyP( cd_en_list.at( pmax_idx ) );
-//					particle_evt->SetEnergyN( 0.0 );
-//					particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-//					particle_evt->SetTimeN( cd_ts_list.at( pmax_idx ) );
-//					particle_evt->SetDetector( i );
-//					particle_evt->SetSector( j );
-//					particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-//					particle_evt->SetStripN( 5.0 );
-//
-//					// Fill tree
-//					write_evts->AddEvt( particle_evt );
-//					cd_ctr++;
-//
-//					// Fill histograms
-//					cd_pen_id[i][j]->Fill( pmax_en,
-//										  cd_en_list.at( pmax_idx ) );
-//
-//				} // treat as 1 vs 0
-//
-//			} // 2 vs 0
+			} // neighbour strips
 
-			// Everything else, just take the max energy for now
-			else if( pmax_idx >= 0 && nmax_idx >= 0 ){
+			// otherwise treat as 1 vs 1
+			else {
 				
 				// Set event
-				particle_evt->SetEnergyP( pmax_en );
-				particle_evt->SetEnergyN( nmax_en );
+				particle_evt->SetEnergyP( cd_en_list.at( pmax_idx ) );
+				particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
 				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
-				particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
 				particle_evt->SetDetector( i );
 				particle_evt->SetSector( j );
 				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
-				particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
+				particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
 				particle_evt->SetEnergyPad( pad_coinc_en );
 				particle_evt->SetTimePad( pad_coinc_ts );
 
 				// Fill tree
 				write_evts->AddEvt( particle_evt );
 				cd_ctr++;
+
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
+									  cd_en_list.at( pmax_idx ) );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex[0] ),
+									  cd_en_list.at( nindex[0] ) );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
+
 				
-			}
-			
-		} // j: sector ID
+			} // treat as 1 vs 1
+
+		} // 2 vs 1
 		
-	} // i: detector ID
+		// 2 vs 2 - charge sharing on both or two particles?
+		else if( pindex.size() == 2 && nindex.size() == 2 ) {
 
-	return;
-	
-}
+			// Neighbour strips - p-side + n-side
+			if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 &&
+			    TMath::Abs( cd_strip_list.at( nindex[0] ) - cd_strip_list.at( nindex[1] ) ) == 1 ) {
 
-void MiniballEventBuilder::BeamDumpFinder(){
+				// Simple sum of both energies, cross-talk not included yet
+				psum_en  = cd_en_list.at( pindex[0] );
+				psum_en += cd_en_list.at( pindex[1] );
+				nsum_en  = cd_en_list.at( nindex[0] );
+				nsum_en += cd_en_list.at( nindex[1] );
 
-	// Build individual beam dump events
-	// Loop over all the events in beam dump detectors
-	for( unsigned int i = 0; i < bd_en_list.size(); ++i ) {
-	
-		bd_evt->SetEnergy( bd_en_list.at(i) );
-		bd_evt->SetTime( bd_ts_list.at(i) );
-		bd_evt->SetDetector( bd_det_list.at(i) );
-		write_evts->AddEvt( bd_evt );
-		bd_ctr++;
-		
+				// Set event
+				particle_evt->SetEnergyP( psum_en );
+				particle_evt->SetEnergyN( nsum_en );
+				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+				particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
+
+				// Fill tree
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
+
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
+									  psum_en );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
+									  nsum_en );
+				cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
+									  cd_en_list.at( nindex[0] ) );
+				cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[0] ),
+									  cd_en_list.at( nindex[1] ) );
+				cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[1] ),
+									  cd_en_list.at( nindex[0] ) );
+				cd_pn_2v2[i][j]->Fill( cd_en_list.at( pindex[1] ),
+									  cd_en_list.at( nindex[1] ) );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
+
+			} // neighbour strips - p-side + n-side
+
+			// Neighbour strips - p-side only
+			else if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 ) {
+
+				// Simple sum of both energies, cross-talk not included yet
+				psum_en  = cd_en_list.at( pindex.at(0) );
+				psum_en += cd_en_list.at( pindex.at(1) );
+
+				// Set event
+				particle_evt->SetEnergyP( psum_en );
+				particle_evt->SetEnergyN( nmax_en );
+				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+				particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
+
+				// Fill tree
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
+
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
+									  psum_en );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
+									  cd_en_list.at( nmax_idx ) );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
+
+			} // neighbour strips - p-side only
+
+			// Neighbour strips - n-side only
+			else if( TMath::Abs( cd_strip_list.at( nindex[0] ) - cd_strip_list.at( nindex[1] ) ) == 1 ) {
+
+				// Simple sum of both energies, cross-talk not included yet
+				nsum_en  = cd_en_list.at( nindex.at(0) );
+				nsum_en += cd_en_list.at( nindex.at(1) );
+
+				// Set event
+				particle_evt->SetEnergyP( cd_en_list.at( pmax_idx ) );
+				particle_evt->SetEnergyN( nsum_en );
+				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+				particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
+
+				// Fill tree
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
+
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pmax_idx ),
+									  cd_en_list.at( pmax_idx ) );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nmax_idx ),
+									  nsum_en );
+				cd_ppad_mult[i][i]->Fill( 1, padmult );
+
+			} // neighbour strips - n-side only
+
+			// Neither of them are neighbours... 2 events?
+			else {
+
+				// Event 1 is with first p-side, but which n-side?
+				unsigned int nfriend_idx = nindex.at(0);
+				if( TMath::Abs( cd_en_list.at( pindex.at(0) ) - cd_en_list.at( nindex.at(1) ) )
+				    < TMath::Abs( cd_en_list.at( pindex.at(0) ) - cd_en_list.at( nindex.at(0) ) ) )
+					nfriend_idx = nindex.at(1);
+				
+				// Set event
+				particle_evt->SetEnergyP( cd_en_list.at( pindex.at(0) ) );
+				particle_evt->SetEnergyN( cd_en_list.at( nfriend_idx ) );
+				particle_evt->SetTimeP( cd_ts_list.at( pindex.at(0) ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nfriend_idx ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pindex.at(0) ) );
+				particle_evt->SetStripN( cd_strip_list.at( nfriend_idx ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
+
+				// Fill tree for first hit
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
+
+				// Event 2 is with first p-side, but which n-side?
+				if( nfriend_idx == nindex.at(1) ) nfriend_idx = nindex.at(0);
+				else nfriend_idx = nindex.at(1);
+				
+				// Set event
+				particle_evt->SetEnergyP( cd_en_list.at( pindex.at(1) ) );
+				particle_evt->SetEnergyN( cd_en_list.at( nfriend_idx ) );
+				particle_evt->SetTimeP( cd_ts_list.at( pindex.at(1) ) );
+				particle_evt->SetTimeN( cd_ts_list.at( nfriend_idx ) );
+				particle_evt->SetDetector( i );
+				particle_evt->SetSector( j );
+				particle_evt->SetStripP( cd_strip_list.at( pindex.at(1) ) );
+				particle_evt->SetStripN( cd_strip_list.at( nfriend_idx ) );
+				particle_evt->SetEnergyPad( pad_coinc_en );
+				particle_evt->SetTimePad( pad_coinc_ts );
+
+				// Fill tree for second hit
+				write_evts->AddEvt( particle_evt );
+				cd_ctr++;
+
+				
+				// Fill histograms
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex.at(0) ),
+									  cd_en_list.at( pindex.at(0) ) );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex.at(0) ),
+									  cd_en_list.at( nindex.at(0) ) );
+				cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex.at(1) ),
+									  cd_en_list.at( pindex.at(1) ) );
+				cd_nen_id[i][j]->Fill( cd_strip_list.at( nindex.at(1) ),
+									  cd_en_list.at( nindex.at(1) ) );
+				cd_ppad_mult[i][i]->Fill( 2, padmult );
+
+			} // neighbour strips - n-side only
+
+		} // 2 vs 2
+		
+//		// 1 vs 0 - p-side only, do we carry on?
+//		if( pindex.size() == 1 && nindex.size() == 0 ) {
+//
+//			// Set event
+//			particle_evt->SetEnergyP( cd_en_list.at( pindex[0] ) );
+//			particle_evt->SetEnergyN( cd_en_list.at( 0.0 ) );
+//			particle_evt->SetTimeP( cd_ts_list.at( pindex[0] ) );
+//			particle_evt->SetTimeN( cd_ts_list.at( pindex[0] ) );
+//			particle_evt->SetDetector( i );
+//			particle_evt->SetSector( j );
+//			particle_evt->SetStripP( cd_strip_list.at( pindex[0] ) );
+//			particle_evt->SetStripN( 5.0 );
+//
+//			// Fill tree
+//			write_evts->AddEvt( particle_evt );
+//			cd_ctr++;
+//
+//			// Fill histograms
+//			cd_pen_id[i][j]->Fill( cd_strip_list.at( pindex[0] ),
+//								  cd_en_list.at( pindex[0] ) );
+//
+//		} // 1 vs 0
+//
+//		// 2 vs 0 - p-side charge sharing? and no n-side
+//		else if( pindex.size() == 2 && nindex.size() == 0 ) {
+//
+//			// Neighbour strips
+//			if( TMath::Abs( cd_strip_list.at( pindex[0] ) - cd_strip_list.at( pindex[1] ) ) == 1 ) {
+//
+//				// Simple sum of both energies, cross-talk not included yet
+//				psum_en  = cd_en_list.at( pindex[0] );
+//				psum_en += cd_en_list.at( pindex[1] );
+//
+//				// Set event
+//				particle_evt->SetEnergyP( psum_en );
+//				particle_evt->SetEnergyN( cd_en_list.at( nindex[0] ) );
+//				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+//				particle_evt->SetTimeN( cd_ts_list.at( nindex[0] ) );
+//				particle_evt->SetDetector( i );
+//				particle_evt->SetSector( j );
+//				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+//				particle_evt->SetStripN( cd_strip_list.at( nindex[0] ) );
+//
+//				// Fill tree
+//				write_evts->AddEvt( particle_evt );
+//				cd_ctr++;
+//
+//				// Fill histograms
+//				cd_pen_id[i][j]->Fill( psum_en,
+//									  cd_en_list.at( pmax_idx ) );
+//
+//			} // neighbour strips
+//
+//			// otherwise treat as 1 vs 0
+//			else {
+//
+//				// Set event
+//				particle_evt->SetEnergyP( cd_en_list.at( pmax_idx ) );
+//				particle_evt->SetEnergyN( 0.0 );
+//				particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+//				particle_evt->SetTimeN( cd_ts_list.at( pmax_idx ) );
+//				particle_evt->SetDetector( i );
+//				particle_evt->SetSector( j );
+//				particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+//				particle_evt->SetStripN( 5.0 );
+//
+//				// Fill tree
+//				write_evts->AddEvt( particle_evt );
+//				cd_ctr++;
+//
+//				// Fill histograms
+//				cd_pen_id[i][j]->Fill( pmax_en,
+//									  cd_en_list.at( pmax_idx ) );
+//
+//			} // treat as 1 vs 0
+//
+//		} // 2 vs 0
+
+		// Everything else, just take the max energy for now
+		else if( pmax_idx >= 0 && nmax_idx >= 0 ){
+			
+			// Set event
+			particle_evt->SetEnergyP( pmax_en );
+			particle_evt->SetEnergyN( nmax_en );
+			particle_evt->SetTimeP( cd_ts_list.at( pmax_idx ) );
+			particle_evt->SetTimeN( cd_ts_list.at( nmax_idx ) );
+			particle_evt->SetDetector( i );
+			particle_evt->SetSector( j );
+			particle_evt->SetStripP( cd_strip_list.at( pmax_idx ) );
+			particle_evt->SetStripN( cd_strip_list.at( nmax_idx ) );
+			particle_evt->SetEnergyPad( pad_coinc_en );
+			particle_evt->SetTimePad( pad_coinc_ts );
+
+			// Fill tree
+			write_evts->AddEvt( particle_evt );
+			cd_ctr++;
+			
+		}
+
+	} // b: detector element
+
+	return;
+	
+}
+
+void MiniballEventBuilder::BeamDumpFinder(){
+
+	// Build individual beam dump events
+	// Loop over all the events in beam dump detectors
+	for( unsigned int i = 0; i < bd_en_list.size(); ++i ) {
+	
+		bd_evt->SetEnergy( bd_en_list.at(i) );
+		bd_evt->SetTime( bd_ts_list.at(i) );
+		bd_evt->SetDetector( bd_det_list.at(i) );
+		write_evts->AddEvt( bd_evt );
+		bd_ctr++;
+		
 	}
 	
 	return;
@@ -1448,37 +1521,16 @@ void MiniballEventBuilder::IonChamberFinder(){
 
 
 
-unsigned long MiniballEventBuilder::BuildEvents() {
-	
-	/// Function to loop over the sort tree and build array and recoil events
-
-	// Load the full tree if possible
-	//output_tree->SetMaxVirtualSize(1.0e9);	// 1.0 GB
-	//input_tree->SetMaxVirtualSize(2.2e9); 	// 2.2 GB
-	//input_tree->LoadBaskets(2.0e9); 		// Load 2.0 GB of data to memory
-
-	if( input_tree->LoadTree(0) < 0 ){
-		
-		std::cout << " Event Building: nothing to do" << std::endl;
-		return 0;
-		
-	}
+void MiniballEventBuilder::BuildRange( unsigned long first, unsigned long last ) {
 	
-	// Get ready and go
-	Initialise();
-	n_entries = input_tree->GetEntries();
-	n_mbs_entries = mbsinfo_tree->GetEntries();
+	/// Loop over the entries from first up to last and build the events.
+	/// The lookahead at the end of a range still reads entry last, so that
+	/// the last event is closed exactly as it is when building in one go.
 
-	std::cout << " Event Building: number of entries in input tree = ";
-	std::cout << n_entries << std::endl;
-
-	std::cout << "\tnumber of MBS Events/triggers in input tree = ";
-	std::cout << n_mbs_entries << std::endl;
-	
 	// ------------------------------------------------------------------------ //
 	// Main loop over TTree to find events
 	// ------------------------------------------------------------------------ //
-	for( unsigned long i = 0; i < n_entries; ++i ) {
+	for( unsigned long i = first; i < last; ++i ) {
 		
 		// First event, yes please!
 		if( i == 0 ){
@@ -1514,6 +1566,35 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 
 		}
 
+		// First entry of a chunk when building in parallel. The event ID
+		// and trigger time before it come from the pre-scan, so it's like
+		// we just looked ahead to this entry from the previous one
+		else if( i == first ) {
+
+			input_tree->GetEntry(i);
+			myeventid = in_data->GetEventID();
+
+			// Get the MBS info event, looking for it if the index fails
+			if( mbsinfo_tree->GetEntryWithIndex( myeventid ) < 0 &&
+			    n_mbs_entries > 0 ) {
+
+				for( unsigned long j = 0; j < n_mbs_entries; ++j ){
+
+					mbsinfo_tree->GetEntry(j);
+					if( mbs_info->GetEventID() == myeventid ) break;
+
+					// Panic if we failed!
+					if( j+1 == n_mbs_entries ) {
+						std::cerr << "Didn't find matching MBS Event IDs at start of chunk: ";
+						std::cerr << myeventid << std::endl;
+					}
+
+				}
+
+			}
+
+		}
+
 		// Get the time of the event
 		if( set->GetMbsEventMode() ) {
 		
@@ -1557,7 +1638,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 		if( in_data->IsFebex() ) {
 			
 			// Get the data
-			febex_data = in_data->GetFebexData();
+			febex_data = &in_data->GetFebexDataRef();
 			mysfp = febex_data->GetSfp();
 			myboard = febex_data->GetBoard();
 			mych = febex_data->GetChannel();
@@ -1582,19 +1663,19 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			// otherwise carry on
 			else {
 				
-				// Update calibration if necessary
-				if( overwrite_cal ) {
+				// Update calibration if necessary, but not for hits made
+				// by the pile-up recovery, which have no firmware charge
+				if( overwrite_cal && !febex_data->IsRecovered() ) {
 					
+					const FebexChannelCal &fcal = cal->GetFebexCal( mysfp, myboard, mych );
 					unsigned int adc_tmp_value;
-					if( cal->FebexType( mysfp, myboard, mych ) == "Qshort" )
-						adc_tmp_value = febex_data->GetQshort();
-					else if( cal->FebexType( mysfp, myboard, mych ) == "Qint" )
+					if( fcal.type == MiniballCalibration::FEBEX_QINT )
 						adc_tmp_value = febex_data->GetQint();
 					else adc_tmp_value = febex_data->GetQshort();
 
-					myenergy = cal->FebexEnergy( mysfp, myboard, mych, adc_tmp_value );
+					myenergy = cal->FebexEnergy( fcal, adc_tmp_value, i );
 
-					if( adc_tmp_value > cal->FebexThreshold( mysfp, myboard, mych ) )
+					if( adc_tmp_value > fcal.threshold )
 						mythres = true;
 					else mythres = false;
 
@@ -1615,163 +1696,162 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 				n_sfp[mysfp]++;
 				n_board[mysfp][myboard]++;
 				
-				// Is it a gamma ray from Miniball?
-				if( set->IsMiniball( mysfp, myboard, mych ) && mythres ) {
-					
-					// Increment counts and open the event
-					n_miniball++;
-					hit_ctr++;
-					
-					// Clipped rejection and pileup rejection
-					if( ( !myclipped || !set->GetClippedRejection() ) &&
-					    ( !mypileup || !set->GetPileupRejection() ) ) {
-
-						event_open = true;
-						mb_en_list.push_back( myenergy );
-						mb_ts_list.push_back( mytime );
-						mb_clu_list.push_back( set->GetMiniballCluster( mysfp, myboard, mych ) );
-						mb_cry_list.push_back( set->GetMiniballCrystal( mysfp, myboard, mych ) );
-						mb_seg_list.push_back( set->GetMiniballSegment( mysfp, myboard, mych ) );
-						
-					}
-					
-				}
+				// What is plugged into this channel?
+				const MiniballChannelID &chan = set->GetFebexChannelID( mysfp, myboard, mych );
 				
-				// Is it a particle from the CD?
-				else if( set->IsCD( mysfp, myboard, mych ) && mythres ) {
-					
-					// Increment counts and open the event
-					n_cd++;
-					hit_ctr++;
+				// Clipped rejection and pileup rejection
+				bool accept = ( !myclipped || !set->GetClippedRejection() ) &&
+							  ( !mypileup || !set->GetPileupRejection() );
+				
+				if( mythres ) switch( chan.type ) {
 					
-					// Clipped rejection and pileup rejection
-					if( ( !myclipped || !set->GetClippedRejection() ) &&
-						( !mypileup || !set->GetPileupRejection() ) ) {
+					// Is it a gamma ray from Miniball?
+					case MiniballSettings::DET_MINIBALL:
 						
-						event_open = true;
-						cd_en_list.push_back( myenergy );
-						cd_ts_list.push_back( mytime );
-						cd_det_list.push_back( set->GetCDDetector( mysfp, myboard, mych ) );
-						cd_sec_list.push_back( set->GetCDSector( mysfp, myboard, mych ) );
-						cd_side_list.push_back( set->GetCDSide( mysfp, myboard, mych ) );
-						cd_strip_list.push_back( set->GetCDStrip( mysfp, myboard, mych ) );
+						// Increment counts and open the event
+						n_miniball++;
+						hit_ctr++;
 						
-					}
-					
-				}
-				
-				// Is it a particle from the Pad?
-				else if( set->IsPad( mysfp, myboard, mych ) && mythres ) {
-					
-					// Increment counts and open the event
-					n_pad++;
-					hit_ctr++;
-					
-					// Clipped rejection and pileup rejection
-					if( ( !myclipped || !set->GetClippedRejection() ) &&
-					    ( !mypileup || !set->GetPileupRejection() ) ) {
-
-						event_open = true;
-						pad_en_list.push_back( myenergy );
-						pad_ts_list.push_back( mytime );
-						pad_det_list.push_back( set->GetPadDetector( mysfp, myboard, mych ) );
-						pad_sec_list.push_back( set->GetPadSector( mysfp, myboard, mych ) );
+						if( accept ) {
+							
+							event_open = true;
+							mb_en_list.push_back( myenergy );
+							mb_ts_list.push_back( mytime );
+							mb_clu_list.push_back( chan.id[0] );
+							mb_cry_list.push_back( chan.id[1] );
+							mb_seg_list.push_back( chan.id[2] );
+							BucketMiniballHit( chan );
+							
+						}
+						break;
 						
-					}
-					
-				}
-				
-				// Is it an electron from Spede?
-				else if( set->IsSpede( mysfp, myboard, mych ) && mythres ) {
-					
-					// Increment counts and open the event
-					n_spede++;
-					hit_ctr++;
-					
-					// Clipped rejection and pileup rejection
-					if( ( !myclipped || !set->GetClippedRejection() ) &&
-					    ( !mypileup || !set->GetPileupRejection() ) ) {
-
-						event_open = true;
-						spede_en_list.push_back( myenergy );
-						spede_ts_list.push_back( mytime );
-						spede_seg_list.push_back( set->GetSpedeSegment( mysfp, myboard, mych ) );
+					// Is it a particle from the CD?
+					case MiniballSettings::DET_CD:
 						
-					}
-					
-				}
-				
-				// Is it a gamma ray from the beam dump?
-				else if( set->IsBeamDump( mysfp, myboard, mych ) && mythres ) {
-					
-					// Increment counts and open the event
-					n_bd++;
-					hit_ctr++;
-					
-					// Clipped rejection and pileup rejection
-					if( ( !myclipped || !set->GetClippedRejection() ) &&
-					    ( !mypileup || !set->GetPileupRejection() ) ) {
-
-						event_open = true;
-						bd_en_list.push_back( myenergy );
-						bd_ts_list.push_back( mytime );
-						bd_det_list.push_back( set->GetBeamDumpDetector( mysfp, myboard, mych ) );
+						// Increment counts and open the event
+						n_cd++;
+						hit_ctr++;
 						
-					}
-					
-				}
-				
-				// Is it an IonChamber event
-				else if( set->IsIonChamber( mysfp, myboard, mych ) && mythres ) {
-					
-					// Increment counts and open the event
-					n_ic++;
-					hit_ctr++;
-					
-					// Clipped rejection and pileup rejection
-					if( ( !myclipped || !set->GetClippedRejection() ) &&
-					    ( !mypileup || !set->GetPileupRejection() ) ) {
-
-						event_open = true;
-						ic_en_list.push_back( myenergy );
-						ic_ts_list.push_back( mytime );
-						ic_id_list.push_back( set->GetIonChamberLayer( mysfp, myboard, mych ) );
+						if( accept ) {
+							
+							event_open = true;
+							cd_en_list.push_back( myenergy );
+							cd_ts_list.push_back( mytime );
+							cd_det_list.push_back( chan.id[0] );
+							cd_sec_list.push_back( chan.id[1] );
+							cd_side_list.push_back( chan.id[2] );
+							cd_strip_list.push_back( chan.id[3] );
+							BucketCDHit( chan );
+							
+						}
+						break;
 						
-					}
-					
-				}
-				
-				// Pulser item
-				else if( set->IsPulser( mysfp, myboard, mych ) && mythres ) {
-					
-					unsigned int pulserID = set->GetPulser( mysfp, myboard, mych );
-					pulser_time[pulserID] = mytime;
-					pulser_T = (double)pulser_time[pulserID] - (double)pulser_prev[pulserID];
-					pulser_f = 1e9 / pulser_T;
-					if( pulserID == 0 && pulser_prev[pulserID] != 0 ) {
-						pulser_period->Fill( pulser_T );
-						pulser_freq->Fill( pulser_time[pulserID], pulser_f );
-					}
-					
-					if( pulserID == 0 ) {
+					// Is it a particle from the Pad?
+					case MiniballSettings::DET_PAD:
+						
+						// Increment counts and open the event
+						n_pad++;
+						hit_ctr++;
+						
+						if( accept ) {
+							
+							event_open = true;
+							pad_en_list.push_back( myenergy );
+							pad_ts_list.push_back( mytime );
+							pad_det_list.push_back( chan.id[0] );
+							pad_sec_list.push_back( chan.id[1] );
+							
+						}
+						break;
+						
+					// Is it an electron from Spede?
+					case MiniballSettings::DET_SPEDE:
+						
+						// Increment counts and open the event
+						n_spede++;
+						hit_ctr++;
+						
+						if( accept ) {
+							
+							event_open = true;
+							spede_en_list.push_back( myenergy );
+							spede_ts_list.push_back( mytime );
+							spede_seg_list.push_back( chan.id[0] );
+							
+						}
+						break;
+						
+					// Is it a gamma ray from the beam dump?
+					case MiniballSettings::DET_BEAMDUMP:
+						
+						// Increment counts and open the event
+						n_bd++;
+						hit_ctr++;
+						
+						if( accept ) {
+							
+							event_open = true;
+							bd_en_list.push_back( myenergy );
+							bd_ts_list.push_back( mytime );
+							bd_det_list.push_back( chan.id[0] );
+							
+						}
+						break;
+						
+					// Is it an IonChamber event
+					case MiniballSettings::DET_IONCHAMBER:
+						
+						// Increment counts and open the event
+						n_ic++;
+						hit_ctr++;
+						
+						if( accept ) {
+							
+							event_open = true;
+							ic_en_list.push_back( myenergy );
+							ic_ts_list.push_back( mytime );
+							ic_id_list.push_back( chan.id[0] );
+							
+						}
+						break;
 						
-						for( unsigned int i = 1; i < set->GetNumberOfPulsers(); i++ ) {
-							
-							// If diff is greater than 5 ms, we have the wrong pair
-							double tmp_tdiff = (double)pulser_time[i] - (double)pulser_time[0];
-							if( tmp_tdiff > 1e4 ) tmp_tdiff = (double)pulser_prev[i] - (double)pulser_time[0];
-							else if( tmp_tdiff < -1e4 ) tmp_tdiff = (double)pulser_time[i] - (double)pulser_prev[0];
+					// Pulser item
+					case MiniballSettings::DET_PULSER: {
+						
+						unsigned int pulserID = chan.id[0];
+						pulser_time[pulserID] = mytime;
+						pulser_T = (double)pulser_time[pulserID] - (double)pulser_prev[pulserID];
+						pulser_f = 1e9 / pulser_T;
+						if( pulserID == 0 && pulser_prev[pulserID] != 0 ) {
+							pulser_period->Fill( pulser_T );
+							pulser_freq->Fill( pulser_time[pulserID], pulser_f );
+						}
+						
+						if( pulserID == 0 ) {
 							
-							pulser_tdiff->Fill( i, tmp_tdiff );
+							for( unsigned int i = 1; i < set->GetNumberOfPulsers(); i++ ) {
+								
+								// If diff is greater than 5 ms, we have the wrong pair
+								double tmp_tdiff = (double)pulser_time[i] - (double)pulser_time[0];
+								if( tmp_tdiff > 1e4 ) tmp_tdiff = (double)pulser_prev[i] - (double)pulser_time[0];
+								else if( tmp_tdiff < -1e4 ) tmp_tdiff = (double)pulser_time[i] - (double)pulser_prev[0];
+								
+								pulser_tdiff->Fill( i, tmp_tdiff );
+								
+							}
 							
 						}
 						
-					}
+						pulser_prev[pulserID] = pulser_time[pulserID];
+						n_pulser[pulserID]++;
+						break;
+						
+					} // pulser code
 					
-					pulser_prev[pulserID] = pulser_time[pulserID];
-					n_pulser[pulserID]++;
+					default:
+						break;
 						
-				} // pulser code
+				} // switch on detector type
 
 
 			} // process febex data
@@ -1794,7 +1874,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 		else if( in_data->IsDgf() ) {
 			
 			// Get the data
-			dgf_data = in_data->GetDgfData();
+			dgf_data = &in_data->GetDgfDataRef();
 			mydgf = dgf_data->GetModule();
 			mych = dgf_data->GetChannel();
 			
@@ -1802,7 +1882,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			if( overwrite_cal ) {
 				
 				unsigned int adc_tmp_value = dgf_data->GetQshort();
-				myenergy = cal->DgfEnergy( mydgf, mych, adc_tmp_value );
+				myenergy = cal->DgfEnergy( mydgf, mych, adc_tmp_value, i );
 				
 				if( adc_tmp_value > cal->DgfThreshold( mydgf, mych ) )
 					mythres = true;
@@ -1824,34 +1904,43 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			n_dgf_data++;
 			n_dgf[mydgf]++;
 			
-			// Is it a gamma ray from Miniball?
-			if( set->IsMiniball( mydgf, mych ) && mythres ) {
-				
-				// Increment counts and open the event
-				n_miniball++;
-				hit_ctr++;
-				event_open = true;
-				
-				mb_en_list.push_back( myenergy );
-				mb_ts_list.push_back( mytime );
-				mb_clu_list.push_back( set->GetMiniballCluster( mydgf, mych ) );
-				mb_cry_list.push_back( set->GetMiniballCrystal( mydgf, mych ) );
-				mb_seg_list.push_back( set->GetMiniballSegment( mydgf, mych ) );
-				
-			}
+			// What is plugged into this channel?
+			const MiniballChannelID &chan = set->GetDgfChannelID( mydgf, mych );
 			
-			// Is it a gamma ray from the beam dump?
-			else if( set->IsBeamDump( mydgf, mych ) && mythres ) {
-				
-				// Increment counts but do not open the event
-				n_bd++;
-				hit_ctr++;
+			if( mythres ) switch( chan.type ) {
 				
-				bd_en_list.push_back( myenergy );
-				bd_ts_list.push_back( mytime );
-				bd_det_list.push_back( set->GetBeamDumpDetector( mydgf, mych ) );
-				
-			}
+				// Is it a gamma ray from Miniball?
+				case MiniballSettings::DET_MINIBALL:
+					
+					// Increment counts and open the event
+					n_miniball++;
+					hit_ctr++;
+					event_open = true;
+					
+					mb_en_list.push_back( myenergy );
+					mb_ts_list.push_back( mytime );
+					mb_clu_list.push_back( chan.id[0] );
+					mb_cry_list.push_back( chan.id[1] );
+					mb_seg_list.push_back( chan.id[2] );
+					BucketMiniballHit( chan );
+					break;
+					
+				// Is it a gamma ray from the beam dump?
+				case MiniballSettings::DET_BEAMDUMP:
+					
+					// Increment counts but do not open the event
+					n_bd++;
+					hit_ctr++;
+					
+					bd_en_list.push_back( myenergy );
+					bd_ts_list.push_back( mytime );
+					bd_det_list.push_back( chan.id[0] );
+					break;
+					
+				default:
+					break;
+					
+			} // switch on detector type
 			
 		}
 		
@@ -1862,7 +1951,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 		if( in_data->IsAdc() ) {
 			
 			// Get the data
-			adc_data = in_data->GetAdcData();
+			adc_data = &in_data->GetAdcDataRef();
 			myadc = adc_data->GetModule();
 			mych = adc_data->GetChannel();
 			myclipped = adc_data->IsClipped();
@@ -1871,7 +1960,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			if( overwrite_cal ) {
 				
 				unsigned int adc_tmp_value = adc_data->GetQshort();
-				myenergy = cal->AdcEnergy( myadc, mych, adc_tmp_value );
+				myenergy = cal->AdcEnergy( myadc, mych, adc_tmp_value, i );
 				
 				if( adc_tmp_value > cal->AdcThreshold( myadc, mych ) )
 					mythres = true;
@@ -1893,63 +1982,71 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			n_adc_data++;
 			n_adc[myadc]++;
 			
-			// Is it a particle from the CD?
-			if( set->IsCD( myadc, mych ) && mythres ) {
-				
-				// Increment counts and open the event
-				n_cd++;
-				hit_ctr++;
-				
-				if( !myclipped || !set->GetClippedRejection() ) {
-
-					event_open = true;
-					cd_en_list.push_back( myenergy );
-					cd_ts_list.push_back( mytime );
-					cd_det_list.push_back( set->GetCDDetector( myadc, mych ) );
-					cd_sec_list.push_back( set->GetCDSector( myadc, mych ) );
-					cd_side_list.push_back( set->GetCDSide( myadc, mych ) );
-					cd_strip_list.push_back( set->GetCDStrip( myadc, mych ) );
-					
-				}
-				
-			}
+			// What is plugged into this channel?
+			const MiniballChannelID &chan = set->GetAdcChannelID( myadc, mych );
+			bool accept = !myclipped || !set->GetClippedRejection();
 			
-			// Is it a particle from the Pad?
-			else if( set->IsPad( myadc, mych ) && mythres ) {
-				
-				// Increment counts and open the event
-				n_pad++;
-				hit_ctr++;
+			if( mythres ) switch( chan.type ) {
 				
-				if( !myclipped || !set->GetClippedRejection() ) {
-
-					event_open = true;
-					pad_en_list.push_back( myenergy );
-					pad_ts_list.push_back( mytime );
-					pad_det_list.push_back( set->GetPadDetector( myadc, mych ) );
-					pad_sec_list.push_back( set->GetPadSector( myadc, mych ) );
+				// Is it a particle from the CD?
+				case MiniballSettings::DET_CD:
+					
+					// Increment counts and open the event
+					n_cd++;
+					hit_ctr++;
+					
+					if( accept ) {
+						
+						event_open = true;
+						cd_en_list.push_back( myenergy );
+						cd_ts_list.push_back( mytime );
+						cd_det_list.push_back( chan.id[0] );
+						cd_sec_list.push_back( chan.id[1] );
+						cd_side_list.push_back( chan.id[2] );
+						cd_strip_list.push_back( chan.id[3] );
+						BucketCDHit( chan );
+						
+					}
+					break;
+					
+				// Is it a particle from the Pad?
+				case MiniballSettings::DET_PAD:
+					
+					// Increment counts and open the event
+					n_pad++;
+					hit_ctr++;
+					
+					if( accept ) {
+						
+						event_open = true;
+						pad_en_list.push_back( myenergy );
+						pad_ts_list.push_back( mytime );
+						pad_det_list.push_back( chan.id[0] );
+						pad_sec_list.push_back( chan.id[1] );
+						
+					}
+					break;
+					
+				// Is it an IonChamber event
+				case MiniballSettings::DET_IONCHAMBER:
+					
+					// Clipped IonChamber hits are never used
+					if( myclipped ) break;
+					
+					// Increment counts and open the event
+					n_ic++;
+					hit_ctr++;
 					
-				}
-				
-			}
-			
-			// Is it an IonChamber event
-			else if( set->IsIonChamber( myadc, mych ) && mythres && !myclipped ) {
-				
-				// Increment counts and open the event
-				n_ic++;
-				hit_ctr++;
-				
-				if( !myclipped || !set->GetClippedRejection() ) {
-
 					event_open = true;
 					ic_en_list.push_back( myenergy );
 					ic_ts_list.push_back( mytime );
-					ic_id_list.push_back( set->GetIonChamberLayer( myadc, mych ) );
+					ic_id_list.push_back( chan.id[0] );
+					break;
 					
-				}
-				
-			}
+				default:
+					break;
+					
+			} // switch on detector type
 			
 		}
 		
@@ -1963,7 +2060,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			// Increment event counter
 			n_info_data++;
 			
-			info_data = in_data->GetInfoData();
+			info_data = &in_data->GetInfoDataRef();
 
 			// Update EBIS time
 			if( info_data->GetCode() == set->GetEBISCode() &&
@@ -2251,7 +2348,7 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 		//----------------------------
 		// if close this event or last entry
 		//----------------------------
-		if( flag_close_event || (i+1) == n_entries ) {
+		if( flag_close_event || (i+1) == last ) {
 
 			// If we opened the event, then sort it out
 			if( event_open ) {
@@ -2295,6 +2392,14 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 			
 		} // if close event && hit_ctr > 0
 		
+		// The main thread shows the progress of all the chunks
+		if( nbuilt != nullptr ) {
+			
+			nbuilt->fetch_add( 1, std::memory_order_relaxed );
+			continue;
+			
+		}
+		
 		// Progress bar
 		bool update_progress = false;
 		if( n_entries < 200 )
@@ -2322,7 +2427,455 @@ unsigned long MiniballEventBuilder::BuildEvents() {
 
 		}		
 		
-	} // End of main loop over TTree to process raw FEBEX data entries (for n_entries)
+	} // End of main loop over TTree to process raw FEBEX data entries (for first to last)
+
+	return;
+
+}
+
+void MiniballEventBuilder::PrescanEntry( unsigned long i ) {
+
+	/// Follow only the things that carry on from one event to the next for
+	/// the current entry: the EBIS, T1, SuperCycle, laser and pulser times,
+	/// the sync and pause/resume state and the last timestamp in each FEBEX
+	/// channel. It has to do the same as BuildRange does with them.
+
+	// FEBEX pulsers and repeated timestamps
+	if( in_data->IsFebex() ) {
+
+		const FebexData &febex = in_data->GetFebexDataRef();
+		unsigned char sfp = febex.GetSfp();
+		unsigned char board = febex.GetBoard();
+		unsigned char ch = febex.GetChannel();
+		if( sfp >= set->GetNumberOfFebexSfps() ||
+		    board >= set->GetNumberOfFebexBoards() ||
+		    ch >= set->GetNumberOfFebexChannels() ) return;
+
+		const MiniballChannelID &chan = set->GetFebexChannelID( sfp, board, ch );
+		if( chan.type == MiniballSettings::DET_PULSER &&
+		    mytime != febex_time_ch[sfp][board][ch] ) {
+
+			// Same threshold as the main loop
+			float energy;
+			bool thres;
+			if( overwrite_cal && !febex.IsRecovered() ) {
+
+				const FebexChannelCal &fcal = cal->GetFebexCal( sfp, board, ch );
+				unsigned int adc_tmp_value;
+				if( fcal.type == MiniballCalibration::FEBEX_QINT )
+					adc_tmp_value = febex.GetQint();
+				else adc_tmp_value = febex.GetQshort();
+
+				energy = cal->FebexEnergy( fcal, adc_tmp_value, i );
+				thres = adc_tmp_value > fcal.threshold;
+
+			}
+
+			else {
+
+				energy = febex.GetEnergy();
+				thres = febex.IsOverThreshold();
+
+			}
+
+			if( thres && energy >= 0.0 ) {
+
+				pulser_time[chan.id[0]] = mytime;
+				pulser_prev[chan.id[0]] = mytime;
+
+			}
+
+		}
+
+		febex_time_ch[sfp][board][ch] = mytime;
+
+	}
+
+	// Info events
+	else if( in_data->IsInfo() ) {
+
+		const InfoData &info = in_data->GetInfoDataRef();
+		unsigned long long info_time = info.GetTime();
+		if( set->GetMbsEventMode() ) info_time += myeventtime;
+
+		// EBIS, T1, SuperCycle and laser
+		if( info.GetCode() == set->GetEBISCode() &&
+			TMath::Abs( (double)ebis_time - (double)info.GetTime() ) > 1e3 ) {
+			ebis_time = info_time;
+			ebis_prev = info_time;
+		}
+		if( info.GetCode() == set->GetT1Code() &&
+			TMath::Abs( (double)t1_time - (double)info.GetTime() ) > 1e3 ) {
+			t1_time = info_time;
+			t1_prev = info_time;
+		}
+		if( info.GetCode() == set->GetSCCode() &&
+			TMath::Abs( (double)sc_time - (double)info.GetTime() ) > 1e3 ) {
+			sc_time = info_time;
+			sc_prev = info_time;
+		}
+		if( info.GetCode() == set->GetRILISCode() &&
+			TMath::Abs( (double)laser_time - (double)info.GetTime() ) > 1e3 )
+			laser_time = info_time;
+
+		// Pulsers
+		if( info.GetCode() >= set->GetPulserCode() &&
+		    info.GetCode() < set->GetPulserCode() + set->GetNumberOfPulsers() ) {
+			unsigned int pulserID = info.GetCode() - set->GetPulserCode();
+			pulser_time[pulserID] = info_time;
+			pulser_prev[pulserID] = info_time;
+		}
+
+		// Sync, pause and resume of each module
+		if( info.GetSfp() < set->GetNumberOfFebexSfps() &&
+		    info.GetBoard() < set->GetNumberOfFebexBoards() ) {
+
+			if( info.GetCode() == set->GetMsbSyncCode() )
+				sync_time[info.GetSfp()][info.GetBoard()] = info.GetTime();
+
+			if( info.GetCode() == set->GetPauseCode() ) {
+				flag_pause[info.GetSfp()][info.GetBoard()] = true;
+				pause_time[info.GetSfp()][info.GetBoard()] = info.GetTime();
+			}
+
+			if( info.GetCode() == set->GetResumeCode() ) {
+				flag_resume[info.GetSfp()][info.GetBoard()] = true;
+				resume_time[info.GetSfp()][info.GetBoard()] = info.GetTime();
+			}
+
+		}
+
+	}
+
+	return;
+
+}
+
+void MiniballEventBuilder::BuildParallel() {
+
+	/// Split the input into chunks and build each one on its own thread,
+	/// with its own copy of the input and a temporary output file. A chunk
+	/// can only start where the event before it is sure to be closed, which
+	/// is at a new MBS event or after a gap longer than the build window.
+	/// The main thread scans the timestamps to find those places, starts
+	/// each chunk as soon as its end is known, and then adds them back
+	/// together in order. The things that carry on between events, like
+	/// the EBIS and pulser times, are followed by the scan and given to
+	/// each chunk at its start.
+
+	// ROOT has to know there are files open in several threads
+	ROOT::EnableThreadSafety();
+
+	std::vector<std::unique_ptr<MiniballEventBuilder>> chunks;
+	std::vector<unsigned long> chunk_start;
+	std::vector<std::thread> threads;
+	std::atomic<unsigned long> nbuilt_all( 0 );
+
+	std::string part_name = output_file->GetName();
+	part_name = part_name.substr( 0, part_name.find_last_of(".") ) + "_part";
+
+	// Make the builder for the chunk starting at entry i,
+	// returns false if we can't open the input again for it
+	auto make_chunk = [&]( unsigned long i ) {
+
+		// Its own copy of the input and output, but no log file
+		TFile *chunk_file = new TFile( input_name.data(), "read" );
+		TTree *chunk_tree = nullptr, *chunk_info = nullptr;
+		if( !chunk_file->IsZombie() ) {
+			chunk_tree = (TTree*)chunk_file->Get("mb_sort");
+			chunk_info = (TTree*)chunk_file->Get("mbsinfo");
+		}
+		if( chunk_tree == nullptr || chunk_info == nullptr ) {
+
+			std::cerr << "Cannot open " << input_name << " again to build events in parallel" << std::endl;
+			delete chunk_file;
+			output_file->cd();
+			return false;
+
+		}
+
+		auto chunk = std::make_unique<MiniballEventBuilder>( set );
+		if( overwrite_cal ) chunk->AddCalibration( cal );
+		chunk->input_file = chunk_file;
+		chunk->SetInputTree( chunk_tree );
+		chunk->SetMBSInfoTree( chunk_info );
+		chunk->StartFile();
+		chunk->n_entries = n_entries;
+		chunk->n_mbs_entries = n_mbs_entries;
+		chunk->OpenOutput( part_name + std::to_string( chunks.size() ) + ".root" );
+		chunk->Initialise();
+		chunk->nbuilt = &nbuilt_all;
+
+		// Carry on from the entries before
+		chunk->ebis_time = ebis_time;
+		chunk->ebis_prev = ebis_prev;
+		chunk->t1_time = t1_time;
+		chunk->t1_prev = t1_prev;
+		chunk->sc_time = sc_time;
+		chunk->sc_prev = sc_prev;
+		chunk->laser_time = laser_time;
+		chunk->pulser_time = pulser_time;
+		chunk->pulser_prev = pulser_prev;
+		chunk->sync_time = sync_time;
+		chunk->pause_time = pause_time;
+		chunk->resume_time = resume_time;
+		chunk->flag_pause = flag_pause;
+		chunk->flag_resume = flag_resume;
+		chunk->febex_time_ch = febex_time_ch;
+		chunk->myeventtime = myeventtime;
+		chunk->preveventid = preveventid;
+		chunk->time_prev = time_prev;
+
+		chunks.push_back( std::move( chunk ) );
+		chunk_start.push_back( i );
+		output_file->cd();
+		return true;
+
+	};
+
+	// Start building chunk k, now we know it ends at entry i
+	auto start_chunk = [&]( unsigned int k, unsigned long i ) {
+
+		MiniballEventBuilder *chunk = chunks[k].get();
+		unsigned long first = chunk_start[k];
+		threads.emplace_back( [chunk,first,i]{ chunk->BuildRange( first, i ); } );
+
+	};
+
+	// Progress of all the threads together
+	auto show_progress = [&]() {
+
+		float percent = (float)nbuilt_all.load()*100.0/(float)n_entries;
+
+		if( _prog_ ) {
+
+			prog->SetPosition( percent );
+			gSystem->ProcessEvents();
+
+		}
+
+		std::cout << " " << std::setw(6) << std::setprecision(4);
+		std::cout << percent << "%    \r";
+		std::cout.flush();
+
+	};
+
+	// Scan the input for places to start a new chunk
+	unsigned long long time_last = 0; // latest timestamp so far
+	if( !make_chunk( 0 ) ) {
+
+		std::cerr << "Building events in one thread instead" << std::endl;
+		BuildRange( 0, n_entries );
+		return;
+
+	}
+	for( unsigned long i = 0; i < n_entries && chunks.size() < nthreads; ++i ) {
+
+		input_tree->GetEntry(i);
+		if( i > 0 ) preveventid = myeventid;
+		myeventid = in_data->GetEventID();
+
+		// Trigger time of the MBS event, found as in the main loop
+		if( i == 0 ) myeventtime = in_data->GetTime();
+		if( i == 0 || myeventid != preveventid ) {
+
+			if( mbsinfo_tree->GetEntryWithIndex( myeventid ) < 0 &&
+			    n_mbs_entries > 0 ) {
+
+				for( unsigned long j = 0; j < n_mbs_entries; ++j ){
+
+					mbsinfo_tree->GetEntry(j);
+					if( mbs_info->GetEventID() == myeventid ) {
+						myeventtime = mbs_info->GetTime();
+						break;
+					}
+
+				}
+
+			}
+
+			else if( i > 0 ) myeventtime = mbs_info->GetTime();
+
+		}
+
+		if( set->GetMbsEventMode() )
+			mytime = myeventtime + in_data->GetTime();
+		else mytime = in_data->GetTime();
+
+		// Start a new chunk if this one is long enough and we're sure
+		// that the event before is closed
+		if( i >= chunks.size() * n_entries / nthreads &&
+		    ( myeventid != preveventid ||
+		      ( mytime > time_last && mytime - time_last > (unsigned long long)build_window ) ) ) {
+
+			// If we can't make another, the last one goes to the end
+			if( !make_chunk( i ) ) break;
+			start_chunk( chunks.size() - 2, i );
+
+		}
+
+		// Follow the things that carry on to the next event
+		PrescanEntry( i );
+		time_prev = mytime;
+		if( mytime > time_last ) time_last = mytime;
+
+		if( i % (n_entries/100) == 0 ) show_progress();
+
+	}
+
+	// The last chunk goes to the end
+	start_chunk( chunks.size() - 1, n_entries );
+
+	// Wait for them to finish
+	while( nbuilt_all.load() < n_entries ) {
+
+		show_progress();
+		std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+
+	}
+	show_progress();
+
+	for( unsigned int k = 0; k < threads.size(); ++k )
+		threads[k].join();
+
+	// Put them back together in order
+	for( unsigned int k = 0; k < chunks.size(); ++k )
+		AddChunk( *chunks[k] );
+
+	return;
+
+}
+
+void MiniballEventBuilder::AddChunk( MiniballEventBuilder &chunk ) {
+
+	/// Add the events, histograms and counters of a chunk that was built
+	/// in another thread to our own, then delete its temporary file
+
+	// Events into our tree in the same order
+	MiniballEvts *evts = write_evts.get();
+	chunk.output_tree->SetBranchAddress( "MiniballEvts", &evts );
+	for( long long j = 0; j < chunk.output_tree->GetEntries(); ++j ) {
+
+		chunk.output_tree->GetEntry(j);
+		output_tree->Fill();
+
+	}
+	chunk.output_tree->ResetBranchAddresses();
+
+	// Histograms are made in the same order in both lists
+	TIter next( histlist->MakeIterator() );
+	TIter next_chunk( chunk.histlist->MakeIterator() );
+	while( TObject *obj = next() )
+		( (TH1*)obj )->Add( (TH1*)next_chunk() );
+
+	// Counters
+	n_febex_data	+= chunk.n_febex_data;
+	n_info_data		+= chunk.n_info_data;
+	n_dgf_data		+= chunk.n_dgf_data;
+	n_adc_data		+= chunk.n_adc_data;
+
+	n_ebis			+= chunk.n_ebis;
+	n_rilis			+= chunk.n_rilis;
+	n_t1			+= chunk.n_t1;
+	n_sc			+= chunk.n_sc;
+
+	n_miniball		+= chunk.n_miniball;
+	n_cd			+= chunk.n_cd;
+	n_pad			+= chunk.n_pad;
+	n_bd			+= chunk.n_bd;
+	n_spede			+= chunk.n_spede;
+	n_ic			+= chunk.n_ic;
+
+	gamma_ctr		+= chunk.gamma_ctr;
+	gamma_ab_ctr	+= chunk.gamma_ab_ctr;
+	cd_ctr			+= chunk.cd_ctr;
+	bd_ctr			+= chunk.bd_ctr;
+	spede_ctr		+= chunk.spede_ctr;
+	ic_ctr			+= chunk.ic_ctr;
+
+	repeat_ctr		+= chunk.repeat_ctr;
+
+	for( unsigned int i = 0; i < set->GetNumberOfPulsers(); ++i )
+		n_pulser[i] += chunk.n_pulser[i];
+
+	for( unsigned int i = 0; i < set->GetNumberOfFebexSfps(); ++i ) {
+
+		n_sfp[i] += chunk.n_sfp[i];
+
+		for( unsigned int j = 0; j < set->GetNumberOfFebexBoards(); ++j ) {
+
+			n_board[i][j] += chunk.n_board[i][j];
+			n_sync[i][j] += chunk.n_sync[i][j];
+			n_pause[i][j] += chunk.n_pause[i][j];
+			n_resume[i][j] += chunk.n_resume[i][j];
+			febex_dead_time[i][j] += chunk.febex_dead_time[i][j];
+
+			// Start in the first chunk with data and stop in the last
+			if( febex_time_start[i][j] == 0 )
+				febex_time_start[i][j] = chunk.febex_time_start[i][j];
+			if( chunk.febex_time_stop[i][j] != 0 )
+				febex_time_stop[i][j] = chunk.febex_time_stop[i][j];
+
+		}
+
+	}
+
+	for( unsigned int i = 0; i < set->GetNumberOfAdcModules(); ++i )
+		n_adc[i] += chunk.n_adc[i];
+
+	for( unsigned int i = 0; i < set->GetNumberOfDgfModules(); ++i )
+		n_dgf[i] += chunk.n_dgf[i];
+
+	// Close the chunk's files and get rid of the temporary one
+	std::string chunk_name = chunk.output_file->GetName();
+	chunk.output_file->Close();
+	delete chunk.output_file;
+	gSystem->Unlink( chunk_name.data() );
+
+	chunk.input_tree->ResetBranchAddresses();
+	chunk.mbsinfo_tree->ResetBranchAddresses();
+	chunk.input_file->Close();
+	delete chunk.input_file;
+	delete chunk.in_data;
+	delete chunk.mbs_info;
+
+	output_file->cd();
+
+	return;
+
+}
+
+unsigned long MiniballEventBuilder::BuildEvents() {
+	
+	/// Function to loop over the sort tree and build array and recoil events
+
+	// Load the full tree if possible
+	//output_tree->SetMaxVirtualSize(1.0e9);	// 1.0 GB
+	//input_tree->SetMaxVirtualSize(2.2e9); 	// 2.2 GB
+	//input_tree->LoadBaskets(2.0e9); 		// Load 2.0 GB of data to memory
+
+	if( input_tree->LoadTree(0) < 0 ){
+		
+		std::cout << " Event Building: nothing to do" << std::endl;
+		return 0;
+		
+	}
+	
+	// Get ready and go
+	Initialise();
+	n_entries = input_tree->GetEntries();
+	n_mbs_entries = mbsinfo_tree->GetEntries();
+
+	std::cout << " Event Building: number of entries in input tree = ";
+	std::cout << n_entries << std::endl;
+
+	std::cout << "\tnumber of MBS Events/triggers in input tree = ";
+	std::cout << n_mbs_entries << std::endl;
+	
+	// Build the events in one go, or in chunks on separate threads
+	if( nthreads > 1 && flag_input_file && n_entries > 100 * nthreads )
+		BuildParallel();
+	else BuildRange( 0, n_entries );
 	
 	//--------------------------
 	// Clean up
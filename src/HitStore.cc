@@ -0,0 +1,408 @@
+#include "HitStore.hh"
+
+MiniballHitStore::MiniballHitStore() {
+
+	nhits = 0;
+	nsamples = 0;
+	run_lookup.resize( 4 << 16, -1 );
+
+	febex_hit = std::make_shared<FebexData>();
+	info_hit = std::make_shared<InfoData>();
+	dgf_hit = std::make_shared<DgfData>();
+	adc_hit = std::make_shared<AdcData>();
+
+}
+
+void MiniballHitStore::Clear() {
+
+	// Give the memory back, not just reset the counters
+	std::vector<std::unique_ptr<MiniballHit[]>>().swap(chunks);
+	std::vector<std::unique_ptr<unsigned short[]>>().swap(trace_chunks);
+	nhits = 0;
+	nsamples = 0;
+
+	// Forget the runs too
+	std::vector<MiniballHitRun>().swap(runs);
+	std::fill( run_lookup.begin(), run_lookup.end(), -1 );
+
+	return;
+
+}
+
+void MiniballHitStore::Reset() {
+
+	// Keep the chunks so they can be used again without
+	// going back to the allocator, just start from the beginning
+	nhits = 0;
+	nsamples = 0;
+	runs.clear();
+	std::fill( run_lookup.begin(), run_lookup.end(), -1 );
+
+	return;
+
+}
+
+void MiniballHitStore::Swap( MiniballHitStore &other ) {
+
+	chunks.swap( other.chunks );
+	trace_chunks.swap( other.trace_chunks );
+	std::swap( nhits, other.nhits );
+	std::swap( nsamples, other.nsamples );
+	runs.swap( other.runs );
+	run_lookup.swap( other.run_lookup );
+
+	return;
+
+}
+
+MiniballHit& MiniballHitStore::NewHit() {
+
+	// Start a new chunk if this one is full, unless
+	// we already have one left over from before a Reset()
+	unsigned long chunk = nhits >> HIT_CHUNK_BITS;
+	if( chunk >= chunks.size() )
+		chunks.push_back( std::unique_ptr<MiniballHit[]>( new MiniballHit[HIT_CHUNK_SIZE] ) );
+
+	MiniballHit &hit = chunks[chunk][ nhits & ( HIT_CHUNK_SIZE - 1 ) ];
+	nhits++;
+
+	// Start from a clean record
+	hit = MiniballHit();
+
+	return hit;
+
+}
+
+void MiniballHitStore::AddToRun( MiniballHit &hit ) {
+
+	// Find the run for this source, or start a new one
+	unsigned int key = ( hit.type << 16 ) | ( hit.sfp << 8 ) | hit.board;
+	if( run_lookup[key] < 0 ) {
+
+		MiniballHitRun new_run;
+		new_run.last_time = hit.time;
+		new_run.nhits = 0;
+		new_run.ordered = true;
+		run_lookup[key] = runs.size();
+		runs.push_back( new_run );
+
+	}
+
+	// Check that it is still in order
+	MiniballHitRun &run = runs[ run_lookup[key] ];
+	if( hit.time < run.last_time ) run.ordered = false;
+	run.last_time = hit.time;
+	run.nhits++;
+	hit.run = run_lookup[key];
+
+	return;
+
+}
+
+unsigned short* MiniballHitStore::NewSamples( unsigned long n, unsigned long &offset ) {
+
+	// A trace never goes across two chunks, so skip to the next
+	// chunk if there isn't enough space left in this one
+	unsigned long pos = nsamples & ( TRACE_CHUNK_SIZE - 1 );
+	if( pos + n > TRACE_CHUNK_SIZE ) nsamples += TRACE_CHUNK_SIZE - pos;
+
+	// Get a new chunk unless we have one left over from before a Reset()
+	unsigned long chunk = nsamples >> TRACE_CHUNK_BITS;
+	if( chunk >= trace_chunks.size() )
+		trace_chunks.push_back( std::unique_ptr<unsigned short[]>( new unsigned short[TRACE_CHUNK_SIZE] ) );
+
+	offset = nsamples;
+	nsamples += n;
+
+	return trace_chunks[chunk].get() + ( offset & ( TRACE_CHUNK_SIZE - 1 ) );
+
+}
+
+unsigned long MiniballHitStore::AddSamples( const unsigned short *s1, unsigned long n1,
+										    const unsigned short *s2, unsigned long n2 ) {
+
+	// Nothing to store
+	unsigned long n = n1 + n2;
+	if( n == 0 ) return nsamples;
+
+	unsigned long offset;
+	unsigned short *dest = NewSamples( n, offset );
+	std::copy( s1, s1 + n1, dest );
+	std::copy( s2, s2 + n2, dest + n1 );
+
+	return offset;
+
+}
+
+unsigned short MiniballHitStore::FitLength( std::size_t n, const char *what ) {
+
+	// Keep the start of anything that's too long, but say so
+	if( n > MAX_TRACE_LENGTH ) {
+
+		std::cerr << "MiniballHitStore: " << what << " has " << n;
+		std::cerr << " samples, only keeping the first " << MAX_TRACE_LENGTH << std::endl;
+		return MAX_TRACE_LENGTH;
+
+	}
+
+	return n;
+
+}
+
+void MiniballHitStore::Add( std::shared_ptr<FebexData> data ) {
+
+	MiniballHit &hit = NewHit();
+	hit.type = HIT_FEBEX;
+	hit.time = data->GetTime();
+	hit.eventid = data->GetEventID();
+	hit.energy = data->GetEnergy();
+	hit.Qint = data->GetQint();
+	hit.Qshort = data->GetQshort();
+	hit.sfp = data->GetSfp();
+	hit.board = data->GetBoard();
+	hit.ch = data->GetChannel();
+	if( data->IsOverThreshold() )	hit.flags |= FLAG_THRES;
+	if( data->IsPileup() )			hit.flags |= FLAG_PILEUP;
+	if( data->IsClipped() )			hit.flags |= FLAG_CLIPPED;
+	if( data->HasFlag() )			hit.flags |= FLAG_BIT;
+	if( data->IsRecovered() )		hit.flags |= FLAG_RECOVERED;
+	AddToRun( hit );
+
+	// Traces go in the pool, copied straight from the packet
+	const std::vector<unsigned short> &trace = data->GetTrace();
+	if( trace.size() ) {
+		hit.trace_length = FitLength( trace.size(), "FEBEX trace" );
+		hit.trace_offset = AddSamples( trace.data(), hit.trace_length, nullptr, 0 );
+	}
+
+	return;
+
+}
+
+void MiniballHitStore::Add( std::shared_ptr<InfoData> data ) {
+
+	MiniballHit &hit = NewHit();
+	hit.type = HIT_INFO;
+	hit.time = data->GetTime();
+	hit.eventid = data->GetEventID();
+	hit.sfp = data->GetSfp();
+	hit.board = data->GetBoard();
+	hit.ch = data->GetCode();
+	AddToRun( hit );
+
+	return;
+
+}
+
+void MiniballHitStore::Add( std::shared_ptr<DgfData> data ) {
+
+	MiniballHit &hit = NewHit();
+	hit.type = HIT_DGF;
+	hit.time = data->GetLongFastTriggerTime();
+	hit.eventid = data->GetEventID();
+	hit.event_time = data->GetEventTime();
+	hit.run_time = data->GetRunTime();
+	hit.fast_time = data->GetFastTriggerTime();
+	hit.hit_pattern = data->GetHitPattern();
+	hit.energy = data->GetEnergy();
+	hit.Qshort = data->GetQshort();
+	hit.sfp = data->GetModule();
+	hit.ch = data->GetChannel();
+	if( data->IsOverThreshold() ) hit.flags |= FLAG_THRES;
+	AddToRun( hit );
+
+	// Trace and user values both go in the pool, copied straight from the packet
+	const std::vector<unsigned short> &trace = data->GetTrace();
+	const std::vector<unsigned short> &user = data->GetUserValues();
+	hit.trace_length = FitLength( trace.size(), "DGF trace" );
+	hit.user_length = FitLength( user.size(), "DGF user values" );
+	hit.trace_offset = AddSamples( trace.data(), hit.trace_length,
+								   user.data(), hit.user_length );
+
+	return;
+
+}
+
+void MiniballHitStore::Add( std::shared_ptr<AdcData> data ) {
+
+	MiniballHit &hit = NewHit();
+	hit.type = HIT_ADC;
+	hit.time = data->GetTime();
+	hit.eventid = data->GetEventID();
+	hit.energy = data->GetEnergy();
+	hit.Qshort = data->GetQshort();
+	hit.sfp = data->GetModule();
+	hit.ch = data->GetChannel();
+	if( data->IsOverThreshold() )	hit.flags |= FLAG_THRES;
+	if( data->IsClipped() )			hit.flags |= FLAG_CLIPPED;
+	AddToRun( hit );
+
+	return;
+
+}
+
+void MiniballHitStore::AddHit( const MiniballHitStore &from, unsigned long i ) {
+
+	// Copy the record, but it has to go in a run in this store
+	MiniballHit &hit = NewHit();
+	hit = from.GetHit(i);
+	AddToRun( hit );
+
+	// And the samples need to move to our own pool
+	unsigned long n = hit.trace_length + hit.user_length;
+	if( n ) {
+		const unsigned short *samples = from.GetSamples( hit.trace_offset );
+		std::copy( samples, samples + n, NewSamples( n, hit.trace_offset ) );
+	}
+
+	return;
+
+}
+
+void MiniballHitStore::FillPacket( unsigned long i, std::shared_ptr<MiniballDataPackets> packet,
+								   std::shared_ptr<MiniballTracePackets> trace_packet ) {
+
+	const MiniballHit &hit = GetHit(i);
+	const unsigned short *samples = nullptr;
+	if( hit.trace_length + hit.user_length )
+		samples = GetSamples( hit.trace_offset );
+
+	FillPacket( hit, samples, packet, trace_packet );
+
+	return;
+
+}
+
+void MiniballHitStore::FillPacket( const MiniballHit &hit, const unsigned short *samples,
+								   std::shared_ptr<MiniballDataPackets> packet,
+								   std::shared_ptr<MiniballTracePackets> trace_packet ) {
+
+	// Trace in its own packet, or left in the hit
+	bool trace_in_hit = ( trace_packet == nullptr );
+	if( !trace_in_hit ) {
+
+		trace_packet->ClearData();
+		if( hit.trace_length )
+			trace_packet->SetTrace( samples, hit.trace_length );
+
+	}
+
+	if( hit.type == HIT_FEBEX ) {
+
+		febex_hit->SetTime( hit.time );
+		febex_hit->SetEventID( hit.eventid );
+		febex_hit->SetEnergy( hit.energy );
+		febex_hit->SetQint( hit.Qint );
+		febex_hit->SetQshort( hit.Qshort );
+		febex_hit->SetSfp( hit.sfp );
+		febex_hit->SetBoard( hit.board );
+		febex_hit->SetChannel( hit.ch );
+		febex_hit->SetThreshold( hit.flags & FLAG_THRES );
+		febex_hit->SetPileup( hit.flags & FLAG_PILEUP );
+		febex_hit->SetClipped( hit.flags & FLAG_CLIPPED );
+		febex_hit->SetFlag( hit.flags & FLAG_BIT );
+		febex_hit->SetRecovered( hit.flags & FLAG_RECOVERED );
+		if( samples != nullptr && trace_in_hit )
+			febex_hit->SetTrace( samples, hit.trace_length );
+		else febex_hit->ClearTrace();
+
+		packet->SetData( febex_hit );
+
+	}
+
+	else if( hit.type == HIT_INFO ) {
+
+		info_hit->SetTime( hit.time );
+		info_hit->SetEventID( hit.eventid );
+		info_hit->SetSfp( hit.sfp );
+		info_hit->SetBoard( hit.board );
+		info_hit->SetCode( hit.ch );
+
+		packet->SetData( info_hit );
+
+	}
+
+	else if( hit.type == HIT_DGF ) {
+
+		dgf_hit->SetLongFastTriggerTime( hit.time );
+		dgf_hit->SetEventID( hit.eventid );
+		dgf_hit->SetEventTime( hit.event_time );
+		dgf_hit->SetRunTime( hit.run_time );
+		dgf_hit->SetFastTriggerTime( hit.fast_time );
+		dgf_hit->SetHitPattern( hit.hit_pattern );
+		dgf_hit->SetEnergy( hit.energy );
+		dgf_hit->SetQshort( hit.Qshort );
+		dgf_hit->SetModule( hit.sfp );
+		dgf_hit->SetChannel( hit.ch );
+		dgf_hit->SetThreshold( hit.flags & FLAG_THRES );
+		if( samples != nullptr ) {
+			if( trace_in_hit )
+				dgf_hit->SetTrace( samples, hit.trace_length );
+			else dgf_hit->SetTrace( samples, 0 );
+			dgf_hit->SetUserValues( samples + hit.trace_length, hit.user_length );
+		}
+		else {
+			dgf_hit->SetTrace( nullptr, 0 );
+			dgf_hit->SetUserValues( nullptr, 0 );
+		}
+
+		packet->SetData( dgf_hit );
+
+	}
+
+	else if( hit.type == HIT_ADC ) {
+
+		adc_hit->SetTime( hit.time );
+		adc_hit->SetEventID( hit.eventid );
+		adc_hit->SetEnergy( hit.energy );
+		adc_hit->SetQshort( hit.Qshort );
+		adc_hit->SetModule( hit.sfp );
+		adc_hit->SetChannel( hit.ch );
+		adc_hit->SetThreshold( hit.flags & FLAG_THRES );
+		adc_hit->SetClipped( hit.flags & FLAG_CLIPPED );
+
+		packet->SetData( adc_hit );
+
+	}
+
+	return;
+
+}
+
+bool MiniballHitStore::WriteHit( unsigned long i, FILE *fp ) const {
+
+	// The record goes first, then the samples straight after
+	const MiniballHit &hit = GetHit(i);
+	if( fwrite( &hit, sizeof(MiniballHit), 1, fp ) != 1 ) return false;
+
+	unsigned long n = hit.trace_length + hit.user_length;
+	if( n && fwrite( GetSamples( hit.trace_offset ), sizeof(unsigned short), n, fp ) != n )
+		return false;
+
+	return true;
+
+}
+
+bool MiniballHitStore::ReadHit( FILE *fp, MiniballHit &hit, std::vector<unsigned short> &samples ) {
+
+	// Nothing left in the file
+	if( fread( &hit, sizeof(MiniballHit), 1, fp ) != 1 ) return false;
+
+	unsigned long n = hit.trace_length + hit.user_length;
+	samples.resize( n );
+	if( n && fread( samples.data(), sizeof(unsigned short), n, fp ) != n )
+		return false;
+
+	return true;
+
+}
+
+unsigned long long int MiniballHitStore::GetMemoryUsage() const {
+
+	unsigned long long int mem = 0;
+	mem += chunks.size() * HIT_CHUNK_SIZE * sizeof(MiniballHit);
+	mem += trace_chunks.size() * TRACE_CHUNK_SIZE * sizeof(unsigned short);
+
+	return mem;
+
+}
@@ -0,0 +1,585 @@
+#include "MWDScanner.hh"
+
+MiniballMWDScanner::MiniballMWDScanner( std::shared_ptr<MiniballSettings> myset,
+									    std::shared_ptr<MiniballCalibration> mycal ){
+
+	// Settings and the calibration for everything that isn't scanned
+	set = myset;
+	cal = mycal;
+
+	// Same spectra as the mwd_optimisation.cc script by default
+	nbins = 65536;
+	emax = 65535.5;
+
+	nsamples_waiting = 0;
+	nthreads = 1;
+	output_file = nullptr;
+
+	// Lookup from the channel IDs, nothing seen yet (-1) or not scanned (-2)
+	channel_lookup.resize( set->GetNumberOfFebexSfps() *
+						   set->GetNumberOfFebexBoards() *
+						   set->GetNumberOfFebexChannels(), -1 );
+
+}
+
+// Values of a parameter in the grid file, either a list or low:high:step
+static std::vector<unsigned int> ReadScanValues( TEnv *config, std::string name ) {
+
+	std::vector<unsigned int> values;
+	std::stringstream ss( config->GetValue( name.data(), "" ) );
+	std::string token;
+
+	while( ss >> token ) {
+
+		unsigned int low, high, step;
+		if( std::sscanf( token.data(), "%u:%u:%u", &low, &high, &step ) == 3 ) {
+
+			if( step == 0 || high < low ) {
+
+				std::cerr << "Bad range " << token << " for " << name;
+				std::cerr << ", need low:high:step with low <= high and step > 0" << std::endl;
+				continue;
+
+			}
+
+			// Count in 64 bits so that we stop before wrapping around
+			for( unsigned long long v = low; v <= high; v += step )
+				values.push_back( v );
+
+		}
+
+		else {
+
+			try {
+
+				unsigned long v = std::stoul( token );
+				if( v > UINT_MAX ) throw std::out_of_range( token );
+				values.push_back( v );
+
+			}
+			catch( const std::exception & ) {
+
+				std::cerr << "Bad value " << token << " for " << name;
+				std::cerr << ", it must be a number or low:high:step" << std::endl;
+
+			}
+
+		}
+
+	}
+
+	return values;
+
+}
+
+bool MiniballMWDScanner::ReadGrid( std::string grid_file_name ) {
+
+	// Test if the file exists
+	std::ifstream ftest;
+	ftest.open( grid_file_name.data() );
+	if( !ftest.is_open() ) {
+
+		std::cerr << grid_file_name << " does not exist" << std::endl;
+		return false;
+
+	}
+	else ftest.close();
+
+	std::unique_ptr<TEnv> config = std::make_unique<TEnv>( grid_file_name.data() );
+
+	// Values to scan
+	scan_decay = ReadScanValues( config.get(), "MWD.DecayTime" );
+	scan_rise = ReadScanValues( config.get(), "MWD.RiseTime" );
+	scan_top = ReadScanValues( config.get(), "MWD.FlatTop" );
+	scan_window = ReadScanValues( config.get(), "MWD.Window" );
+
+	// A decay time of zero would divide by zero
+	for( unsigned int i = 0; i < scan_decay.size(); ++i ) {
+
+		if( scan_decay[i] == 0 ) {
+
+			std::cerr << "MWD.DecayTime of 0 is not allowed in the scan" << std::endl;
+			scan_decay.erase( scan_decay.begin() + i-- );
+
+		}
+
+	}
+
+	// Channels to scan, given as <sfp>_<board>_<ch>
+	std::stringstream ss( config->GetValue( "Channels", "" ) );
+	std::string token;
+	while( ss >> token ) scan_channels.push_back( token );
+
+	// Spectra
+	nbins = (unsigned int)config->GetValue( "Bins", (double)nbins );
+	emax = config->GetValue( "MaxEnergy", emax );
+
+	// Tell the user
+	std::cout << " MWD scan: " << scan_decay.size() << " decay times, ";
+	std::cout << scan_rise.size() << " rise times, " << scan_top.size() << " flat tops and ";
+	std::cout << scan_window.size() << " windows" << std::endl;
+	std::cout << "\t(none means the value from the calibration file)" << std::endl;
+
+	return true;
+
+}
+
+void MiniballMWDScanner::SetInputFile( std::vector<std::string> input_file_names ) {
+
+	input_names = input_file_names;
+	return;
+
+}
+
+void MiniballMWDScanner::SetOutput( std::string output_file_name ) {
+
+	// Create the output file, the histograms are made when the
+	// channels are found in the data
+	output_file = new TFile( output_file_name.data(), "recreate" );
+	return;
+
+}
+
+void MiniballMWDScanner::SetupChannel( unsigned char sfp, unsigned char board, unsigned char ch,
+									   MiniballMWDScanChannel &chan ) {
+
+	chan.sfp = sfp;
+	chan.board = board;
+	chan.ch = ch;
+
+	// Everything that isn't scanned comes from the calibration
+	chan.baseline = cal->GetMWDBaseline( sfp, board, ch );
+	chan.cfd_delay = cal->GetCFDDelay( sfp, board, ch );
+	chan.cfd_hold = cal->GetCFDHoldOff( sfp, board, ch );
+	chan.cfd_shaping = cal->GetCFDShapingTime( sfp, board, ch );
+	chan.cfd_integration = cal->GetCFDIntegrationTime( sfp, board, ch );
+	chan.threshold = cal->GetCFDThreshold( sfp, board, ch );
+
+	// Including the parameters that aren't in the grid file
+	std::vector<unsigned int> decay = scan_decay;
+	std::vector<unsigned int> rise = scan_rise;
+	std::vector<unsigned int> top = scan_top;
+	std::vector<unsigned int> window = scan_window;
+	if( !decay.size() ) decay.push_back( cal->GetMWDDecay( sfp, board, ch ) );
+	if( !rise.size() ) rise.push_back( cal->GetMWDRise( sfp, board, ch ) );
+	if( !top.size() ) top.push_back( cal->GetMWDFlatTop( sfp, board, ch ) );
+	if( !window.size() ) window.push_back( cal->GetMWDWindow( sfp, board, ch ) );
+
+	// All combinations, grouped by flat top so the triggers are shared
+	chan.grid.clear();
+	chan.tops = top;
+	for( unsigned int t = 0; t < top.size(); ++t )
+		for( unsigned int d = 0; d < decay.size(); ++d )
+			for( unsigned int r = 0; r < rise.size(); ++r )
+				for( unsigned int w = 0; w < window.size(); ++w )
+					chan.grid.push_back( { decay[d], rise[r], top[t], window[w] } );
+
+	return;
+
+}
+
+int MiniballMWDScanner::GetChannel( unsigned char sfp, unsigned char board, unsigned char ch ) {
+
+	// Check if it's a valid channel
+	if(   sfp >= set->GetNumberOfFebexSfps() ||
+	    board >= set->GetNumberOfFebexBoards() ||
+	       ch >= set->GetNumberOfFebexChannels() )
+		return -1;
+
+	unsigned int idx = ( sfp * set->GetNumberOfFebexBoards() + board );
+	idx = idx * set->GetNumberOfFebexChannels() + ch;
+	if( channel_lookup[idx] >= 0 ) return channel_lookup[idx];
+	else if( channel_lookup[idx] == -2 ) return -1;
+
+	// Is it one we want?
+	std::string name = std::to_string(sfp) + "_" + std::to_string(board);
+	name += "_" + std::to_string(ch);
+	if( scan_channels.size() &&
+	   std::find( scan_channels.begin(), scan_channels.end(), name ) == scan_channels.end() ) {
+
+		channel_lookup[idx] = -2;
+		return -1;
+
+	}
+
+	// New channel with its spectra
+	MiniballMWDScanChannel chan;
+	SetupChannel( sfp, board, ch, chan );
+
+	output_file->cd();
+	TDirectory *dir = output_file->mkdir( ( "febex_" + name ).data() );
+	dir->cd();
+	for( unsigned int g = 0; g < chan.grid.size(); ++g ) {
+
+		std::string hname = "mwd_" + name + "_" + std::to_string(g);
+		std::string htitle = "Moving window energy spectrum for SFP " + std::to_string(sfp);
+		htitle += ", board " + std::to_string(board) + ", channel " + std::to_string(ch);
+		htitle += " with decay = " + std::to_string( chan.grid[g].decay );
+		htitle += ", rise = " + std::to_string( chan.grid[g].rise );
+		htitle += ", flat top = " + std::to_string( chan.grid[g].top );
+		htitle += ", window = " + std::to_string( chan.grid[g].window );
+		htitle += ";Energy [arb. units];Counts";
+		chan.hists.push_back( new TH1F( hname.data(), htitle.data(), nbins, -0.5, emax ) );
+
+	}
+	output_file->cd();
+
+	channels.push_back( chan );
+	channel_lookup[idx] = channels.size() - 1;
+	return channel_lookup[idx];
+
+}
+
+void MiniballMWDScanner::ScanTrace( const MiniballMWDScanChannel &chan,
+								    const unsigned short *samples, unsigned int nsamples,
+								    MiniballMWDScanBuffer &buf ) {
+
+	// Same as FebexMWD::DoMWD
+	unsigned int skip = 8;
+	unsigned int ci = chan.cfd_integration;
+
+	buf.energies.resize( chan.grid.size() );
+	for( unsigned int g = 0; g < chan.grid.size(); ++g )
+		buf.energies[g].clear();
+
+	// Running sums of the samples and of those sums. The window sums of
+	// stages 1 to 3 of any grid point are differences of these
+	buf.trace_sum.resize( nsamples + 1 );
+	buf.sum_sum.resize( nsamples + 1 );
+	buf.trace_sum[0] = 0;
+	buf.sum_sum[0] = 0;
+	for( unsigned int i = 0; i < nsamples; ++i ) {
+		buf.trace_sum[i+1] = buf.trace_sum[i] + samples[i];
+		buf.sum_sum[i+1] = buf.sum_sum[i] + buf.trace_sum[i];
+	}
+
+	// Shaped pulse, exactly as in FebexMWD::DoMWDEnergy
+	unsigned int cs = chan.cfd_shaping;
+	auto differential = [&]( unsigned int k ) -> int {
+		if( k >= cs + skip && k >= ci + skip )
+			return (int)samples[k] - (int)samples[k-cs];
+		else return 0;
+	};
+	buf.cfd.resize( nsamples );
+	long long int diff_sum = 0;
+	for( unsigned int i = 0; i < nsamples; ++i ) {
+
+		float shaper = samples[i];
+		if( i >= cs + skip && i >= ci + skip ) {
+			shaper = samples[i] + diff_sum;
+			shaper /= ci;
+		}
+		buf.cfd[i] = shaper;
+
+		diff_sum += differential(i);
+		if( i >= ci ) diff_sum -= differential(i-ci);
+
+	}
+
+	// CFD trace, going backwards so the shaper is still there to use
+	for( unsigned int i = nsamples; i-- > 0; ) {
+		if( i >= chan.cfd_delay + skip ) buf.cfd[i] -= buf.cfd[i-chan.cfd_delay];
+		else buf.cfd[i] = 0;
+	}
+
+	// Stage 4 of a grid point at sample j, from the running sums
+	const long long int *P = buf.trace_sum.data();
+	const long long int *Q = buf.sum_sum.data();
+	auto stage4 = [&]( const MiniballMWDScanPoint &p, unsigned int j ) -> double {
+
+		unsigned int L = p.rise + 3;
+		unsigned int M = p.window + 3;
+		if( j < L + skip ) return 0.0;
+
+		// Only stage 3 from M+skip onwards is not zero
+		unsigned int a = j - L;
+		if( a < M + skip ) a = M + skip;
+		if( a >= j ) return 0.0;
+
+		long long int stage1 = ( P[j] - P[a] ) - ( P[j-M] - P[a-M] );
+		long long int stage2 = ( Q[j] - Q[a] ) - ( Q[j-M] - Q[a-M] );
+		return ( stage1 + (double)stage2 / p.decay ) / L;
+
+	};
+
+	// Triggers for each flat top, then the energies of the grid points
+	unsigned int g = 0;
+	for( unsigned int t = 0; t < chan.tops.size(); ++t ) {
+
+		FebexMWDTrigger<float> trigger( nsamples, skip, chan.cfd_delay, chan.cfd_hold,
+									    chan.threshold, chan.tops[t], chan.baseline );
+		unsigned int baseline_at = 0;
+		buf.cfd_list.clear();
+		buf.baseline_at.clear();
+		buf.energy_at.clear();
+
+		for( unsigned int i = 0; i < nsamples && !trigger.Done(); ++i ) {
+
+			unsigned int found = trigger.Step( i, buf.cfd[i], buf.cfd_list );
+			if( found & trigger.BASELINE ) baseline_at = trigger.GetBaselineSample();
+			if( found & trigger.ENERGY ) {
+				buf.baseline_at.push_back( baseline_at );
+				buf.energy_at.push_back( i );
+			}
+
+		}
+
+		for( ; g < chan.grid.size() && chan.grid[g].top == chan.tops[t]; ++g )
+			for( unsigned int k = 0; k < buf.energy_at.size(); ++k )
+				buf.energies[g].push_back( stage4( chan.grid[g], buf.energy_at[k] ) -
+										   stage4( chan.grid[g], buf.baseline_at[k] ) );
+
+	}
+
+	return;
+
+}
+
+void MiniballMWDScanner::ScanChannels() {
+
+	// Each thread takes the next channel until they are all done
+	std::atomic<unsigned int> next( 0 );
+	auto worker = [&]() {
+
+		MiniballMWDScanBuffer buf;
+		unsigned int c;
+		while( ( c = next++ ) < channels.size() ) {
+
+			MiniballMWDScanChannel &chan = channels[c];
+			unsigned long pos = 0;
+			for( unsigned int j = 0; j < chan.lengths.size(); ++j ) {
+
+				ScanTrace( chan, chan.samples.data() + pos, chan.lengths[j], buf );
+				pos += chan.lengths[j];
+
+				for( unsigned int g = 0; g < chan.grid.size(); ++g )
+					for( unsigned int k = 0; k < buf.energies[g].size(); ++k )
+						chan.hists[g]->Fill( buf.energies[g][k] );
+
+			}
+
+			chan.samples.clear();
+			chan.lengths.clear();
+
+		}
+
+	};
+
+	unsigned int nworkers = nthreads < channels.size() ? nthreads : channels.size();
+	if( nworkers <= 1 ) worker();
+	else {
+
+		std::vector<std::thread> workers;
+		for( unsigned int i = 0; i < nworkers; ++i )
+			workers.emplace_back( worker );
+		for( unsigned int i = 0; i < nworkers; ++i )
+			workers[i].join();
+
+	}
+
+	nsamples_waiting = 0;
+	return;
+
+}
+
+unsigned long MiniballMWDScanner::ScanTraces() {
+
+	unsigned long ntraces = 0;
+	MiniballDataPackets *data = new MiniballDataPackets;
+	MiniballTracePackets *trace = new MiniballTracePackets;
+	const FebexData *febex;
+	std::vector<unsigned short> samples;
+
+	for( unsigned int f = 0; f < input_names.size(); ++f ) {
+
+		TFile *input_file = new TFile( input_names[f].data(), "read" );
+		if( input_file->IsZombie() ) {
+
+			std::cout << "Cannot open " << input_names[f] << std::endl;
+			delete input_file;
+			continue;
+
+		}
+
+		TTree *t = (TTree*)input_file->Get("mb_sort");
+		if( t == nullptr ) {
+
+			std::cout << "No mb_sort tree in " << input_names[f] << std::endl;
+			input_file->Close();
+			delete input_file;
+			continue;
+
+		}
+		t->SetBranchAddress( "data", &data );
+
+		// Traces are in their own tree, indexed by the entry number in
+		// mb_sort. Older files still have them in the data packets instead
+		TTree *tt = (TTree*)input_file->Get("mb_trace");
+		if( tt != nullptr ) tt->SetBranchAddress( "trace", &trace );
+
+		unsigned long long n_entries = tt != nullptr ? tt->GetEntries() : t->GetEntries();
+		std::cout << " MWD scan: " << input_names[f] << ", " << n_entries;
+		std::cout << ( tt != nullptr ? " traces" : " entries" ) << std::endl;
+
+		for( unsigned long long i = 0; i < n_entries; ++i ) {
+
+			// Progress bar
+			bool update_progress = false;
+			if( n_entries < 200 )
+				update_progress = true;
+			else if( i % (n_entries/100) == 0 || i+1 == n_entries )
+				update_progress = true;
+
+			if( update_progress ) {
+
+				// Percent complete
+				float percent = (float)(i+1)*100.0/(float)n_entries;
+
+				// Progress bar in terminal
+				std::cout << " " << std::setw(6) << std::setprecision(4);
+				std::cout << percent << "%    \r";
+				std::cout.flush();
+
+			}
+
+			// Get the hit for the trace
+			if( tt != nullptr ) {
+				tt->GetEntry(i);
+				t->GetEntry( trace->GetEntry() );
+			}
+			else t->GetEntry(i);
+
+			if( !data->IsFebex() ) continue;
+			febex = &data->GetFebexDataRef();
+
+			int c = GetChannel( febex->GetSfp(), febex->GetBoard(), febex->GetChannel() );
+			if( c < 0 ) continue;
+
+			// Keep the trace until there are enough for the threads
+			if( tt != nullptr ) samples = trace->GetTrace();
+			else samples = febex->GetTrace();
+			if( !samples.size() ) continue;
+
+			channels[c].samples.insert( channels[c].samples.end(), samples.begin(), samples.end() );
+			channels[c].lengths.push_back( samples.size() );
+			nsamples_waiting += samples.size();
+			ntraces++;
+
+			if( nsamples_waiting >= MAX_SAMPLES ) ScanChannels();
+
+		}
+
+		// Finish the traces from this file before it is closed
+		ScanChannels();
+		input_file->Close();
+		delete input_file;
+
+	}
+
+	std::cout << " MWD scan: " << ntraces << " traces in " << channels.size();
+	std::cout << " channels" << std::endl;
+
+	delete data;
+	delete trace;
+
+	return ntraces;
+
+}
+
+void MiniballMWDScanner::FitResolution() {
+
+	// Results of the fits
+	output_file->cd();
+	TTree *results = new TTree( "mwd_scan", "Resolution for each MWD grid point" );
+	int sfp, board, ch;
+	unsigned int decay, rise, top, window;
+	double centroid, fwhm, resolution;
+	results->Branch( "sfp", &sfp );
+	results->Branch( "board", &board );
+	results->Branch( "ch", &ch );
+	results->Branch( "decay", &decay );
+	results->Branch( "rise", &rise );
+	results->Branch( "top", &top );
+	results->Branch( "window", &window );
+	results->Branch( "centroid", &centroid );
+	results->Branch( "fwhm", &fwhm );
+	results->Branch( "resolution", &resolution );
+
+	for( unsigned int c = 0; c < channels.size(); ++c ) {
+
+		MiniballMWDScanChannel &chan = channels[c];
+		sfp = chan.sfp;
+		board = chan.board;
+		ch = chan.ch;
+		int best = -1;
+		double best_resolution = 0;
+
+		for( unsigned int g = 0; g < chan.grid.size(); ++g ) {
+
+			TH1F *h = chan.hists[g];
+			decay = chan.grid[g].decay;
+			rise = chan.grid[g].rise;
+			top = chan.grid[g].top;
+			window = chan.grid[g].window;
+			centroid = fwhm = resolution = -1;
+
+			// Fit the biggest peak if there is something to fit
+			if( h->GetEntries() >= 100 ) {
+
+				int peak = h->GetMaximumBin();
+				double half = h->GetBinContent( peak ) / 2.0;
+				int lo = peak, hi = peak;
+				while( lo > 1 && h->GetBinContent( lo ) > half ) lo--;
+				while( hi < h->GetNbinsX() && h->GetBinContent( hi ) > half ) hi++;
+				double width = h->GetBinCenter( hi ) - h->GetBinCenter( lo );
+				if( width <= 0 ) width = h->GetBinWidth( peak );
+
+				TF1 *f = new TF1( "mwd_peak", "gaus",
+								  h->GetBinCenter( peak ) - width,
+								  h->GetBinCenter( peak ) + width );
+				f->SetParameters( 2.0 * half, h->GetBinCenter( peak ), width / 2.35482 );
+				h->Fit( f, "QNR" );
+				centroid = f->GetParameter(1);
+				fwhm = 2.35482 * TMath::Abs( f->GetParameter(2) );
+				if( TMath::Abs( centroid ) > 0 ) resolution = fwhm / TMath::Abs( centroid );
+				delete f;
+
+				if( resolution > 0 && ( best < 0 || resolution < best_resolution ) ) {
+					best = g;
+					best_resolution = resolution;
+				}
+
+			}
+
+			results->Fill();
+
+		}
+
+		// Best grid point for this channel
+		std::cout << " febex_" << (int)chan.sfp << "_" << (int)chan.board << "_" << (int)chan.ch;
+		if( best < 0 ) std::cout << ": not enough counts to fit" << std::endl;
+		else {
+			std::cout << ": best resolution " << best_resolution * 100.0 << "% with";
+			std::cout << " DecayTime = " << chan.grid[best].decay;
+			std::cout << ", RiseTime = " << chan.grid[best].rise;
+			std::cout << ", FlatTop = " << chan.grid[best].top;
+			std::cout << ", Window = " << chan.grid[best].window << std::endl;
+		}
+
+	}
+
+	return;
+
+}
+
+void MiniballMWDScanner::CloseOutput() {
+
+	std::cout << "Writing output file...\r";
+	std::cout.flush();
+	output_file->Write( nullptr, TObject::kOverwrite );
+	std::cout << "Writing output file... Done!" << std::endl << std::endl;
+	output_file->Close();
+
+	return;
+
+}
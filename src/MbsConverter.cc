@@ -35,6 +35,9 @@ void MiniballMbsConverter::ProcessBlock( unsigned long nblock ){
 	//	pos++;
 	//}
 
+	// No piled-up channels yet in this event
+	pileup_mask.assign( set->GetNumberOfFebexSfps() * set->GetNumberOfFebexBoards(), 0 );
+
 	// Now the channel data
 	while( pos < ndata ) ProcessFebexData( pos );
 	
@@ -55,6 +58,7 @@ void MiniballMbsConverter::ProcessFebexData( UInt_t &pos ) {
 	
 	flag_febex_data0 = false;
 	flag_febex_trace = false;
+	flag_febex_recover = false;
 
 	// Check for padding - Liam
 	while( (data[pos++] & 0xFFFF0000) == 0xADD00000 ) {
@@ -128,6 +132,10 @@ void MiniballMbsConverter::ProcessFebexData( UInt_t &pos ) {
 					std::cerr << "Error: One hit and multiple hits flagged" << std::endl;
 				
 				n_double_hits++;
+
+				// The trace of this channel can give us the hits instead
+				if( my_hit_ch_id < 32 )
+					pileup_mask[ PileupIndex( my_sfp_id, my_board_id ) ] |= 1U << my_hit_ch_id;
 				
 			}
 			
@@ -241,74 +249,93 @@ void MiniballMbsConverter::ProcessFebexData( UInt_t &pos ) {
 		bool filter_on = (trace_header & 0x80000) >> 19;
 		bool filter_mode = (trace_header & 0x40000) >> 18;
 
-		for( UInt_t i = 0; i < nsamples; i++ ) {
+		// Only this trace, not the ones before it in the event
+		febex_data->ResizeTrace(0);
 
-			auto sample_packet = data[pos++];
+		// Unpack all the samples in one go
+		unsigned short mask = adc_type ? 0x3FFF : 0x0FFF; // 14 bit or 12 bit
+		if( filter_on ) {
 
-			if( nsamples > 0 ) {
+			UnpackMbsFilterTrace( data + pos, nsamples, mask,
+								  febex_data->NewSamples( nsamples ) );
 
-				//std::cout << pos << " : " << sample_packet << std::endl;
-				//std::cout << " " << (( sample_packet >> 16 ) & 0x0000FFFF) << std::endl;
-				//std::cout << " " << (sample_packet & 0x0000FFFF) << std::endl;
+			// The filter energy from the last word is kept
+			if( nsamples > 0 ) {
 
-			}
-			
-			if( filter_on ) {
-			
-				if( adc_type ) febex_data->AddSample( ( sample_packet >> 16 ) & 0x00003FFF ); // 14 bit
-				else febex_data->AddSample( ( sample_packet >> 16 ) & 0x00000FFF ); // 12 bit
-				
+				auto sample_packet = data[pos+nsamples-1];
 				bool filter_sign = (sample_packet & 0x800000) >> 23;
 				int filter_energy = sample_packet & 0x7fffff;
 				if( filter_sign ) filter_energy *= -1.0;
 				febex_data->SetQint( filter_energy );
-				
-			}
-			
-			else {
-				
-				if( adc_type ) { // 14 bit
-			
-					febex_data->AddSample( sample_packet & 0x00003FFF );
-					febex_data->AddSample( ( sample_packet >> 16 ) & 0x00003FFF );
-			
-				}
-				
-				else { // 12 bit
-					
-					febex_data->AddSample( sample_packet & 0x00000FFF );
-					febex_data->AddSample( ( sample_packet >> 16 ) & 0x00000FFF );
 
-				}
-			
 			}
-			
+
 		}
-		
+
+		else UnpackMbsTrace( data + pos, nsamples, mask,
+							 febex_data->NewSamples( 2 * nsamples ) );
+
+		pos += nsamples;
+
 		// suppress unused warnings
 		(void)filter_mode;
 
-		FebexMWD mwd = cal->DoMWD( my_sfp_id, my_board_id, my_ch_id, febex_data->GetTrace() );
-		for( unsigned int i = 0; i < mwd.NumberOfTriggers(); ++i ) {
+		// The MWD of normal channels only goes into the histograms, so the
+		// workers can do it while we carry on. Info channels make hits, which
+		// have to be done here to keep them in order
+		// With pile-up recovery, the triggers in the trace of a piled-up
+		// channel are made into hits, as the firmware didn't give any
+		bool recover = set->GetPileupRecovery() && my_ch_id < 32 &&
+			( pileup_mask[ PileupIndex( my_sfp_id, my_board_id ) ] >> my_ch_id ) & 0x1;
+
+		if( trace_pool.IsRunning() && !recover &&
+		    !IsInfoChannel( my_sfp_id, my_board_id, my_ch_id ) ) {
 
-			flag_febex_trace = true;
+			trace_pool.Submit( my_sfp_id, my_board_id, my_ch_id,
+							   febex_data->GetTrace().data(),
+							   febex_data->GetTrace().size() );
 
-			// Make a FebexData item
-			febex_data->SetQint( mwd.GetEnergy(i) );
-			if( set->GetMbsEventMode() )
-				febex_data->SetTime( mwd.GetCfdTime(i) );
-			else febex_data->SetTime( my_tm_stp + mwd.GetCfdTime(i) );
-			febex_data->SetSfp( my_sfp_id );
-			febex_data->SetBoard( my_board_id );
-			febex_data->SetChannel( my_ch_id );
-			if( mwd.NumberOfTriggers() > 1 )
-				febex_data->SetPileup( true );
-			else febex_data->SetPileup( false );
+		}
 
+		else {
+
+			const FebexMWD &mwd = cal->DoMWDEnergy( my_sfp_id, my_board_id, my_ch_id, febex_data->GetTrace() );
+			for( unsigned int i = 0; i < mwd.NumberOfTriggers(); ++i ) {
+
+				// Nothing to make from a trigger without a positive energy
+				if( recover && mwd.GetEnergy(i) <= 0 ) continue;
+
+				flag_febex_trace = true;
+
+				// Make a FebexData item, CFD time is in samples
+				// A recovered hit has no firmware charge, only its MWD energy
+				long long int cfd_time = mwd.GetCfdTime(i) * FEBEX_SAMPLE_TIME;
+				if( recover ) {
+					febex_data->SetQint( 0 );
+					febex_data->SetRecovered( true );
+					recover_energy = mwd.GetEnergy(i);
+				}
+				else if( mwd.GetEnergy(i) > 0 )
+					febex_data->SetQint( mwd.GetEnergy(i) );
+				else febex_data->SetQint( 0 );
+				if( set->GetMbsEventMode() )
+					febex_data->SetTime( cfd_time );
+				else febex_data->SetTime( my_tm_stp + cfd_time );
+				febex_data->SetEventID( my_event_id );
+				febex_data->SetSfp( my_sfp_id );
+				febex_data->SetBoard( my_board_id );
+				febex_data->SetChannel( my_ch_id );
+				if( mwd.NumberOfTriggers() > 1 || recover )
+					febex_data->SetPileup( true );
+				else febex_data->SetPileup( false );
+				flag_febex_recover = recover;
+
+
+				// Close the data packet and clean up
+				FinishFebexData();
+				
+			}
 
-			// Close the data packet and clean up
-			FinishFebexData();
-			
 		}
 
 		// Trace trailer
@@ -373,10 +400,13 @@ bool MiniballMbsConverter::GetFebexChanID( unsigned int x ){
 	
 void MiniballMbsConverter::FinishFebexData(){
 	
+	// Calibration of this channel
+	const FebexChannelCal &fcal = cal->GetFebexCal( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() );
+
 	// Timestamp with offset
 	unsigned long long time_corr;
 	time_corr  = febex_data->GetTime();
-	time_corr += cal->FebexTime( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() );
+	time_corr += fcal.time;
 
 	// Check if this is actually just a timestamp or info like event
 	flag_febex_info = false;
@@ -416,39 +446,50 @@ void MiniballMbsConverter::FinishFebexData(){
 		info_data->SetCode( my_info_code );
 
 		if( !flag_source ) {
-			std::shared_ptr<MiniballDataPackets> data_packet =
-				std::make_shared<MiniballDataPackets>( info_data );
-			data_vector.emplace_back( data_packet );
-			data_map.push_back( std::make_pair<unsigned long,double>(
-				 data_vector.size()-1, data_packet->GetTime() ) );
+			hit_store.Add( info_data );
 		}
 
 	}
 	
-	// Otherwise it is real data, so fill a FEBEX event
-	else if( flag_febex_data0 ) {
+	// Otherwise it is real data, so fill a FEBEX event.
+	// That includes the MWD triggers of a piled-up trace
+	else if( flag_febex_data0 || flag_febex_recover ) {
+		
+		// Calibrate, the MWD triggers with their own calibration
+		if( flag_febex_recover ) {
+			
+			my_energy = cal->FebexMWDEnergy( fcal, recover_energy );
+			if( recover_energy > fcal.mwd_threshold )
+				febex_data->SetThreshold( true );
+			else
+				febex_data->SetThreshold( false );
+			
+		}
 		
-		// Calibrate
-		my_energy = cal->FebexEnergy( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel(), febex_data->GetQint() );
+		else {
+			
+			my_energy = cal->FebexEnergy( fcal, febex_data->GetQint(),
+										  ctr_febex_hit[febex_data->GetSfp()][febex_data->GetBoard()] );
+			if( febex_data->GetQint() > fcal.threshold )
+				febex_data->SetThreshold( true );
+			else
+				febex_data->SetThreshold( false );
+			
+		}
 		febex_data->SetEnergy( my_energy );
-		if( febex_data->GetQint() > cal->FebexThreshold( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() ) )
-			febex_data->SetThreshold( true );
-		else
-			febex_data->SetThreshold( false );
 		
 		// Fill histograms
 		hfebex_cal[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()]->Fill( my_energy );
-		hfebex_qint[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()]->Fill( febex_data->GetQint() );
+		if( flag_febex_recover )
+			hfebex_mwd[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()]->Fill( recover_energy );
+		else
+			hfebex_qint[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()]->Fill( febex_data->GetQint() );
 		
 		// Set this data and fill event to tree
 		// Also add the time offset when we do this
 		febex_data->SetTime( time_corr );
 		if( !flag_source ) {
-			std::shared_ptr<MiniballDataPackets> data_packet =
-				std::make_shared<MiniballDataPackets>( febex_data );
-			data_vector.emplace_back( data_packet );
-			data_map.push_back( std::make_pair<unsigned long,double>(
-				data_vector.size()-1, data_packet->GetTime() ) );
+			hit_store.Add( febex_data );
 		}
 
 	}
@@ -499,6 +540,9 @@ int MiniballMbsConverter::ConvertFile( std::string input_file_name,
 	// Reset counters to zero for every file
 	StartFile();
 
+	// Random numbers for the calibration belong to this file
+	cal->SetRandomKey( PhiloxKey( input_file_name ) );
+
 	// Calculate the size of the file.
 	input_file.seekg( 0, input_file.end );
 	unsigned long long size_end = input_file.tellg();
@@ -533,6 +577,9 @@ int MiniballMbsConverter::ConvertFile( std::string input_file_name,
 	mbs.SetBufferSize( set->GetBlockSize() );
 	mbs.OpenLmdFile( input_file_name );
 
+	// Start the workers for the trace MWD
+	if( nthreads > 1 ) trace_pool.Start( nthreads, cal );
+
 	// Loop over all the MBS Events.
 	unsigned long mbsevt = 0, nblock = 0;
 	for( mbsevt = 0; ; mbsevt++ ){
@@ -578,8 +625,23 @@ int MiniballMbsConverter::ConvertFile( std::string input_file_name,
 
 		// Process current block
 		ProcessBlock( mbsevt );
+
+		// Spill to disk if we're running out of memory
+		SpillHits();
+
+		// Fill the MWD energies from the workers now and again
+		if( trace_pool.IsRunning() && mbsevt % DRAIN_EVENTS == 0 )
+			trace_pool.Drain( hfebex_mwd );
 		
 	} // loop - mbsevt < MBS_EVENTS
+
+	// Finish the traces that are left and stop the workers
+	if( trace_pool.IsRunning() ) {
+
+		trace_pool.Drain( hfebex_mwd );
+		trace_pool.Stop();
+
+	}
 	
 	// Close the file
 	mbs.CloseFile();
@@ -205,8 +205,9 @@ void MiniballMedConverter::ProcessMesytecAdcData() {
 			// Some basic info for every event
 			adc_data->SetEventID( my_event_id );
 
-			// Calculate energy and threshold
-			float energy = cal->AdcEnergy( mod, ch_vec[item], qshort_vec[item] );
+			// Calculate energy and threshold, numbering the hits on each module
+			unsigned long long hit = mod < ctr_madc_hit.size() ? ctr_madc_hit[mod]++ : 0;
+			float energy = cal->AdcEnergy( mod, ch_vec[item], qshort_vec[item], hit );
 			bool thresh = cal->AdcThreshold( mod, ch_vec[item] );
 
 			// Corrected time for ADCs
@@ -224,11 +225,7 @@ void MiniballMedConverter::ProcessMesytecAdcData() {
 
 			// Fill the tree
 			if( !flag_source ) {
-				std::shared_ptr<MiniballDataPackets> data_packet =
-					std::make_shared<MiniballDataPackets>( adc_data );
-				data_vector.emplace_back( data_packet );
-				data_map.push_back( std::make_pair<unsigned long,double>(
-					data_vector.size()-1, data_packet->GetTime() ) );
+				hit_store.Add( adc_data );
 			}
 
 			// Fill histograms
@@ -636,8 +633,9 @@ void MiniballMedConverter::ProcessDgfData() {
 						else
 							LongFastTriggerTime += 65536ll*EventTimeHigh + 65536ll + 65536ll*65536ll*RunTimeA;
 
-						// Get calibrated energy and check threshold
-						float energy = cal->DgfEnergy( mod, ch, Qshort );
+						// Get calibrated energy and check threshold, numbering the hits on each module
+						unsigned long long hit = mod < ctr_dgf_hit.size() ? ctr_dgf_hit[mod]++ : 0;
+						float energy = cal->DgfEnergy( mod, ch, Qshort, hit );
 						bool thresh = cal->DgfThreshold( mod, ch );
 
 						// For RUNTASK!=259, now 6 user PSA values (& possible trace) follow
@@ -699,11 +697,7 @@ void MiniballMedConverter::ProcessDgfData() {
 
 								// Fill the tree
 								if( !flag_source ) {
-									std::shared_ptr<MiniballDataPackets> data_packet =
-										std::make_shared<MiniballDataPackets>( info_data );
-									data_vector.emplace_back( data_packet );
-									data_map.push_back( std::make_pair<unsigned long,double>(
-										data_vector.size()-1, data_packet->GetTime() ) );
+									hit_store.Add( info_data );
 								}
 
 							}
@@ -729,11 +723,7 @@ void MiniballMedConverter::ProcessDgfData() {
 
 							// Fill the tree
 							if( !flag_source ) {
-								std::shared_ptr<MiniballDataPackets> data_packet =
-									std::make_shared<MiniballDataPackets>( dgf_data );
-								data_vector.emplace_back( data_packet );
-								data_map.push_back( std::make_pair<unsigned long,double>(
-									data_vector.size()-1, data_packet->GetTime() ) );
+								hit_store.Add( dgf_data );
 							}
 
 						}
@@ -777,6 +767,9 @@ int MiniballMedConverter::ConvertFile( std::string input_file_name,
 	// Reset counters to zero for every file
 	StartFile();
 
+	// Random numbers for the calibration belong to this file
+	cal->SetRandomKey( PhiloxKey( input_file_name ) );
+
 	// Calculate the size of the file.
 	input_file.seekg( 0, input_file.end );
 	unsigned long long size_end = input_file.tellg();
@@ -853,6 +846,9 @@ int MiniballMedConverter::ConvertFile( std::string input_file_name,
 		mbsinfo_packet->SetEventID( my_event_id );
 		mbsinfo_tree->Fill();
 
+		// Spill to disk if we're running out of memory
+		SpillHits();
+
 	} // loop - mbsevt < MBS_EVENTS
 
 	// Close the file
@@ -6,7 +6,8 @@ void MiniballMidasConverter::SetBlockHeader( char *input_header ){
 	
 	// Copy header
 	for( unsigned int i = 0; i < HEADER_SIZE; i++ )
-		block_header[i] = input_header[i];
+		header_buffer[i] = input_header[i];
+	block_header = header_buffer;
 
 	return;
 	
@@ -56,46 +57,187 @@ void MiniballMidasConverter::ProcessBlockHeader( long nblock ){
 // Function to copy the main data from a DataSpy, for example
 void MiniballMidasConverter::SetBlockData( char *input_data ){
 	
-	// Copy header
+	// Copy data
 	for( UInt_t i = 0; i < MAIN_SIZE; i++ )
-		block_data[i] = input_data[i];
+		data_buffer[i] = input_data[i];
+	block_data = data_buffer;
 
 	return;
 	
 }
 
 
-// Function to process data words
-void MiniballMidasConverter::ProcessBlockData( long nblock ){
+// Function to work out the swapping mode of a block
+Int_t MiniballMidasConverter::FindSwapMode( const ULong64_t *words, UShort_t data_endian ){
 	
-	// Get the data in 64-bit words and check endieness and swap if needed
-	// Data format here: http://npg.dl.ac.uk/documents/edoc504/edoc504.html
-	// Unpack in to two 32-bit words for purposes of data format
-		
-	// Swap mode is unknown for the first block of data, so let's work it out
-	if( (swap & SWAP_KNOWN) == 0 ) {
+	Int_t mode = 0;
 
-		// See if we can figure out the swapping - the DataEndian word of the
-		// header is 256 if the endianness is correct, otherwise swap endianness
-		if( header_DataEndian != 256 ) swap |= SWAP_ENDIAN;
-		
-		// However, that is not all, the words may also be swapped, so check
-		// for that. Bits 31:30 should always be zero in the timestamp word
-		for( UInt_t i = 0; i < WORD_SIZE; i++ ) {
-			ULong64_t word = (swap & SWAP_ENDIAN) ? Swap64(data[i]) : data[i];
-			if( word & 0xC000000000000000LL ) {
-				swap |= SWAP_KNOWN;
-				break;
-			}
-			if( word & 0x00000000C0000000LL ) {
-				swap |= SWAP_KNOWN;
-				swap |= SWAP_WORDS;
-				break;
-			}
+	// See if we can figure out the swapping - the DataEndian word of the
+	// header is 256 if the endianness is correct, otherwise swap endianness
+	if( data_endian != 256 ) mode |= SWAP_ENDIAN;
+	
+	// However, that is not all, the words may also be swapped, so check
+	// for that. Bits 31:30 should always be zero in the timestamp word
+	for( UInt_t i = 0; i < WORD_SIZE; i++ ) {
+		ULong64_t word = (mode & SWAP_ENDIAN) ? Swap64(words[i]) : words[i];
+		if( word & 0xC000000000000000LL ) {
+			mode |= SWAP_KNOWN;
+			break;
+		}
+		if( word & 0x00000000C0000000LL ) {
+			mode |= SWAP_KNOWN;
+			mode |= SWAP_WORDS;
+			break;
 		}
+	}
+	
+	return mode;
+	
+}
+
+// Function to decode a block in a worker thread. It only does the
+// byte swapping and the trace unpacking and MWD, which don't depend
+// on anything from the previous blocks. Everything else is left for
+// ProcessBlockData, which replays the blocks in order afterwards.
+void MiniballMidasConverter::DecodeBlock( const char *input_header,
+										 const char *input_data,
+										 bool prev_full, MidasBlock &blk ){
+	
+	// Endianness and length of the data, as in ProcessBlockHeader
+	UShort_t data_endian = (input_header[18] & 0xFF) << 8 | (input_header[19]& 0xFF);
+	UInt_t data_len = BlockDataLength( input_header );
+
+	// Nothing to do if the block is going to be rejected anyway
+	blk.traces.clear();
+	if( RejectBlock( data_len, prev_full ) ) return;
+
+	// Can't have more data than fits in the block
+	if( data_len > WORD_SIZE ) data_len = WORD_SIZE;
+
+	// Do the swapping once for the whole block
+	const ULong64_t *raw = (const ULong64_t *)input_data;
+	Int_t blk_swap = FindSwapMode( raw, data_endian );
+	blk.words.resize( WORD_SIZE );
+	SwapMidasWords( raw, WORD_SIZE, blk_swap & SWAP_ENDIAN,
+				    blk_swap & SWAP_WORDS, blk.words.data() );
+	
+	// Find the traces and do the MWD
+	DecodeTraces( blk.words.data(), data_len, blk.traces );
+	
+	return;
+	
+}
+
+// Function to get the length of the data in a block from its header
+UInt_t MiniballMidasConverter::BlockDataLength( const char *input_header ){
+	
+	UInt_t data_len =
+	(input_header[20] & 0xFF) | (input_header[21]& 0xFF) << 8 |
+	(input_header[22] & 0xFF) << 16  | (input_header[23]& 0xFF) << 24 ;
+
+	return data_len / sizeof(ULong64_t);
+	
+}
+
+// Function to check if a block will be rejected by ProcessBlockData
+bool MiniballMidasConverter::RejectBlock( UInt_t data_len, bool prev_full ){
+	
+	return ( data_len == WORD_SIZE && set->GetBufferFullRejection() ) ||
+		   ( prev_full && set->GetBufferPartRejection() );
+	
+}
+
+// Function to unpack all the traces in a block of native words and run the
+// MWD on them together. This can run in a worker thread, or in the main one
+void MiniballMidasConverter::DecodeTraces( const ULong64_t *words, UInt_t data_len,
+										  std::vector<MidasTraceResult> &traces ){
+	
+	// Can't have more data than fits in the block
+	if( data_len > WORD_SIZE ) data_len = WORD_SIZE;
+	
+	// Walk through the words in the same way as ProcessBlockData
+	traces.clear();
+	std::vector<FebexMWDTrace> mwd_traces;
+	for( UInt_t i = 0; i < data_len; i++ ) {
+		
+		// Only trace headers are interesting here
+		UInt_t w0 = ( words[i] >> 32 ) & 0xFFFFFFFF;
+		if( ( ( w0 >> 30 ) & 0x3 ) != 0x1 ) continue;
+		
+		// Channel ID, checked as in GetFebexChanID but quietly
+		unsigned int ADCchanIdent = (w0 >> 16) & 0x0FFF;
+		unsigned char sfp = (ADCchanIdent >> 10) & 0x0003;
+		unsigned char board = (ADCchanIdent >> 6) & 0x000F;
+		unsigned char ch = ADCchanIdent & 0x000F;
+		if( sfp >= set->GetNumberOfFebexSfps() ||
+		    board >= set->GetNumberOfFebexBoards() ||
+		    ch >= set->GetNumberOfFebexChannels() ) continue;
+
+		MidasTraceResult trace;
+		trace.start = i;
+		
+		// Get the samples from the trace, the words are already swapped
+		UInt_t nwords = ( w0 & 0xFFFF ) / 4;
+		trace.samples.resize( 4 * nwords );
+		UInt_t nread = UnpackTrace( words, i, nwords, trace.samples.data() );
+		trace.samples.resize( 4 * nread );
+		int pos = i + nread;
+		trace.end = pos;
+		
+		traces.push_back( std::move( trace ) );
+		
+		FebexMWDTrace mwd_trace;
+		mwd_trace.sfp = sfp;
+		mwd_trace.board = board;
+		mwd_trace.ch = ch;
+		mwd_traces.push_back( mwd_trace );
+		
+		i = pos;
 		
 	}
 	
+	// Run the MWD on all the traces, keeping only what we need later
+	for( unsigned int j = 0; j < traces.size(); ++j ) {
+		mwd_traces[j].samples = traces[j].samples.data();
+		mwd_traces[j].nsamples = traces[j].samples.size();
+	}
+	cal->DoMWD( mwd_traces );
+	for( unsigned int j = 0; j < traces.size(); ++j ) {
+		traces[j].clipped = mwd_traces[j].clipped;
+		traces[j].energies = std::move( mwd_traces[j].energies );
+		traces[j].cfd_times = std::move( mwd_traces[j].cfd_times );
+	}
+	
+	return;
+	
+}
+
+UInt_t MiniballMidasConverter::UnpackTrace( const ULong64_t *words, int pos,
+										   UInt_t nwords, unsigned short *samples ){
+
+	// Only the words that are inside the block
+	UInt_t navail = 0;
+	if( pos + 1 < WORD_SIZE )
+		navail = std::min( nwords, (UInt_t)( WORD_SIZE - pos - 1 ) );
+
+	// Stop early if we found the end marker
+	UInt_t nread = UnpackMidasTrace( words + pos + 1, navail, false, false, samples );
+	if( nread < navail ) return nread;
+
+	// Anything past the end of the block is zero
+	std::fill( samples + 4 * navail, samples + 4 * nwords, 0 );
+
+	return nwords;
+
+}
+
+// Function to process data words
+void MiniballMidasConverter::ProcessBlockData( long nblock ){
+	
+	// Get the data in 64-bit words, already swapped in ProcessCurrentBlock
+	// Data format here: http://npg.dl.ac.uk/documents/edoc504/edoc504.html
+	// Unpack in to two 32-bit words for purposes of data format
+	
 	// If the previous buffer was full and we want to reject the
 	// next buffer, because of the readout bugs in September 2023,
 	// this is the place to do it. Next buffer might be good again!
@@ -115,19 +257,27 @@ void MiniballMidasConverter::ProcessBlockData( long nblock ){
 	if( real_DataLen == WORD_SIZE ) buffer_full = true;
 	
 	// Check if we should reject this event
-	if( ( buffer_full && set->GetBufferFullRejection() ) ||
-        ( buffer_part && set->GetBufferPartRejection() ) ) {
+	if( RejectBlock( real_DataLen, buffer_part ) ) {
 		
 		reject_ctr++;
 		return;
 	
 	}
 		
+	// Can't have more data than fits in the block
+	if( real_DataLen > WORD_SIZE ) {
+		
+		std::cerr << "WARNING: data length " << real_DataLen;
+		std::cerr << " is bigger than the block, in block: " << nblock << std::endl;
+		real_DataLen = WORD_SIZE;
+		
+	}
+	
 	// Process data in the buffer
 	NewBuffer();
 	for( UInt_t i = 0; i < real_DataLen; i++ ) {
 	
-		word = GetWord(i);
+		word = data[i];
 		word_0 = (word & 0xFFFFFFFF00000000) >> 32;
 		word_1 = (word & 0x00000000FFFFFFFF);
 
@@ -231,58 +381,51 @@ int MiniballMidasConverter::ProcessTraceData( int pos ){
 	// sample length
 	nsamples = word_0 & 0xFFFF; // 16 bits from 0
 	
-	// Get the samples from the trace
-	for( UInt_t j = 0; j < nsamples/4; j++ ){
-		
-		// get next word
-		ULong64_t sample_packet = GetWord(++pos);
-		
-		UInt_t block_test = ( sample_packet >> 32 ) & 0x00000000FFFFFFFF;
-		
-		// Note from Carl Unsworth in elog:22769 referring to note in edoc504.
-		// Basically the trace_test as defined below is not applicable for FEBEX data.
-		// We test if the two uppermost bits are 00, but this isn't always the case.
-		// Therefore, we are hacking for now to define it as so in case we change our mind
-		// then at least the code still exists to go back to some type of test.
-		// unsigned char trace_test = ( sample_packet >> 62 ) & 0x0000000000000003;
-		unsigned char trace_test = 0;
+	// If a worker thread already did this trace, just take the result
+	if( decoded_block != nullptr && trace_ctr < decoded_block->traces.size() &&
+	    decoded_block->traces[trace_ctr].start == (UInt_t)pos ) {
 
-		if( trace_test == 0 && block_test != 0x5E5E5E5E ){
-			
-			// Usually the top two bits are zero and we mask them off
-			//febex_data->AddSample( ( sample_packet >> 48 ) & 0x0000000000003FFF );
-			//febex_data->AddSample( ( sample_packet >> 32 ) & 0x0000000000003FFF );
-			//febex_data->AddSample( ( sample_packet >> 16 ) & 0x0000000000003FFF );
-			//febex_data->AddSample( sample_packet & 0x0000000000003FFF );
+		const MidasTraceResult &trace = decoded_block->traces[trace_ctr++];
+		if( febex_data->GetTraceLength() == 0 ) {
 			
-			// FEBEX might not be masking the top two bits with zero
-			// And the pairs need to be swapped. First sample goes to lower bits
-			febex_data->AddSample( ( sample_packet >> 32 ) & 0x000000000000FFFF );
-			febex_data->AddSample( ( sample_packet >> 48 ) & 0x000000000000FFFF );
-			febex_data->AddSample( sample_packet & 0x000000000000FFFF );
-			febex_data->AddSample( ( sample_packet >> 16 ) & 0x000000000000FFFF );
+			febex_data->SetTrace( trace.samples );
+			febex_data->SetClipped( trace.clipped );
 
-		}
-		
-		else {
-			
-			//std::cout << "This isn't a trace anymore..." << std::endl;
-			//std::cout << "Sample #" << j << " of " << nsamples << std::endl;
-			//std::cout << " trace_test = " << (int)trace_test << std::endl;
+			for( unsigned int i = 0; i < trace.energies.size(); ++i )
+				hfebex_mwd[my_sfp_id][my_board_id][my_ch_id]->Fill( trace.energies[i] );
 
-			pos--;
-			break;
+			trace_energies = trace.energies;
+			trace_cfd_times = trace.cfd_times;
+
+			flag_febex_trace = true;
+			
+			return trace.end;
 			
 		}
-
+		
 	}
 	
-	FebexMWD mwd = cal->DoMWD( my_sfp_id, my_board_id, my_ch_id, febex_data->GetTrace() );
+	// Get the samples from the trace, four in each word, all in one go.
+	// Note from Carl Unsworth in elog:22769 referring to note in edoc504.
+	// The test that the two uppermost bits are 00 is not applicable for
+	// FEBEX data, so we only stop at the 0x5E5E5E5E end of trace marker.
+	// FEBEX might not be masking the top two bits with zero either, and
+	// the pairs need to be swapped. First sample goes to lower bits.
+	UInt_t nwords = nsamples / 4;
+	UInt_t ntrace = febex_data->GetTraceLength();
+	UInt_t nread = UnpackTrace( data, pos, nwords, febex_data->NewSamples( 4 * nwords ) );
+	if( nread < nwords ) febex_data->ResizeTrace( ntrace + 4 * nread );
+	pos += nread;
+	
+	const FebexMWD &mwd = cal->DoMWDEnergy( my_sfp_id, my_board_id, my_ch_id, febex_data->GetTrace() );
 	febex_data->SetClipped( mwd.IsClipped() );
 
 	for( unsigned int i = 0; i < mwd.NumberOfTriggers(); ++i )
 		hfebex_mwd[my_sfp_id][my_board_id][my_ch_id]->Fill( mwd.GetEnergy(i) );
 
+	trace_energies = mwd.GetEnergies();
+	trace_cfd_times = mwd.GetCfdTimes();
+
 	flag_febex_trace = true;
 	
 	return pos;
@@ -433,9 +576,12 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 	// if( ( flag_febex_data0 && flag_febex_data1 ) || flag_febex_trace ){
 	if( ( flag_febex_data0 && flag_febex_data2 && flag_febex_data3 ) || flag_febex_trace ){
 
+		// Calibration of this channel
+		const FebexChannelCal &fcal = cal->GetFebexCal( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() );
+
 		// Add the time offset to this channel
 		time_corr  = febex_data->GetTime();
-		time_corr += cal->FebexTime( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() );
+		time_corr += fcal.time;
 
 		// Timestamp checks
 		long long int sfp_check		= febex_data->GetTime() - tm_stp_read[febex_data->GetSfp()];
@@ -506,10 +652,10 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 			
 			// Calibrate and set energies
 			unsigned int adc_tmp_value;
-			if( cal->FebexType( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() ) == "Qshort" )
+			if( fcal.type == MiniballCalibration::FEBEX_QSHORT )
 				adc_tmp_value = febex_data->GetQshort();
 			
-			else if( cal->FebexType( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() ) == "Qint" )
+			else if( fcal.type == MiniballCalibration::FEBEX_QINT )
 				adc_tmp_value = febex_data->GetQint();
 			
 			else {
@@ -523,11 +669,12 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 				
 			}
 			
-			my_energy = cal->FebexEnergy( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel(), adc_tmp_value );
+			my_energy = cal->FebexEnergy( fcal, adc_tmp_value,
+										  ctr_febex_hit[febex_data->GetSfp()][febex_data->GetBoard()] );
 			febex_data->SetEnergy( my_energy );
 			
 			// Check if it's over threshold
-			if( adc_tmp_value > cal->FebexThreshold( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() ) )
+			if( adc_tmp_value > fcal.threshold )
 				febex_data->SetThreshold( true );
 			else febex_data->SetThreshold( false );
 			
@@ -600,11 +747,7 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 
 				// Fill only if we are not doing a source run
 				if( !flag_source ) {
-					std::shared_ptr<MiniballDataPackets> data_packet =
-						std::make_shared<MiniballDataPackets>( info_data );
-					data_vector.emplace_back( data_packet );
-					data_map.push_back( std::make_pair<unsigned long,double>(
-						data_vector.size()-1, data_packet->GetTime() ) );
+					hit_store.Add( info_data );
 				}
 				data_ctr++;
 
@@ -614,17 +757,24 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 			// but only if we are in an EBIS time window or we want all data
 			else if( !flag_ebis || EBISWindow( febex_data->GetTime() ) ) {
 				
-				// Set this data and fill event to tree
-				// Also add the time offset when we do this
-				febex_data->SetTime( time_corr );
+				// Piled-up trace, so make a hit from each MWD trigger
+				// or the one from the firmware if none of them are any good
+				bool recovered = false;
+				if( flag_febex_trace && set->GetPileupRecovery() &&
+				    trace_energies.size() > 1 )
+					recovered = AddRecoveredHits( time_corr, fcal );
+
+				if( !recovered ) {
+
+					// Set this data and fill event to tree
+					// Also add the time offset when we do this
+					febex_data->SetTime( time_corr );
+
+					// Fill only if we are not doing a source run
+					if( !flag_source ) {
+						hit_store.Add( febex_data );
+					}
 
-				// Fill only if we are not doing a source run
-				if( !flag_source ) {
-					std::shared_ptr<MiniballDataPackets> data_packet =
-						std::make_shared<MiniballDataPackets>( febex_data );
-					data_vector.emplace_back( data_packet );
-					data_map.push_back( std::make_pair<unsigned long,double>(
-						data_vector.size()-1, data_packet->GetTime() ) );
 				}
 				data_ctr++;
 				
@@ -645,6 +795,12 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 				hfebex_qint[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()]->Fill( febex_data->GetQint() );
 				hfebex_cal[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()]->Fill( my_energy );
 				
+				// Compare the fixed-point MWD with the firmware, when there's
+				// only one trigger so we know they are from the same pulse
+				TH2F *h = hfebex_mwd_qint[febex_data->GetSfp()][febex_data->GetBoard()][febex_data->GetChannel()];
+				if( h != nullptr && flag_febex_trace && trace_energies.size() == 1 )
+					h->Fill( febex_data->GetQint(), trace_energies[0] );
+				
 			}
 			
 			// Reset the latest board and channel timestamps
@@ -705,6 +861,8 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 	flag_febex_data2 = false;
 	flag_febex_data3 = false;
 	flag_febex_trace = false;
+	trace_energies.clear();
+	trace_cfd_times.clear();
 	febex_data->ClearData();
 	info_data->ClearData();
 
@@ -712,6 +870,63 @@ void MiniballMidasConverter::FinishFebexData( long nblock ){
 
 }
 
+bool MiniballMidasConverter::AddRecoveredHits( unsigned long long int time_corr, const FebexChannelCal &fcal ){
+
+	// The firmware timestamp belongs to the first trigger, so the
+	// others are shifted by their CFD time from the first one
+	// Keep the firmware values for the histograms afterwards
+	long long int fw_time = febex_data->GetTime();
+	unsigned int fw_qint = febex_data->GetQint();
+	unsigned short fw_qshort = febex_data->GetQshort();
+	float fw_energy = febex_data->GetEnergy();
+	bool fw_thres = febex_data->IsOverThreshold();
+	bool fw_pileup = febex_data->IsPileup();
+
+	// There is no firmware charge for these hits, so the event builder
+	// mustn't calibrate them again from Qint or Qshort
+	febex_data->SetQint( 0 );
+	febex_data->SetQshort( 0 );
+	febex_data->SetRecovered( true );
+	febex_data->SetPileup( true );
+
+	unsigned int nhits = 0;
+	for( unsigned int i = 0; i < trace_energies.size() && i < trace_cfd_times.size(); ++i ) {
+
+		// Nothing to make from a trigger without a positive energy
+		if( trace_energies[i] <= 0 ) continue;
+
+		// Always measured from the first trigger, even if we skipped it,
+		// because that is the one the firmware timestamp belongs to
+		long long int dt = ( trace_cfd_times[i] - trace_cfd_times[0] ) * FEBEX_SAMPLE_TIME;
+		febex_data->SetTime( time_corr + dt );
+		febex_data->SetEnergy( cal->FebexMWDEnergy( fcal, trace_energies[i] ) );
+		if( trace_energies[i] > fcal.mwd_threshold )
+			febex_data->SetThreshold( true );
+		else febex_data->SetThreshold( false );
+		nhits++;
+
+		// Fill only if we are not doing a source run
+		if( !flag_source ) {
+			hit_store.Add( febex_data );
+		}
+
+		// Only the first hit keeps the trace
+		febex_data->ClearTrace();
+
+	}
+
+	febex_data->SetTime( fw_time );
+	febex_data->SetQint( fw_qint );
+	febex_data->SetQshort( fw_qshort );
+	febex_data->SetEnergy( fw_energy );
+	febex_data->SetThreshold( fw_thres );
+	febex_data->SetPileup( fw_pileup );
+	febex_data->SetRecovered( false );
+
+	return nhits > 0;
+
+}
+
 void MiniballMidasConverter::ProcessInfoData( long nblock ){
 
 	// Module number from MIDAS
@@ -842,16 +1057,11 @@ void MiniballMidasConverter::ProcessInfoData( long nblock ){
 		info_data->SetBoard( my_board_id );
 		info_data->SetTime( my_tm_stp*10 );
 		info_data->SetCode( my_info_code );
-		std::shared_ptr<MiniballDataPackets> data_packet = std::make_shared<MiniballDataPackets>( info_data );
 
 		// Fill only if we are not doing a source run
 		// Or comment out if we want to skip them because we're not debugging
 		if( !flag_source ) {
-			std::shared_ptr<MiniballDataPackets> data_packet =
-				std::make_shared<MiniballDataPackets>( info_data );
-			data_vector.emplace_back( data_packet );
-			data_map.push_back( std::make_pair<unsigned long,double>(
-				data_vector.size()-1, data_packet->GetTime() ) );
+			hit_store.Add( info_data );
 		}
 		info_data->Clear();
 
@@ -868,8 +1078,42 @@ bool MiniballMidasConverter::ProcessCurrentBlock( long nblock ) {
 	ProcessBlockHeader( nblock );
 
 	// Process the main block data until terminator found
-	data = (ULong64_t *)(block_data);
+	// If a worker thread decoded it already, the words are swapped already
+	if( decoded_block != nullptr ) {
+		
+		data = decoded_block->words.data();
+		swap = SWAP_KNOWN;
+		trace_ctr = 0;
+		
+	}
+	
+	// Otherwise put the whole block in native order in one pass,
+	// so that the decoding doesn't have to swap each word itself
+	else {
+		
+		data = (const ULong64_t *)(block_data);
+		swap = FindSwapMode( data, header_DataEndian );
+		if( swap & ( SWAP_ENDIAN | SWAP_WORDS ) ) {
+			
+			SwapMidasWords( data, WORD_SIZE, swap & SWAP_ENDIAN,
+						    swap & SWAP_WORDS, native_buffer );
+			data = native_buffer;
+			
+		}
+		
+		// Then do the MWD for all the traces in the block together,
+		// unless ProcessBlockData is going to reject the block
+		serial_block.traces.clear();
+		if( !RejectBlock( header_DataLen / sizeof(ULong64_t), buffer_full ) )
+			DecodeTraces( data, header_DataLen / sizeof(ULong64_t), serial_block.traces );
+		decoded_block = &serial_block;
+		trace_ctr = 0;
+		
+	}
 	ProcessBlockData( nblock );
+	
+	// The next block needs decoding again if we did it here
+	if( decoded_block == &serial_block ) decoded_block = nullptr;
 			
 	// Note 08/11/2023 - This isn't the right thing to do
 	// Check once more after going over left overs....
@@ -882,7 +1126,7 @@ bool MiniballMidasConverter::ProcessCurrentBlock( long nblock ) {
 	//}
 
 	// Occassionally, sort the data vector to speed things up?
-	//if( (nblock+1) % 3000 == 0 && (BLOCKS_NUM-nblock) > 3000 ) SortDataVector();
+	//if( (nblock+1) % 3000 == 0 && (BLOCKS_NUM-nblock) > 3000 ) SortDataMap();
 
 	return true;
 
@@ -891,15 +1135,17 @@ bool MiniballMidasConverter::ProcessCurrentBlock( long nblock ) {
 // Function to convert a block of data from DataSpy
 int MiniballMidasConverter::ConvertBlock( char *input_block, long nblock ) {
 	
-	// Get the header.
-	std::memmove( &block_header, &input_block[0], HEADER_SIZE );
-	
-	// Get the block
-	std::memmove( &block_data, &input_block[HEADER_SIZE], MAIN_SIZE );
+	// Point to the header and the block in the DataSpy buffer.
+	// No need to copy, it is processed before the next read.
+	block_header = &input_block[0];
+	block_data = &input_block[HEADER_SIZE];
 	
 	// Process the data
 	ProcessCurrentBlock( nblock );
 
+	// Write out what we can in streaming mode, for near-real-time output
+	StreamHits();
+
 	return nblock+1;
 	
 }
@@ -912,15 +1158,38 @@ int MiniballMidasConverter::ConvertFile( std::string input_file_name,
 	// Uncomment to force only a few blocks - debug
 	//end_block = 1000;
 	
-	// Read the file.
-	std::ifstream input_file( input_file_name, std::ios::in|std::ios::binary );
-	if( !input_file.is_open() ){
+	// Open the file
+	FILE *fp = fopen( input_file_name.data(), "rb" );
+	if( !fp ){
 		
 		std::cout << "Cannot open " << input_file_name << std::endl;
 		return -1;
 		
 	}
 
+	// Calculate the size of the file.
+	fseek( fp, 0, SEEK_END );
+	unsigned long long int FILE_SIZE = ftell(fp);
+	if( FILE_SIZE == 0 ){
+		
+		std::cout << "Empty file " << input_file_name << std::endl;
+		fclose(fp);
+		return 0;
+		
+	}
+	
+	// Map the whole file into virtual memory and decode the blocks in place.
+	// The kernel does the read-ahead for us, which we encourage with madvise
+	const char *file_ptr = (const char *)mmap( nullptr, FILE_SIZE, PROT_READ, MAP_SHARED, fileno(fp), 0 );
+	if( file_ptr == MAP_FAILED ) {
+		
+		std::cerr << __FUNCTION__ << ": Error mapping MIDAS file " << input_file_name << std::endl;
+		fclose(fp);
+		return -1;
+		
+	}
+	madvise( (void*)file_ptr, FILE_SIZE, MADV_SEQUENTIAL );
+
 	// Conversion starting
 	std::cout << "Converting MIDAS file: " << input_file_name;
 	std::cout << " from block " << start_block << std::endl;
@@ -928,13 +1197,9 @@ int MiniballMidasConverter::ConvertFile( std::string input_file_name,
 	// Reset counters and data vectors to zero for every file
 	StartFile();
 
-	// Calculate the size of the file.
-	input_file.seekg( 0, input_file.end );
-	unsigned long long int size_end = input_file.tellg();
-	input_file.seekg( 0, input_file.beg );
-	unsigned long long int size_beg = input_file.tellg();
-	unsigned long long int FILE_SIZE = size_end - size_beg;
-	
+	// Random numbers for the calibration belong to this file
+	cal->SetRandomKey( PhiloxKey( input_file_name ) );
+
 	// Calculate the number of blocks in the file.
 	BLOCKS_NUM = FILE_SIZE / DATA_BLOCK_SIZE;
 	
@@ -958,6 +1223,58 @@ int MiniballMidasConverter::ConvertFile( std::string input_file_name,
 	// The information is split into 2 words of 32 bits (4 byte).
 	// We will collect the data in 64 bit words and split later
 	
+	// Range of blocks that we actually want to process
+	unsigned long first_block = start_block;
+	unsigned long last_block = BLOCKS_NUM;
+	if( end_block > 0 && (unsigned long)end_block + 1 < last_block )
+		last_block = end_block + 1;
+
+	// In multi-threaded mode, the worker threads decode batches of blocks
+	// in the background. We then replay them here in the correct order, so
+	// that the timestamp extension and buffer rejection are the same as before
+	const unsigned long batch_size = 64 * nthreads;
+	std::vector<MidasBlock> current_batch, next_batch;
+	unsigned long current_first = first_block;
+	unsigned long next_first = first_block;
+	std::thread batch_thread;
+	
+	// Was the block before the first one full? Needed for the buffer rejection
+	const bool first_prev_full = buffer_full;
+	
+	// Function to decode a batch of blocks with all the worker threads
+	auto decode_batch = [&]( unsigned long first, std::vector<MidasBlock> &blocks ) {
+		
+		std::atomic<unsigned long> next_block( 0 );
+		std::vector<std::thread> workers;
+		for( unsigned int t = 0; t < nthreads; ++t ) {
+			
+			workers.emplace_back( [&]() {
+				unsigned long k;
+				while( ( k = next_block++ ) < blocks.size() ) {
+					const char *blk_ptr = file_ptr + ( first + k ) * DATA_BLOCK_SIZE;
+					bool prev_full = first_prev_full;
+					if( first + k > first_block )
+						prev_full = BlockDataLength( blk_ptr - DATA_BLOCK_SIZE ) == WORD_SIZE;
+					DecodeBlock( blk_ptr, blk_ptr + HEADER_SIZE, prev_full, blocks[k] );
+				}
+			} );
+			
+		}
+		
+		for( unsigned int t = 0; t < workers.size(); ++t )
+			workers[t].join();
+		
+	};
+
+	// Start decoding the first batch
+	if( nthreads > 1 && first_block < last_block ) {
+		
+		ROOT::EnableThreadSafety();
+		next_batch.resize( std::min( batch_size, last_block - first_block ) );
+		batch_thread = std::thread( decode_batch, next_first, std::ref( next_batch ) );
+		
+	}
+	
 	// Loop over all the blocks.
 	for( unsigned long nblock = 0; nblock < BLOCKS_NUM ; nblock++ ){
 		
@@ -983,23 +1300,57 @@ int MiniballMidasConverter::ConvertFile( std::string input_file_name,
 		}
 		
 		
-		// Get the header.
-		input_file.read( (char*)&block_header, HEADER_SIZE );
-		// Get the block
-		input_file.read( (char*)&block_data, MAIN_SIZE );
-
-
 		// Check if we are before the start block or after the end block
 		if( nblock < start_block || ( (long)nblock > end_block && end_block > 0 ) )
 			continue;
 
+		// Get the header and the block directly from the mapped file
+		block_header = file_ptr + nblock * DATA_BLOCK_SIZE;
+		block_data = block_header + HEADER_SIZE;
+
+		// Get the decoded block from the worker threads
+		if( nthreads > 1 ) {
+			
+			// Wait for the next batch if we finished this one
+			if( nblock >= current_first + current_batch.size() ) {
+				
+				batch_thread.join();
+				current_batch.swap( next_batch );
+				current_first = next_first;
+				
+				// and start on the one after while we deal with this one
+				next_first = current_first + current_batch.size();
+				if( next_first < last_block ) {
+					
+					next_batch.resize( std::min( batch_size, last_block - next_first ) );
+					batch_thread = std::thread( decode_batch, next_first, std::ref( next_batch ) );
+					
+				}
+				
+			}
+			
+			decoded_block = &current_batch[ nblock - current_first ];
+			
+		}
+
 
 		// Process current block. If it's the end, stop.
 		if( !ProcessCurrentBlock( nblock ) ) break;
+
+		// Write out what we can in streaming mode,
+		// or spill to disk if we're running out of memory
+		StreamHits();
+		SpillHits();
 		
 	} // loop - nblock < BLOCKS_NUM
 	
-	input_file.close();
+	// Make sure the workers are finished before we unmap
+	if( batch_thread.joinable() ) batch_thread.join();
+	decoded_block = nullptr;
+	
+	// Unmap and close the file
+	munmap( (void*)file_ptr, FILE_SIZE );
+	fclose(fp);
 
 	// Print the number of warps and jumps
 	sslogs << "Number of timestamp jumps  = " << jump_ctr;
@@ -0,0 +1,111 @@
+#include "RadixSort.hh"
+
+// Byte number d of the key, with the sign bit flipped so that
+// negative times come before positive ones
+static inline unsigned int RadixDigit( long long int key, unsigned int d ) {
+
+	unsigned long long int ukey = (unsigned long long int)key ^ ( 1ULL << 63 );
+	return ( ukey >> ( 8 * d ) ) & 0xFF;
+
+}
+
+void RadixSort( std::pair<long long int,unsigned long> *data, unsigned long n,
+			    unsigned int nthreads ) {
+
+	if( n < 2 ) return;
+
+	// Threads are only worth it for big inputs
+	const unsigned long min_per_thread = 1UL << 16;
+	if( nthreads < 1 ) nthreads = 1;
+	if( n / nthreads < min_per_thread ) nthreads = std::max( 1UL, n / min_per_thread );
+
+	// Histogram of every byte in one go
+	std::vector<unsigned long> count( 8 * 256, 0 );
+	for( unsigned long i = 0; i < n; ++i )
+		for( unsigned int d = 0; d < 8; ++d )
+			count[ d * 256 + RadixDigit( data[i].first, d ) ]++;
+
+	// Buffer to scatter into, we swap between this and the input
+	std::vector<std::pair<long long int,unsigned long>> buffer( n );
+	std::pair<long long int,unsigned long> *src = data;
+	std::pair<long long int,unsigned long> *dst = buffer.data();
+
+	// Each thread takes a contiguous slice of the input
+	std::vector<unsigned long> slice( nthreads + 1 );
+	for( unsigned int t = 0; t <= nthreads; ++t )
+		slice[t] = n * t / nthreads;
+
+	// Per-thread bucket counts and offsets for the parallel passes
+	std::vector<std::vector<unsigned long>> offset( nthreads, std::vector<unsigned long>( 256 ) );
+
+	for( unsigned int d = 0; d < 8; ++d ) {
+
+		// Skip this byte if it is the same for all of them
+		unsigned long *cnt = &count[ d * 256 ];
+		if( *std::max_element( cnt, cnt + 256 ) == n ) continue;
+
+		if( nthreads == 1 ) {
+
+			// Start of each bucket
+			unsigned long pos = 0;
+			for( unsigned int b = 0; b < 256; ++b ) {
+				offset[0][b] = pos;
+				pos += cnt[b];
+			}
+
+			for( unsigned long i = 0; i < n; ++i )
+				dst[ offset[0][ RadixDigit( src[i].first, d ) ]++ ] = src[i];
+
+		}
+
+		else {
+
+			// Count the buckets in each slice
+			std::vector<std::thread> workers;
+			for( unsigned int t = 0; t < nthreads; ++t ) {
+
+				workers.emplace_back( [&,t]() {
+					std::fill( offset[t].begin(), offset[t].end(), 0 );
+					for( unsigned long i = slice[t]; i < slice[t+1]; ++i )
+						offset[t][ RadixDigit( src[i].first, d ) ]++;
+				} );
+
+			}
+			for( unsigned int t = 0; t < nthreads; ++t )
+				workers[t].join();
+			workers.clear();
+
+			// Start of each bucket for each slice, earlier slices go first
+			unsigned long pos = 0;
+			for( unsigned int b = 0; b < 256; ++b ) {
+				for( unsigned int t = 0; t < nthreads; ++t ) {
+					unsigned long c = offset[t][b];
+					offset[t][b] = pos;
+					pos += c;
+				}
+			}
+
+			// Scatter each slice into its own places
+			for( unsigned int t = 0; t < nthreads; ++t ) {
+
+				workers.emplace_back( [&,t]() {
+					for( unsigned long i = slice[t]; i < slice[t+1]; ++i )
+						dst[ offset[t][ RadixDigit( src[i].first, d ) ]++ ] = src[i];
+				} );
+
+			}
+			for( unsigned int t = 0; t < nthreads; ++t )
+				workers[t].join();
+
+		}
+
+		std::swap( src, dst );
+
+	}
+
+	// Make sure the result ends up in the input
+	if( src != data ) std::copy( src, src + n, data );
+
+	return;
+
+}
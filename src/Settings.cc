@@ -1,5 +1,10 @@
 #include "Settings.hh"
 
+// Binary cache header
+#ifndef __CONFIGCACHE_HH
+# include "ConfigCache.hh"
+#endif
+
 ClassImp(MiniballSettings)
 
 MiniballSettings::MiniballSettings() {
@@ -135,6 +140,11 @@ void MiniballSettings::TestSettings() {
 
 void MiniballSettings::ReadSettings() {
 	
+	// If the file hasn't changed since last time, take it from the cache
+	unsigned long long key;
+	bool cache = ConfigFileHash( fInputFile, key );
+	if( cache && ReadCache( key ) ) return;
+
 	TEnv *config = new TEnv( fInputFile.data() );
 	
 	// FEBEX initialisation
@@ -259,12 +269,16 @@ void MiniballSettings::ReadSettings() {
 	// Data things
 	block_size			= config->GetValue( "DataBlockSize", 0x10000 );
 	flag_febex_only		= config->GetValue( "FebexOnlyData", true );
+	stream_window		= config->GetValue( "StreamWatermark", 0.0 );
+	stream_idle			= config->GetValue( "StreamIdleBlocks", 1000 );
+	sort_mem_limit		= config->GetValue( "SortMemoryLimit", 0 );
 
 	
 	// Pileup and clipped rejection
 	pileup_reject		= config->GetValue( "PileupRejection",
 								config->GetValue( "PileUpRejection", false ) );
 	clipped_reject		= config->GetValue( "ClippedRejection", true );
+	pileup_recover		= config->GetValue( "PileupRecovery", false );
 
 	
 	// Buffer full rejection
@@ -922,6 +936,280 @@ void MiniballSettings::ReadSettings() {
 	// Finished
 	delete config;
 	
+	// Flat tables for looking up each hit
+	BuildChannelMaps();
+	
+	// Save it for next time
+	if( cache ) WriteCache( key );
+	
+}
+
+void MiniballSettings::BuildChannelMaps() {
+	
+	// ID from one of the channel maps, or -1 if it's not in there
+	auto map_id = []( const std::vector<std::vector<std::vector<int>>> &v,
+					  unsigned int i, unsigned int j, unsigned int k ) {
+		if( i < v.size() && j < v[i].size() && k < v[i][j].size() )
+			return (short)v[i][j][k];
+		return (short)-1;
+	};
+	
+	// Empty entry for channels with nothing plugged in
+	MiniballChannelID empty;
+	empty.type = DET_NONE;
+	for( unsigned int n = 0; n < 4; ++n ) empty.id[n] = -1;
+	
+	// The first detector found wins, in the same order as the event builder used to check them
+	auto fill = [&]( unsigned int i, unsigned int j, unsigned int k,
+					 bool febex, bool dgf, bool adc ) {
+		
+		MiniballChannelID c = empty;
+		
+		if( ( febex || dgf ) && map_id( mb_cluster, i, j, k ) >= 0 ) {
+			c.type = DET_MINIBALL;
+			c.id[0] = map_id( mb_cluster, i, j, k );
+			c.id[1] = map_id( mb_crystal, i, j, k );
+			c.id[2] = map_id( mb_segment, i, j, k );
+		}
+		else if( ( febex || adc ) && map_id( cd_det, i, j, k ) >= 0 ) {
+			c.type = DET_CD;
+			c.id[0] = map_id( cd_det, i, j, k );
+			c.id[1] = map_id( cd_sector, i, j, k );
+			c.id[2] = map_id( cd_side, i, j, k );
+			c.id[3] = map_id( cd_strip, i, j, k );
+		}
+		else if( ( febex || adc ) && map_id( pad_det, i, j, k ) >= 0 ) {
+			c.type = DET_PAD;
+			c.id[0] = map_id( pad_det, i, j, k );
+			c.id[1] = map_id( pad_sector, i, j, k );
+		}
+		else if( febex && map_id( spede_seg, i, j, k ) >= 0 ) {
+			c.type = DET_SPEDE;
+			c.id[0] = map_id( spede_seg, i, j, k );
+		}
+		else if( ( febex || dgf ) && map_id( bd_det, i, j, k ) >= 0 ) {
+			c.type = DET_BEAMDUMP;
+			c.id[0] = map_id( bd_det, i, j, k );
+		}
+		else if( ( febex || adc ) && map_id( ic_layer, i, j, k ) >= 0 ) {
+			c.type = DET_IONCHAMBER;
+			c.id[0] = map_id( ic_layer, i, j, k );
+		}
+		else if( febex && map_id( pulser, i, j, k ) >= 0 ) {
+			c.type = DET_PULSER;
+			c.id[0] = map_id( pulser, i, j, k );
+		}
+		
+		return c;
+		
+	};
+	
+	// FEBEX
+	map_febex_sfp = n_febex_sfp;
+	map_febex_board = n_febex_board;
+	map_febex_ch = n_febex_ch;
+	febex_map.assign( map_febex_sfp * map_febex_board * map_febex_ch + 1, empty );
+	for( unsigned int i = 0; i < map_febex_sfp; ++i )
+		for( unsigned int j = 0; j < map_febex_board; ++j )
+			for( unsigned int k = 0; k < map_febex_ch; ++k )
+				febex_map[ ( i * map_febex_board + j ) * map_febex_ch + k ] = fill( i, j, k, true, false, false );
+
+	// DGFs are in the first row of the maps
+	map_dgf_mod = n_dgf_mod;
+	map_dgf_ch = n_dgf_ch;
+	dgf_map.assign( map_dgf_mod * map_dgf_ch + 1, empty );
+	for( unsigned int j = 0; j < map_dgf_mod; ++j )
+		for( unsigned int k = 0; k < map_dgf_ch; ++k )
+			dgf_map[ j * map_dgf_ch + k ] = fill( 0, j, k, false, true, false );
+
+	// ADCs too
+	map_adc_mod = GetNumberOfAdcModules();
+	map_adc_ch = GetMaximumNumberOfAdcChannels();
+	adc_map.assign( map_adc_mod * map_adc_ch + 1, empty );
+	for( unsigned int j = 0; j < map_adc_mod; ++j )
+		for( unsigned int k = 0; k < map_adc_ch; ++k )
+			adc_map[ j * map_adc_ch + k ] = fill( 0, j, k, false, false, true );
+
+}
+
+template<typename A>
+void MiniballSettings::CacheItems( A &ar ) {
+	
+	// FEBEX and old DAQ
+	ar.Item( n_febex_sfp );
+	ar.Item( n_febex_board );
+	ar.Item( n_febex_ch );
+	ar.Item( n_dgf_mod );
+	ar.Item( n_dgf_ts_mod );
+	ar.Item( n_dgf_ch );
+	ar.Item( dgf_mod_offset );
+	ar.Item( dgf_ts_mod_offset );
+	ar.Item( n_caen_mod );
+	ar.Item( n_caen_ch );
+	ar.Item( caen_mod_offset );
+	ar.Item( n_madc_mod );
+	ar.Item( n_madc_ch );
+	ar.Item( madc_mod_offset );
+	ar.Item( n_pattern_unit );
+	ar.Item( pattern_unit_offset );
+	ar.Item( n_scaler_unit );
+	ar.Item( scaler_unit_offset );
+	ar.Item( dgf_vme_first );
+	ar.Item( dgf_vme_last );
+	ar.Item( adc_vme_first );
+	ar.Item( adc_vme_last );
+	ar.Item( scaler_vme_first );
+	ar.Item( scaler_vme_last );
+	ar.Item( pattern_vme_first );
+	ar.Item( pattern_vme_last );
+	ar.Item( dgfscaler_vme_first );
+	ar.Item( dgfscaler_vme_last );
+
+	// Miniball
+	ar.Item( n_mb_cluster );
+	ar.Item( n_mb_crystal );
+	ar.Item( n_mb_segment );
+	ar.Item( mb_sfp );
+	ar.Item( mb_board );
+	ar.Item( mb_dgf );
+	ar.Item( mb_ch );
+	ar.Item( mb_veto );
+	ar.Item( mb_cluster );
+	ar.Item( mb_crystal );
+	ar.Item( mb_segment );
+
+	// CD and PAD
+	ar.Item( n_cd_det );
+	ar.Item( n_cd_sector );
+	ar.Item( n_cd_side );
+	ar.Item( n_cd_pstrip );
+	ar.Item( n_cd_nstrip );
+	ar.Item( cd_sfp );
+	ar.Item( cd_board );
+	ar.Item( cd_adc );
+	ar.Item( cd_ch );
+	ar.Item( cd_det );
+	ar.Item( cd_sector );
+	ar.Item( cd_side );
+	ar.Item( cd_strip );
+	ar.Item( pad_sfp );
+	ar.Item( pad_board );
+	ar.Item( pad_adc );
+	ar.Item( pad_ch );
+	ar.Item( pad_det );
+	ar.Item( pad_sector );
+
+	// Beam dump, SPEDE and IonChamber
+	ar.Item( n_bd_det );
+	ar.Item( bd_sfp );
+	ar.Item( bd_board );
+	ar.Item( bd_dgf );
+	ar.Item( bd_ch );
+	ar.Item( bd_det );
+	ar.Item( n_spede_seg );
+	ar.Item( spede_sfp );
+	ar.Item( spede_board );
+	ar.Item( spede_dgf );
+	ar.Item( spede_ch );
+	ar.Item( spede_seg );
+	ar.Item( n_ic_layer );
+	ar.Item( ic_sfp );
+	ar.Item( ic_board );
+	ar.Item( ic_adc );
+	ar.Item( ic_ch );
+	ar.Item( ic_layer );
+
+	// Pulsers
+	ar.Item( n_pulsers );
+	ar.Item( pulser_sfp );
+	ar.Item( pulser_board );
+	ar.Item( pulser_ch );
+	ar.Item( pulser );
+
+	// Info codes
+	ar.Item( sync_msb_code );
+	ar.Item( sync_hsb_code );
+	ar.Item( tm_msb_code );
+	ar.Item( tm_hsb_code );
+	ar.Item( pause_code );
+	ar.Item( resume_code );
+	ar.Item( pulser_code );
+	ar.Item( ebis_sfp );
+	ar.Item( ebis_dgf );
+	ar.Item( ebis_board );
+	ar.Item( ebis_ch );
+	ar.Item( ebis_code );
+	ar.Item( t1_sfp );
+	ar.Item( t1_dgf );
+	ar.Item( t1_board );
+	ar.Item( t1_ch );
+	ar.Item( t1_code );
+	ar.Item( sc_sfp );
+	ar.Item( sc_dgf );
+	ar.Item( sc_board );
+	ar.Item( sc_ch );
+	ar.Item( sc_code );
+	ar.Item( laser_sfp );
+	ar.Item( laser_board );
+	ar.Item( laser_ch );
+	ar.Item( laser_pattern );
+	ar.Item( laser_code );
+
+	// Event builder and hit windows
+	ar.Item( event_window );
+	ar.Item( mbs_event_sort );
+	ar.Item( mb_hit_window );
+	ar.Item( ab_hit_window );
+	ar.Item( cd_hit_window );
+	ar.Item( pad_hit_window );
+	ar.Item( ic_hit_window );
+
+	// Data format, rejection and timestamps
+	ar.Item( block_size );
+	ar.Item( flag_febex_only );
+	ar.Item( stream_window );
+	ar.Item( stream_idle );
+	ar.Item( sort_mem_limit );
+	ar.Item( pileup_reject );
+	ar.Item( clipped_reject );
+	ar.Item( pileup_recover );
+	ar.Item( bufferfull_reject );
+	ar.Item( bufferpart_reject );
+	ar.Item( dgf_ts_delay );
+	ar.Item( dgf_ts_units );
+	ar.Item( caen_ts_units );
+	ar.Item( madc_ts_units );
+
+}
+
+bool MiniballSettings::ReadCache( unsigned long long key ) {
+	
+	MiniballCacheReader ar;
+	if( !ar.Open( ConfigCacheName( fInputFile, "settings" ), key ) )
+		return false;
+	
+	CacheItems( ar );
+	if( ar.Good() ) {
+		
+		// The flat tables are made again rather than cached
+		BuildChannelMaps();
+		return true;
+		
+	}
+	
+	// Something was wrong with it, so we'll read the text instead
+	std::cerr << "Ignoring bad settings cache for " << fInputFile << std::endl;
+	return false;
+	
+}
+
+void MiniballSettings::WriteCache( unsigned long long key ) {
+	
+	// It doesn't matter if this fails, we just read the text next time
+	MiniballCacheWriter ar;
+	CacheItems( ar );
+	ar.Save( ConfigCacheName( fInputFile, "settings" ), key );
+	
 }
 
 
@@ -983,7 +1271,7 @@ bool MiniballSettings::IsMiniballSegmentVetoed( unsigned int clu, unsigned int c
 }
 
 int MiniballSettings::GetMiniballID( unsigned int dgf, unsigned int ch,
-							 std::vector<std::vector<std::vector<int>>> vector ) {
+							 const std::vector<std::vector<std::vector<int>>> &vector ) {
 	
 	/// Return the Miniball ID by the DGF module number and Channel number
 	if( dgf < n_dgf_mod && ch < n_dgf_ch )
@@ -1000,7 +1288,7 @@ int MiniballSettings::GetMiniballID( unsigned int dgf, unsigned int ch,
 }
 
 int MiniballSettings::GetMiniballID( unsigned int sfp, unsigned int board, unsigned int ch,
-							 std::vector<std::vector<std::vector<int>>> vector ) {
+							 const std::vector<std::vector<std::vector<int>>> &vector ) {
 	
 	/// Return the Miniball ID by the FEBEX SFP, Board number and Channel number
 	if( sfp < n_febex_sfp && board < n_febex_board && ch < n_febex_ch )
@@ -1060,7 +1348,7 @@ bool MiniballSettings::IsCD( unsigned int sfp, unsigned int board, unsigned int
 }
 
 int MiniballSettings::GetCDID( unsigned int adc, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector ) {
+					  const std::vector<std::vector<std::vector<int>>> &vector ) {
 	
 	/// Return the CD ID by the FEBEX SFP, Board number and Channel number
 	if( adc < GetNumberOfAdcModules() && ch < GetMaximumNumberOfAdcChannels() )
@@ -1077,7 +1365,7 @@ int MiniballSettings::GetCDID( unsigned int adc, unsigned int ch,
 }
 
 int MiniballSettings::GetCDID( unsigned int sfp, unsigned int board, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector ) {
+					  const std::vector<std::vector<std::vector<int>>> &vector ) {
 	
 	/// Return the CD ID by the FEBEX SFP, Board number and Channel number
 	if( sfp < n_febex_sfp && board < n_febex_board && ch < n_febex_ch )
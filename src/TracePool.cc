@@ -0,0 +1,173 @@
+#include "TracePool.hh"
+
+MiniballTracePool::MiniballTracePool() {
+
+	queue = std::make_unique<MiniballTraceJob[]>( QUEUE_SIZE );
+	for( unsigned long i = 0; i < QUEUE_SIZE; ++i )
+		queue[i].seq.store( i, std::memory_order_relaxed );
+
+	head.store( 0, std::memory_order_relaxed );
+	tail.store( 0, std::memory_order_relaxed );
+	ndone.store( 0, std::memory_order_relaxed );
+	nsubmitted = 0;
+	stop.store( false, std::memory_order_relaxed );
+	cal = nullptr;
+
+}
+
+MiniballTracePool::~MiniballTracePool() {
+
+	Stop();
+
+}
+
+void MiniballTracePool::Start( unsigned int nworkers, std::shared_ptr<MiniballCalibration> mycal ) {
+
+	// Make sure the old workers are finished with
+	Stop();
+
+	// Empty queue
+	for( unsigned long i = 0; i < QUEUE_SIZE; ++i )
+		queue[i].seq.store( i, std::memory_order_relaxed );
+	head.store( 0, std::memory_order_relaxed );
+	tail.store( 0, std::memory_order_relaxed );
+	ndone.store( 0, std::memory_order_relaxed );
+	nsubmitted = 0;
+
+	// One shard for each worker and one for us
+	cal = mycal;
+	shards.clear();
+	shards.resize( nworkers + 1 );
+
+	stop.store( false, std::memory_order_release );
+	for( unsigned int i = 0; i < nworkers; ++i )
+		workers.emplace_back( &MiniballTracePool::Work, this, i );
+
+}
+
+void MiniballTracePool::Stop() {
+
+	stop.store( true, std::memory_order_release );
+	for( auto &w : workers ) w.join();
+	workers.clear();
+
+}
+
+void MiniballTracePool::Submit( unsigned char sfp, unsigned char board, unsigned char ch,
+							    const unsigned short *samples, unsigned int nsamples ) {
+
+	// Only this thread moves the head, so no need to compare-and-swap
+	unsigned long pos = head.load( std::memory_order_relaxed );
+	MiniballTraceJob &job = queue[ pos & QUEUE_MASK ];
+
+	// Wait for the slot to be free, doing other traces in the meantime
+	while( job.seq.load( std::memory_order_acquire ) != pos ) {
+
+		if( !RunOne( shards.back() ) )
+			std::this_thread::yield();
+
+	}
+
+	// Fill the slot and let the workers have it
+	job.sfp = sfp;
+	job.board = board;
+	job.ch = ch;
+	job.samples.assign( samples, samples + nsamples );
+	job.seq.store( pos + 1, std::memory_order_release );
+	head.store( pos + 1, std::memory_order_relaxed );
+	nsubmitted++;
+
+	return;
+
+}
+
+bool MiniballTracePool::RunOne( MiniballTraceShard &shard ) {
+
+	// Claim the next full slot
+	unsigned long pos = tail.load( std::memory_order_relaxed );
+	MiniballTraceJob *job;
+	while( true ) {
+
+		job = &queue[ pos & QUEUE_MASK ];
+		long dif = (long)job->seq.load( std::memory_order_acquire ) - (long)( pos + 1 );
+
+		// It's full, try to take it. If someone else got there
+		// first, pos is updated to the next one to try
+		if( dif == 0 ) {
+
+			if( tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+				break;
+
+		}
+
+		// Nothing in the queue
+		else if( dif < 0 ) return false;
+
+		// Someone else took it already
+		else pos = tail.load( std::memory_order_relaxed );
+
+	}
+
+	// Do the MWD and keep the energies for later
+	const FebexMWD &mwd = cal->DoMWDEnergy( job->sfp, job->board, job->ch, job->samples );
+	for( unsigned int i = 0; i < mwd.NumberOfTriggers(); ++i ) {
+
+		MiniballTraceEnergy e;
+		e.sfp = job->sfp;
+		e.board = job->board;
+		e.ch = job->ch;
+
+		// Same as the Qint from the inline MWD in the MBS converter
+		if( mwd.GetEnergy(i) > 0 ) e.Qint = mwd.GetEnergy(i);
+		else e.Qint = 0;
+		shard.energies.push_back( e );
+
+	}
+
+	// Free the slot for the next time around the queue
+	job->seq.store( pos + QUEUE_SIZE, std::memory_order_release );
+	ndone.fetch_add( 1, std::memory_order_release );
+
+	return true;
+
+}
+
+void MiniballTracePool::Work( unsigned int id ) {
+
+	// Spin for a while when the queue is empty, then sleep
+	unsigned int idle = 0;
+	while( !stop.load( std::memory_order_acquire ) ) {
+
+		if( RunOne( shards[id] ) ) idle = 0;
+		else if( ++idle < 64 ) std::this_thread::yield();
+		else std::this_thread::sleep_for( std::chrono::microseconds(50) );
+
+	}
+
+	return;
+
+}
+
+void MiniballTracePool::Drain( std::vector<std::vector<std::vector<TH1F*>>> &hists ) {
+
+	// Wait for the workers, or do the traces ourselves
+	while( ndone.load( std::memory_order_acquire ) < nsubmitted ) {
+
+		if( !RunOne( shards.back() ) )
+			std::this_thread::yield();
+
+	}
+
+	// Everything in the shards is finished with now
+	for( auto &shard : shards ) {
+
+		for( const auto &e : shard.energies )
+			hists[e.sfp][e.board][e.ch]->Fill( e.Qint );
+
+		shard.energies.clear();
+
+	}
+
+	return;
+
+}
@@ -0,0 +1,252 @@
+#include "TraceUnpack.hh"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+# define TRACEUNPACK_X86
+#endif
+
+// The end of a MIDAS trace is marked by this in the upper 32 bits
+static const unsigned int MIDAS_TRACE_END = 0x5E5E5E5E;
+
+// Put a 64-bit word in sample order. The first sample is in the upper 32
+// bits of the word, so after any swapping the two halves are swapped again,
+// unless the word swapping already did it.
+static inline unsigned long long MidasSampleOrder( unsigned long long w,
+												   bool swap_endian, bool swap_words ) {
+
+	if( swap_endian ) w = __builtin_bswap64( w );
+	if( !swap_words ) w = ( w >> 32 ) | ( w << 32 );
+	return w;
+
+}
+
+// Put a 64-bit word in native order
+static inline unsigned long long MidasNativeOrder( unsigned long long w,
+												   bool swap_endian, bool swap_words ) {
+
+	if( swap_endian ) w = __builtin_bswap64( w );
+	if( swap_words ) w = ( w >> 32 ) | ( w << 32 );
+	return w;
+
+}
+
+static void SwapMidasWordsScalar( const unsigned long long *words, unsigned int nwords,
+								  bool swap_endian, bool swap_words,
+								  unsigned long long *out ) {
+
+	for( unsigned int i = 0; i < nwords; ++i )
+		out[i] = MidasNativeOrder( words[i], swap_endian, swap_words );
+
+	return;
+
+}
+
+static unsigned int UnpackMidasTraceScalar( const unsigned long long *words, unsigned int nwords,
+											bool swap_endian, bool swap_words,
+											unsigned short *samples ) {
+
+	for( unsigned int i = 0; i < nwords; ++i ) {
+
+		unsigned long long w = MidasSampleOrder( words[i], swap_endian, swap_words );
+		if( ( w & 0xFFFFFFFF ) == MIDAS_TRACE_END ) return i;
+
+		samples[4*i+0] = w & 0xFFFF;
+		samples[4*i+1] = ( w >> 16 ) & 0xFFFF;
+		samples[4*i+2] = ( w >> 32 ) & 0xFFFF;
+		samples[4*i+3] = ( w >> 48 ) & 0xFFFF;
+
+	}
+
+	return nwords;
+
+}
+
+#ifdef TRACEUNPACK_X86
+
+// Byte shuffle for each 64-bit word that does the swapping and puts
+// the samples in order, see MidasSampleOrder
+static inline const char* MidasShuffle( bool swap_endian, bool swap_words ) {
+
+	static const char shuffle[4][16] = {
+		{ 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15,  8,  9, 10, 11 },	// halves only
+		{ 0, 1, 2, 3, 4, 5, 6, 7,  8,  9, 10, 11, 12, 13, 14, 15 },	// word swap undoes it
+		{ 3, 2, 1, 0, 7, 6, 5, 4, 11, 10,  9,  8, 15, 14, 13, 12 },	// endian, then halves
+		{ 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10,  9,  8 }	// endian and word swap
+	};
+
+	return shuffle[ 2 * swap_endian + swap_words ];
+
+}
+
+// The native order is the sample order without the extra swap of the
+// two halves, so it is the same shuffle with the word swap flipped
+__attribute__((target("ssse3")))
+static void SwapMidasWordsSSSE3( const unsigned long long *words, unsigned int nwords,
+								 bool swap_endian, bool swap_words,
+								 unsigned long long *out ) {
+
+	const __m128i shuffle = _mm_loadu_si128( (const __m128i*)MidasShuffle( swap_endian, !swap_words ) );
+
+	unsigned int i = 0;
+	for( ; i + 2 <= nwords; i += 2 ) {
+
+		__m128i w = _mm_loadu_si128( (const __m128i*)( words + i ) );
+		_mm_storeu_si128( (__m128i*)( out + i ), _mm_shuffle_epi8( w, shuffle ) );
+
+	}
+
+	SwapMidasWordsScalar( words + i, nwords - i, swap_endian, swap_words, out + i );
+
+	return;
+
+}
+
+__attribute__((target("avx2")))
+static void SwapMidasWordsAVX2( const unsigned long long *words, unsigned int nwords,
+								bool swap_endian, bool swap_words,
+								unsigned long long *out ) {
+
+	const __m256i shuffle = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128( (const __m128i*)MidasShuffle( swap_endian, !swap_words ) ) );
+
+	unsigned int i = 0;
+	for( ; i + 4 <= nwords; i += 4 ) {
+
+		__m256i w = _mm256_loadu_si256( (const __m256i*)( words + i ) );
+		_mm256_storeu_si256( (__m256i*)( out + i ), _mm256_shuffle_epi8( w, shuffle ) );
+
+	}
+
+	SwapMidasWordsScalar( words + i, nwords - i, swap_endian, swap_words, out + i );
+
+	return;
+
+}
+
+__attribute__((target("ssse3")))
+static unsigned int UnpackMidasTraceSSSE3( const unsigned long long *words, unsigned int nwords,
+										   bool swap_endian, bool swap_words,
+										   unsigned short *samples ) {
+
+	const __m128i shuffle = _mm_loadu_si128( (const __m128i*)MidasShuffle( swap_endian, swap_words ) );
+	const __m128i marker = _mm_set1_epi32( MIDAS_TRACE_END );
+
+	// Two words at a time, the end marker is in the lower half of each
+	unsigned int i = 0;
+	for( ; i + 2 <= nwords; i += 2 ) {
+
+		__m128i w = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)( words + i ) ), shuffle );
+		int end = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( w, marker ) ) ) & 0x5;
+		if( end ) break;
+		_mm_storeu_si128( (__m128i*)( samples + 4*i ), w );
+
+	}
+
+	return i + UnpackMidasTraceScalar( words + i, nwords - i, swap_endian, swap_words, samples + 4*i );
+
+}
+
+__attribute__((target("avx2")))
+static unsigned int UnpackMidasTraceAVX2( const unsigned long long *words, unsigned int nwords,
+										  bool swap_endian, bool swap_words,
+										  unsigned short *samples ) {
+
+	const __m256i shuffle = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128( (const __m128i*)MidasShuffle( swap_endian, swap_words ) ) );
+	const __m256i marker = _mm256_set1_epi32( MIDAS_TRACE_END );
+
+	// Four words at a time, the end marker is in the lower half of each
+	unsigned int i = 0;
+	for( ; i + 4 <= nwords; i += 4 ) {
+
+		__m256i w = _mm256_shuffle_epi8( _mm256_loadu_si256( (const __m256i*)( words + i ) ), shuffle );
+		int end = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( w, marker ) ) ) & 0x55;
+		if( end ) break;
+		_mm256_storeu_si256( (__m256i*)( samples + 4*i ), w );
+
+	}
+
+	return i + UnpackMidasTraceScalar( words + i, nwords - i, swap_endian, swap_words, samples + 4*i );
+
+}
+
+#endif
+
+#ifdef TRACEUNPACK_X86
+
+// Check once what the CPU can do
+static int SimdLevel() {
+
+	static const int simd_level = __builtin_cpu_supports("avx2") ? 2 :
+								  __builtin_cpu_supports("ssse3") ? 1 : 0;
+	return simd_level;
+
+}
+
+#endif
+
+void SwapMidasWords( const unsigned long long *words, unsigned int nwords,
+					 bool swap_endian, bool swap_words,
+					 unsigned long long *out ) {
+
+	// Nothing to swap, just a copy if needed
+	if( !swap_endian && !swap_words ) {
+		if( out != words ) std::memmove( out, words, nwords * sizeof(unsigned long long) );
+		return;
+	}
+
+#ifdef TRACEUNPACK_X86
+
+	int simd_level = SimdLevel();
+	if( simd_level == 2 )
+		return SwapMidasWordsAVX2( words, nwords, swap_endian, swap_words, out );
+	if( simd_level == 1 )
+		return SwapMidasWordsSSSE3( words, nwords, swap_endian, swap_words, out );
+
+#endif
+
+	return SwapMidasWordsScalar( words, nwords, swap_endian, swap_words, out );
+
+}
+
+unsigned int UnpackMidasTrace( const unsigned long long *words, unsigned int nwords,
+							   bool swap_endian, bool swap_words,
+							   unsigned short *samples ) {
+
+#ifdef TRACEUNPACK_X86
+
+	int simd_level = SimdLevel();
+	if( simd_level == 2 )
+		return UnpackMidasTraceAVX2( words, nwords, swap_endian, swap_words, samples );
+	if( simd_level == 1 )
+		return UnpackMidasTraceSSSE3( words, nwords, swap_endian, swap_words, samples );
+
+#endif
+
+	return UnpackMidasTraceScalar( words, nwords, swap_endian, swap_words, samples );
+
+}
+
+void UnpackMbsTrace( const unsigned int *words, unsigned int nwords,
+					 unsigned short mask, unsigned short *samples ) {
+
+	for( unsigned int i = 0; i < nwords; ++i ) {
+
+		samples[2*i+0] = words[i] & mask;
+		samples[2*i+1] = ( words[i] >> 16 ) & mask;
+
+	}
+
+	return;
+
+}
+
+void UnpackMbsFilterTrace( const unsigned int *words, unsigned int nwords,
+						   unsigned short mask, unsigned short *samples ) {
+
+	for( unsigned int i = 0; i < nwords; ++i )
+		samples[i] = ( words[i] >> 16 ) & mask;
+
+	return;
+
+}